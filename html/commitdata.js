@@ -58,7 +58,15 @@ function commitData()
     var xmlhttp=new XMLHttpRequest();
     xmlhttp.onreadystatechange=function() {
 	if (xmlhttp.readyState==4 && xmlhttp.status==200) {
-	    document.getElementById("txtHint").innerHTML=xmlhttp.responseText;
+	    var text = xmlhttp.responseText;
+	    if ( text.charAt( 0 ) == '{' ) {
+		// rejected by the validator, see validator.cpp 'write_json'
+		text = "COMMIT REJECTED;";
+		$(JSON.parse( xmlhttp.responseText ).errors).each( function() {
+		    text += " " + ( this.ch < 0 ? "interval" : "CH-" + ( this.ch + 1 ) ) + " " + this.code + " (" + this.value + ( this.unit || "" ) + ")";
+		});
+	    }
+	    document.getElementById("txtHint").innerHTML=text;
 	}
     }
 
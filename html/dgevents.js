@@ -12,6 +12,33 @@ source.addEventListener( 'tick', function( e ) {
     }
 }, false );
 
+// pulse changes made by any client, see dgctl.cpp 'delta_json'
+source.addEventListener( 'delta', function( e ) {
+    var json = JSON.parse( e.data );
+    $(json.delta).each( function() {
+	if ( this.id == 'interval' ) {
+	    $('div #interval').find( ':input' ).val( this.value );
+	} else if ( this.id == 'state' ) {
+	    var cbx = $('#switch-connect');
+	    if ( ( this.value != 0 ) != cbx.prop('checked') )
+		cbx.bootstrapToggle( this.value != 0 ? "on" : "off" );
+	} else {
+	    var elm = document.getElementById( this.id + '.' + "ABCDEFGH".charAt( this.ch ) );
+	    if ( elm ) {
+		if ( elm.type == 'checkbox' )
+		    elm.checked = ( this.value != 0 );
+		else
+		    elm.value = this.value;
+	    }
+	}
+    });
+}, false );
+
+// events missed while disconnected are no longer buffered on the server
+source.addEventListener( 'resync', function( e ) {
+    fetchStatus();
+}, false );
+
 source.onmessage = function(e) {
     var ev = document.getElementById( 'status' )
     if ( ev )
@@ -0,0 +1,37 @@
+// low latency control channel, see connection.cpp 'handle_ws_messages' and dgctl.cpp 'ws_request'
+var dgsocket = null;
+
+function openSocket() {
+    var scheme = ( location.protocol == 'https:' ) ? 'wss://' : 'ws://';
+    dgsocket = new WebSocket( scheme + location.host + '/dg/ws' );
+
+    dgsocket.onmessage = function( e ) {
+	var json = JSON.parse( e.data );
+	if ( json.error ) {
+	    document.getElementById("txtHint").innerHTML = json.error;
+	} else if ( json.errors ) {
+	    // rejected by the validator, see validator.cpp 'write_json'
+	    var text = "SET REJECTED;";
+	    json.errors.forEach( function( err ) {
+		text += " " + ( err.ch < 0 ? "interval" : "CH-" + ( err.ch + 1 ) ) + " " + err.code + " (" + err.value + ( err.unit || "" ) + ")";
+	    });
+	    document.getElementById("txtHint").innerHTML = text;
+	}
+    };
+
+    dgsocket.onclose = function( e ) {
+	dgsocket = null;
+	setTimeout( openSocket, 2000 );
+    };
+}
+
+// id is an input id such as 'PULSE.DELAY.A'; returns false if it can't go over the socket
+function socketSet( id, value ) {
+    var m = /^(PULSE\.(DELAY|WIDTH|POL|STATE))\.([A-H])$/.exec( id );
+    if ( !m || !dgsocket || dgsocket.readyState != WebSocket.OPEN )
+	return false;
+    dgsocket.send( JSON.stringify( { set: [ { id: m[1], ch: "ABCDEFGH".indexOf( m[3] ), value: Number( value ) } ] } ) );
+    return true;
+}
+
+openSocket();
@@ -14,6 +14,9 @@ function onValue(value,id) {
 
 function onEdit( elm ) {
 
+    if ( socketSet( elm.id, elm.value ) )
+	return;
+
     var xmlhttp=new XMLHttpRequest();
 
     xmlhttp.onreadystatechange=function() {
@@ -37,6 +40,9 @@ function onEdit( elm ) {
 
 function onChecked( elm ) {
 
+    if ( socketSet( elm.id, elm.checked ? 1 : 0 ) )
+	return;
+
     var xmlhttp=new XMLHttpRequest();
 
     xmlhttp.onreadystatechange=function() {
@@ -0,0 +1,382 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#include "arp_simulator.hpp"
+#include "log.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cstring>
+
+using namespace dg;
+
+namespace {
+
+    enum {
+        CMD_SFR_READ          = 0x10
+        , CMD_SFR_WRITE       = 0x20
+        , CMD_REG_READ        = 0x30
+        , CMD_REG_WRITE       = 0x31
+        , CMD_EP2468_INIT     = 0x34
+        , CMD_EPx_FIFO_RESET  = 0x35
+        , CMD_MODIFIED_DATE   = 0x40
+        , CMD_TCK_TOGGLE      = 0x44
+    };
+
+    enum { EZUSB_REG_FPGA_RESET = 0xe6c2 }; // 0xff releases reset
+
+    inline uint32_t le32( const uint8_t * p ) {
+        return uint32_t( p[0] ) | ( uint32_t( p[1] ) << 8 ) | ( uint32_t( p[2] ) << 16 ) | ( uint32_t( p[3] ) << 24 );
+    }
+
+    inline void put_le32( uint8_t * p, uint32_t v ) {
+        for ( int i = 0; i < 4; ++i )
+            p[ i ] = uint8_t( ( v >> ( 8 * i ) ) & 0xff );
+    }
+}
+
+arp_simulator *
+arp_simulator::instance()
+{
+    static arp_simulator __instance;
+    return &__instance;
+}
+
+arp_simulator::arp_simulator() : latency_( 125 ) // one full-speed microframe
+                               , per_byte_( 0 )
+                               , version_( "20170401" )
+                               , stats_{ 0, 0, 0, 0, 0, 0 }
+{
+    xdata_.fill( 0 );
+    sfr_.fill( 0 );
+}
+
+int
+arp_simulator::transfer( uint8_t endpoint, uint8_t * data, int length, int& transferred )
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+
+    transferred = 0;
+    if ( int rc = injected_fault( endpoint ) ) {
+        ++stats_.faults;
+        return rc;
+    }
+
+    if ( endpoint & 0x80 ) {
+        auto& q = replies_[ endpoint ];
+        if ( q.empty() )
+            return error_timeout;
+        auto packet = std::move( q.front() );
+        q.pop_front();
+        transferred = std::min( length, int( packet.size() ) );
+        std::copy( packet.begin(), packet.begin() + transferred, data );
+        ++stats_.in_transfers;
+        stats_.bytes += transferred;
+        return success;
+    }
+
+    if ( int rc = endpoint == RegBulkOut ? injected_write_fault( data, length ) : success ) {
+        ++stats_.faults;
+        return rc;
+    }
+
+    int rc = error_pipe;
+    if ( endpoint == RegBulkOut )
+        rc = reg_out( data, length );
+    else if ( endpoint == CmdBulkOut )
+        rc = cmd_out( data, length );
+
+    if ( rc == success ) {
+        transferred = length;
+        ++stats_.out_transfers;
+        stats_.bytes += length;
+    }
+    return rc;
+}
+
+bool
+arp_simulator::readable( uint8_t endpoint ) const
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    auto it = replies_.find( endpoint );
+    return it != replies_.end() && !it->second.empty();
+}
+
+int
+arp_simulator::reg_out( const uint8_t * p, int length )
+{
+    // frames: 14 08 00 00 addr[4]  |  15 0c 00 0f addr[4] data[4]
+    while ( length > 0 ) {
+        if ( length >= 8 && p[0] == 0x14 && p[1] == 0x08 ) {
+            std::vector< uint8_t > r( p, p + 8 );
+            put_le32( &r[4], read_reg( le32( p + 4 ) ) );
+            reply( RegBulkIn, std::move( r ) );
+            p += 8;
+            length -= 8;
+        } else if ( length >= 12 && p[0] == 0x15 && p[1] == 0x0c ) {
+            write_reg( le32( p + 4 ), le32( p + 8 ) );
+            std::vector< uint8_t > r( p, p + 8 );
+            put_le32( &r[4], le32( p + 8 ) );
+            reply( RegBulkIn, std::move( r ) );
+            p += 12;
+            length -= 12;
+        } else {
+            log( log::WARN ) << boost::format( "arp_simulator: malformed register frame 0x%02x 0x%02x, endpoint stalled" ) % int( p[0] ) % int( length > 1 ? p[1] : 0 );
+            return error_pipe;
+        }
+    }
+    return success;
+}
+
+int
+arp_simulator::cmd_out( const uint8_t * p, int length )
+{
+    const uint8_t * end = p + length;
+    while ( p < end ) {
+        size_t avail = end - p;
+        switch ( *p ) {
+        case CMD_SFR_READ:
+            if ( avail < 2 ) return error_pipe;
+            reply( CmdBulkIn, { sfr_[ p[1] ] } );
+            p += 2;
+            break;
+        case CMD_SFR_WRITE:
+            if ( avail < 3 ) return error_pipe;
+            sfr_[ p[1] ] = p[2];
+            p += 3;
+            break;
+        case CMD_REG_READ:
+            if ( avail < 3 ) return error_pipe;
+            reply( CmdBulkIn, { xdata_[ p[1] | ( p[2] << 8 ) ] } );
+            p += 3;
+            break;
+        case CMD_REG_WRITE:
+            if ( avail < 4 ) {
+                return error_pipe;
+            } else {
+                uint16_t addr = p[1] | ( p[2] << 8 );
+                xdata_[ addr ] = p[3];
+                if ( addr == EZUSB_REG_FPGA_RESET && p[3] != 0xff )
+                    fpga_reset();
+                p += 4;
+            }
+            break;
+        case CMD_EPx_FIFO_RESET:
+            for ( auto& q: replies_ )
+                q.second.clear();
+            ++p;
+            break;
+        case CMD_EP2468_INIT:
+        case CMD_TCK_TOGGLE:
+            ++p;
+            break;
+        case CMD_MODIFIED_DATE:
+            reply( CmdBulkIn, std::vector< uint8_t >( version_.begin(), version_.end() ) );
+            ++p;
+            break;
+        default:
+            log( log::WARN ) << boost::format( "arp_simulator: unknown command 0x%02x, endpoint stalled" ) % int( *p );
+            return error_pipe;
+        }
+    }
+    return success;
+}
+
+uint32_t
+arp_simulator::read_reg( uint32_t addr )
+{
+    ++stats_.reg_reads;
+    auto it = regs_.find( addr );
+    uint32_t value = it != regs_.end() ? it->second : 0;
+    auto hook = read_hooks_.find( addr );
+    if ( hook != read_hooks_.end() )
+        value = hook->second.first( value, hook->second.second++ );
+    return value;
+}
+
+void
+arp_simulator::write_reg( uint32_t addr, uint32_t value )
+{
+    ++stats_.reg_writes;
+    regs_[ addr ] = value;
+    auto hook = write_hooks_.find( addr );
+    if ( hook != write_hooks_.end() )
+        hook->second( value );
+}
+
+void
+arp_simulator::reply( uint8_t endpoint, std::vector< uint8_t >&& packet )
+{
+    replies_[ endpoint ].push_back( std::move( packet ) );
+}
+
+int
+arp_simulator::injected_fault( uint8_t endpoint )
+{
+    size_t n = transfer_count_[ endpoint ]++;
+    auto it = faults_.find( endpoint );
+    if ( it == faults_.end() )
+        return success;
+    for ( const auto& f: it->second ) {
+        if ( n >= f.after && n < f.after + f.repeat )
+            return f.error;
+    }
+    return success;
+}
+
+int
+arp_simulator::injected_write_fault( const uint8_t * p, int length )
+{
+    // same framing as reg_out; a malformed tail is left to it
+    while ( length >= 8 ) {
+        int size = p[0] == 0x15 ? 12 : 8;
+        if ( size == 12 && length >= 12 ) {
+            auto it = write_faults_.find( le32( p + 4 ) );
+            if ( it != write_faults_.end() ) {
+                auto error = it->second.first;
+                if ( it->second.second-- <= 1 )
+                    write_faults_.erase( it );
+                return error;
+            }
+        }
+        p += size;
+        length -= size;
+    }
+    return success;
+}
+
+uint32_t
+arp_simulator::reg( uint32_t addr ) const
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    auto it = regs_.find( addr );
+    return it != regs_.end() ? it->second : 0;
+}
+
+void
+arp_simulator::setReg( uint32_t addr, uint32_t value )
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    regs_[ addr ] = value;
+}
+
+uint8_t
+arp_simulator::xdata( uint16_t addr ) const
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    return xdata_[ addr ];
+}
+
+uint8_t
+arp_simulator::sfr( uint8_t addr ) const
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    return sfr_[ addr ];
+}
+
+void
+arp_simulator::on_read( uint32_t addr, read_hook hook )
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    if ( hook )
+        read_hooks_[ addr ] = std::make_pair( hook, size_t( 0 ) );
+    else
+        read_hooks_.erase( addr );
+}
+
+void
+arp_simulator::on_write( uint32_t addr, write_hook hook )
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    if ( hook )
+        write_hooks_[ addr ] = hook;
+    else
+        write_hooks_.erase( addr );
+}
+
+void
+arp_simulator::setLatency( std::chrono::microseconds latency, std::chrono::nanoseconds per_byte )
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    latency_ = latency;
+    per_byte_ = per_byte;
+}
+
+std::chrono::nanoseconds
+arp_simulator::latency( int length ) const
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    return latency_ + per_byte_ * length;
+}
+
+void
+arp_simulator::inject_fault( uint8_t endpoint, size_t after, error_code error, size_t repeat )
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    faults_[ endpoint ].push_back( fault{ transfer_count_[ endpoint ] + after, error, repeat } );
+}
+
+void
+arp_simulator::inject_write_fault( uint32_t addr, error_code error, size_t repeat )
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    write_faults_[ addr ] = std::make_pair( error, repeat );
+}
+
+void
+arp_simulator::clear_faults()
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    faults_.clear();
+    write_faults_.clear();
+}
+
+void
+arp_simulator::setVersion( const std::string& version )
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    version_ = version;
+}
+
+void
+arp_simulator::fpga_reset()
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    regs_.clear();
+    replies_[ RegBulkIn ].clear();
+}
+
+arp_simulator::statistics
+arp_simulator::stats() const
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    return stats_;
+}
+
+void
+arp_simulator::clear_stats()
+{
+    std::lock_guard< std::recursive_mutex > lock( mutex_ );
+    stats_ = statistics{ 0, 0, 0, 0, 0, 0 };
+}
@@ -0,0 +1,136 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace dg {
+
+    // In-process model of the EZ-USB bridge and the ARP FPGA behind it, used in place of
+    // the device when arpproxy is built without libusb.
+    //  - RegBulkOut takes 0x14 read frames (8 bytes) and 0x15 write frames (12 bytes,
+    //    the 0x0f000c15 vector-write triplets); every frame queues one 8-byte reply packet
+    //    on RegBulkIn carrying the register value.
+    //  - CmdBulkOut takes the CMD_* byte commands for the 8051 XDATA and SFR space;
+    //    CMD_MODIFIED_DATE and the read commands queue a reply on CmdBulkIn.
+    //  - An IN transfer returns one packet, as a short packet ends a bulk transfer.
+    class arp_simulator {
+    public:
+        // same values as the corresponding libusb_error codes
+        enum error_code { success = 0, error_io = -1, error_no_device = -4, error_timeout = -7, error_pipe = -9 };
+
+        enum endpoint : uint8_t { CmdBulkOut = 0x01, RegBulkOut = 0x04, CmdBulkIn = 0x81, RegBulkIn = 0x88 };
+
+        static arp_simulator * instance();
+
+        arp_simulator();
+
+        // one bulk transfer; returns an error_code.  An IN transfer without a pending
+        // reply returns error_timeout, which the caller turns into a wait
+        int transfer( uint8_t endpoint, uint8_t * data, int length, int& transferred );
+
+        // true if an IN transfer on the endpoint would return data
+        bool readable( uint8_t endpoint ) const;
+
+        // FPGA register file, addressed like CmdRegRead/CmdRegWrite
+        uint32_t reg( uint32_t addr ) const;
+        void setReg( uint32_t addr, uint32_t value );
+
+        // EZ-USB XDATA and SFR space
+        uint8_t xdata( uint16_t addr ) const;
+        uint8_t sfr( uint8_t addr ) const;
+
+        // scripting: the value a read returns, given the stored value and the number of
+        // reads of that address since the hook was set
+        typedef std::function< uint32_t( uint32_t value, size_t nth ) > read_hook;
+        typedef std::function< void( uint32_t value ) > write_hook;
+        void on_read( uint32_t addr, read_hook );
+        void on_write( uint32_t addr, write_hook );
+
+        // each transfer completes after latency + length * per_byte
+        void setLatency( std::chrono::microseconds latency, std::chrono::nanoseconds per_byte = std::chrono::nanoseconds( 0 ) );
+        std::chrono::nanoseconds latency( int length ) const;
+
+        // the transfer number 'after' (counted on the endpoint from now on) and the
+        // following repeat - 1 transfers fail with error
+        void inject_fault( uint8_t endpoint, size_t after, error_code error, size_t repeat = 1 );
+        // the next repeat RegBulkOut transfers carrying a write of addr fail with error,
+        // none of their frames taken
+        void inject_write_fault( uint32_t addr, error_code error, size_t repeat = 1 );
+        void clear_faults();
+
+        void setVersion( const std::string& );
+
+        // the FPGA register file returns to its power-on state
+        void fpga_reset();
+
+        struct statistics {
+            size_t out_transfers;
+            size_t in_transfers;
+            size_t reg_reads;
+            size_t reg_writes;
+            size_t faults;
+            size_t bytes;
+        };
+        statistics stats() const;
+        void clear_stats();
+
+    private:
+        mutable std::recursive_mutex mutex_; // hooks may call back into the simulator
+        std::map< uint32_t, uint32_t > regs_;
+        std::array< uint8_t, 0x10000 > xdata_;
+        std::array< uint8_t, 0x100 > sfr_;
+        std::map< uint32_t, std::pair< read_hook, size_t > > read_hooks_;
+        std::map< uint32_t, write_hook > write_hooks_;
+        std::map< uint8_t, std::deque< std::vector< uint8_t > > > replies_;
+        struct fault { size_t after; error_code error; size_t repeat; };
+        std::map< uint8_t, std::vector< fault > > faults_;
+        std::map< uint8_t, size_t > transfer_count_;
+        std::map< uint32_t, std::pair< error_code, size_t > > write_faults_;
+        std::chrono::microseconds latency_;
+        std::chrono::nanoseconds per_byte_;
+        std::string version_;
+        statistics stats_;
+
+        int injected_fault( uint8_t endpoint );
+        int injected_write_fault( const uint8_t *, int length );
+        int reg_out( const uint8_t *, int length );
+        int cmd_out( const uint8_t *, int length );
+        uint32_t read_reg( uint32_t addr );
+        void write_reg( uint32_t addr, uint32_t value );
+        void reply( uint8_t endpoint, std::vector< uint8_t >&& );
+    };
+
+}
@@ -0,0 +1,151 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+// Benchmark driver for the simulated EZ-USB/FPGA backend: register reads one
+// transaction at a time, as a blocking libusb_bulk_transfer pair, against the
+// same reads pipelined through usb_reactor.
+//
+//   arp_simulator_bench [reads=2000] [latency_us=125] [depth=8]
+
+#include "arp_simulator.hpp"
+#include "libusb_mock.hpp"
+#include "usb_reactor.hpp"
+#include <boost/asio.hpp>
+#include <boost/format.hpp>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+int __verbose_level__ = 0;
+bool __debug_mode__ = true;
+const char * __argv0__ = "arp_simulator_bench";
+
+namespace {
+
+    using dg::arp_simulator;
+    typedef std::chrono::steady_clock clock_type;
+
+    libusb_device_handle * const handle = reinterpret_cast< libusb_device_handle * >( 1 );
+
+    std::array< uint8_t, 8 > read_frame( uint32_t addr )
+    {
+        return {{ 0x14, 0x08, 0x00, 0x00
+                    , uint8_t( addr ), uint8_t( addr >> 8 ), uint8_t( addr >> 16 ), uint8_t( addr >> 24 ) }};
+    }
+
+    void report( const char * name, size_t reads, clock_type::duration elapsed, int errors )
+    {
+        double us = std::chrono::duration< double, std::micro >( elapsed ).count();
+        std::cout << boost::format( "%-10s %6d reads %10.0f us %8.2f us/read %10.0f reads/s %d error(s)" )
+            % name % reads % us % ( us / reads ) % ( reads * 1.0e6 / us ) % errors << std::endl;
+    }
+
+    void sequential( size_t reads )
+    {
+        int errors = 0;
+        auto t0 = clock_type::now();
+        for ( size_t i = 0; i < reads; ++i ) {
+            auto frame = read_frame( 0x3c00 + 4 * ( i % 32 ) );
+            std::array< uint8_t, 8 > reply;
+            int transferred = 0;
+            if ( libusb_bulk_transfer( handle, arp_simulator::RegBulkOut, frame.data(), int( frame.size() ), &transferred, 100 )
+                 || libusb_bulk_transfer( handle, arp_simulator::RegBulkIn, reply.data(), int( reply.size() ), &transferred, 100 ) )
+                ++errors;
+        }
+        report( "sequential", reads, clock_type::now() - t0, errors );
+    }
+
+    void pipelined( size_t reads, size_t depth )
+    {
+        boost::asio::io_service io_service;
+        std::unique_ptr< boost::asio::io_service::work > work( new boost::asio::io_service::work( io_service ) );
+        std::thread thread( [&]{ io_service.run(); } );
+
+        std::vector< std::array< uint8_t, 8 > > frames( reads ), replies( reads );
+        std::mutex mutex;
+        std::condition_variable cond;
+        size_t done = 0;
+        int errors = 0;
+
+        auto t0 = clock_type::now();
+        do {
+            dg::usb_reactor reactor( io_service, nullptr, depth );
+            for ( size_t i = 0; i < reads; ++i ) {
+                frames[ i ] = read_frame( 0x3c00 + 4 * ( i % 32 ) );
+                reactor.async_bulk_transfer( handle, arp_simulator::RegBulkOut, frames[ i ].data(), 8, 100
+                                             , [&]( int rc, int ){ if ( rc ) ++errors; } );
+                reactor.async_bulk_transfer( handle, arp_simulator::RegBulkIn, replies[ i ].data(), 8, 100
+                                             , [&]( int rc, int ){
+                                                 std::lock_guard< std::mutex > lock( mutex );
+                                                 if ( rc )
+                                                     ++errors;
+                                                 if ( ++done == reads )
+                                                     cond.notify_one();
+                                             } );
+            }
+            std::unique_lock< std::mutex > lock( mutex );
+            cond.wait( lock, [&]{ return done == reads; } );
+        } while ( 0 );
+        auto elapsed = clock_type::now() - t0;
+
+        work.reset();
+        io_service.stop();
+        thread.join();
+
+        report( ( boost::format( "depth %d" ) % depth ).str().c_str(), reads, elapsed, errors );
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    size_t reads = argc > 1 ? std::strtoul( argv[1], nullptr, 0 ) : 2000;
+    long latency = argc > 2 ? std::strtol( argv[2], nullptr, 0 ) : 125;
+    size_t depth = argc > 3 ? std::strtoul( argv[3], nullptr, 0 ) : 8;
+
+    if ( reads == 0 || depth == 0 ) {
+        std::cerr << "usage: " << argv[0] << " [reads] [latency_us] [depth]" << std::endl;
+        return 1;
+    }
+
+    auto sim = arp_simulator::instance();
+    sim->setLatency( std::chrono::microseconds( latency ) );
+
+    sequential( reads );
+    pipelined( reads, 1 );
+    pipelined( reads, depth );
+
+    auto st = sim->stats();
+    std::cout << boost::format( "simulator: %d out, %d in, %d register reads, %d bytes" )
+        % st.out_transfers % st.in_transfers % st.reg_reads % st.bytes << std::endl;
+    return 0;
+}
@@ -0,0 +1,255 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+// Regression test for the simulated EZ-USB/FPGA backend: the register and command
+// framing of arp_simulator, the libusb subset in libusb_mock, and the endpoint
+// ordering usb_reactor promises on top of it.  Exits non-zero on the first failure.
+
+#include "arp_simulator.hpp"
+#include "libusb_mock.hpp"
+#include "usb_reactor.hpp"
+#include <boost/asio.hpp>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+int __verbose_level__ = 0;
+bool __debug_mode__ = true;
+const char * __argv0__ = "arp_simulator_test";
+
+namespace {
+
+    using dg::arp_simulator;
+
+    libusb_device_handle * const handle = reinterpret_cast< libusb_device_handle * >( 1 );
+
+    int failures = 0;
+
+    void check( bool cond, const std::string& what )
+    {
+        if ( !cond ) {
+            std::cerr << "FAIL: " << what << std::endl;
+            ++failures;
+        }
+    }
+
+    void put_le32( uint8_t * p, uint32_t v )
+    {
+        for ( int i = 0; i < 4; ++i )
+            p[ i ] = uint8_t( ( v >> ( 8 * i ) ) & 0xff );
+    }
+
+    uint32_t le32( const uint8_t * p )
+    {
+        return uint32_t( p[0] ) | ( uint32_t( p[1] ) << 8 ) | ( uint32_t( p[2] ) << 16 ) | ( uint32_t( p[3] ) << 24 );
+    }
+
+    std::vector< uint8_t > read_frame( uint32_t addr )
+    {
+        std::vector< uint8_t > f = { 0x14, 0x08, 0x00, 0x00, 0, 0, 0, 0 };
+        put_le32( &f[4], addr );
+        return f;
+    }
+
+    std::vector< uint8_t > write_frame( uint32_t addr, uint32_t value )
+    {
+        std::vector< uint8_t > f = { 0x15, 0x0c, 0x00, 0x0f, 0, 0, 0, 0, 0, 0, 0, 0 };
+        put_le32( &f[4], addr );
+        put_le32( &f[8], value );
+        return f;
+    }
+
+    // one register frame out, its reply in; returns the register value from the reply
+    int reg_transaction( std::vector< uint8_t > frame, uint32_t& value )
+    {
+        int transferred = 0;
+        if ( int rc = libusb_bulk_transfer( handle, arp_simulator::RegBulkOut, frame.data(), int( frame.size() ), &transferred, 100 ) )
+            return rc;
+        uint8_t reply[ 8 ];
+        if ( int rc = libusb_bulk_transfer( handle, arp_simulator::RegBulkIn, reply, sizeof( reply ), &transferred, 100 ) )
+            return rc;
+        if ( transferred != 8 )
+            return LIBUSB_ERROR_OVERFLOW;
+        value = le32( reply + 4 );
+        return LIBUSB_SUCCESS;
+    }
+
+    void test_register_frames()
+    {
+        auto sim = arp_simulator::instance();
+        uint32_t value = 0;
+
+        check( reg_transaction( write_frame( 0x4320, 0x12345678 ), value ) == LIBUSB_SUCCESS, "register write" );
+        check( value == 0x12345678, "write reply echoes the value" );
+        check( sim->reg( 0x4320 ) == 0x12345678, "register file holds the written value" );
+
+        check( reg_transaction( read_frame( 0x4320 ), value ) == LIBUSB_SUCCESS, "register read" );
+        check( value == 0x12345678, "register read returns the written value" );
+
+        check( reg_transaction( read_frame( 0x4324 ), value ) == LIBUSB_SUCCESS && value == 0, "unwritten register reads 0" );
+    }
+
+    void test_read_hook()
+    {
+        auto sim = arp_simulator::instance();
+        sim->setReg( 0x3c04, 0 );
+        sim->on_read( 0x3c04, []( uint32_t v, size_t n ){ return n >= 2 ? v | 2 : v; } );
+
+        uint32_t values[ 3 ] = { 0 };
+        for ( auto& v: values )
+            reg_transaction( read_frame( 0x3c04 ), v );
+        check( values[0] == 0 && values[1] == 0 && values[2] == 2, "read hook sees the read count" );
+
+        sim->on_read( 0x3c04, arp_simulator::read_hook() );
+    }
+
+    void test_faults()
+    {
+        auto sim = arp_simulator::instance();
+        uint32_t value = 0;
+
+        sim->inject_fault( arp_simulator::RegBulkOut, 0, arp_simulator::error_pipe );
+        check( reg_transaction( read_frame( 0x4320 ), value ) == LIBUSB_ERROR_PIPE, "injected fault stalls the endpoint" );
+        check( reg_transaction( read_frame( 0x4320 ), value ) == LIBUSB_SUCCESS, "transfer after the fault succeeds" );
+        sim->clear_faults();
+
+        sim->setReg( 0x4324, 0 );
+        sim->inject_write_fault( 0x4324, arp_simulator::error_pipe );
+        check( reg_transaction( write_frame( 0x4320, 1 ), value ) == LIBUSB_SUCCESS, "write fault spares other registers" );
+        check( reg_transaction( write_frame( 0x4324, 1 ), value ) == LIBUSB_ERROR_PIPE && sim->reg( 0x4324 ) == 0
+               , "write fault fails the transfer writing its register" );
+        check( reg_transaction( write_frame( 0x4324, 1 ), value ) == LIBUSB_SUCCESS && sim->reg( 0x4324 ) == 1, "write after the write fault succeeds" );
+
+        uint8_t reply[ 8 ];
+        int transferred = 0;
+        check( libusb_bulk_transfer( handle, arp_simulator::RegBulkIn, reply, sizeof( reply ), &transferred, 10 ) == LIBUSB_ERROR_TIMEOUT
+               , "IN transfer without a pending reply times out" );
+
+        std::vector< uint8_t > garbage = { 0x16, 0x08, 0, 0, 0, 0, 0, 0 };
+        check( libusb_bulk_transfer( handle, arp_simulator::RegBulkOut, garbage.data(), int( garbage.size() ), &transferred, 100 ) == LIBUSB_ERROR_PIPE
+               , "malformed register frame stalls the endpoint" );
+    }
+
+    void test_commands()
+    {
+        auto sim = arp_simulator::instance();
+        int transferred = 0;
+
+        sim->setVersion( "20170707" );
+        uint8_t date = 0x40;
+        check( libusb_bulk_transfer( handle, arp_simulator::CmdBulkOut, &date, 1, &transferred, 100 ) == LIBUSB_SUCCESS, "CMD_MODIFIED_DATE" );
+        char version[ 64 ] = { 0 };
+        check( libusb_bulk_transfer( handle, arp_simulator::CmdBulkIn, reinterpret_cast< uint8_t * >( version ), sizeof( version ) - 1, &transferred, 100 ) == LIBUSB_SUCCESS
+               && std::string( version, transferred ) == "20170707", "CMD_MODIFIED_DATE returns the version" );
+
+        sim->setReg( 0x4320, 1 );
+        uint8_t reset[] = { 0x31, 0xc2, 0xe6, 0x00 }; // FPGA_RESET asserted
+        check( libusb_bulk_transfer( handle, arp_simulator::CmdBulkOut, reset, sizeof( reset ), &transferred, 100 ) == LIBUSB_SUCCESS, "CMD_REG_WRITE" );
+        check( sim->xdata( 0xe6c2 ) == 0 && sim->reg( 0x4320 ) == 0, "FPGA reset clears the register file" );
+    }
+
+    void test_reactor_ordering()
+    {
+        auto sim = arp_simulator::instance();
+        const size_t count = 64;
+        for ( uint32_t i = 0; i < count; ++i )
+            sim->setReg( 0x5000 + 4 * i, i * 3 + 1 );
+
+        boost::asio::io_service io_service;
+        std::unique_ptr< boost::asio::io_service::work > work( new boost::asio::io_service::work( io_service ) );
+        std::thread thread( [&]{ io_service.run(); } );
+
+        std::vector< std::vector< uint8_t > > frames;
+        std::vector< std::array< uint8_t, 8 > > replies( count );
+        std::vector< uint32_t > values;
+        int errors = 0;
+        size_t done = 0;
+        std::mutex mutex;
+        std::condition_variable cond;
+
+        do {
+            dg::usb_reactor reactor( io_service, nullptr, 4 );
+
+            for ( uint32_t i = 0; i < count; ++i )
+                frames.emplace_back( read_frame( 0x5000 + 4 * i ) );
+
+            // every command first, then every reply: the IN queue must hand the replies back in command order
+            for ( size_t i = 0; i < count; ++i )
+                reactor.async_bulk_transfer( handle, arp_simulator::RegBulkOut, frames[ i ].data(), int( frames[ i ].size() ), 100
+                                             , [&]( int rc, int ){ if ( rc ) ++errors; } );
+            for ( size_t i = 0; i < count; ++i ) {
+                reactor.async_bulk_transfer( handle, arp_simulator::RegBulkIn, replies[ i ].data(), 8, 100
+                                             , [&,i]( int rc, int transferred ){
+                                                 std::lock_guard< std::mutex > lock( mutex );
+                                                 if ( rc || transferred != 8 )
+                                                     ++errors;
+                                                 values.push_back( le32( replies[ i ].data() + 4 ) );
+                                                 ++done;
+                                                 cond.notify_one();
+                                             } );
+            }
+
+            std::unique_lock< std::mutex > lock( mutex );
+            check( cond.wait_for( lock, std::chrono::seconds( 5 ), [&]{ return done == count; } ), "pipelined transfers complete" );
+        } while ( 0 );
+
+        work.reset();
+        io_service.stop();
+        thread.join();
+
+        check( errors == 0, "pipelined transfers succeed" );
+        bool ordered = values.size() == count;
+        for ( uint32_t i = 0; ordered && i < count; ++i )
+            ordered = values[ i ] == i * 3 + 1;
+        check( ordered, "replies arrive in command order" );
+    }
+}
+
+int
+main( int, char ** )
+{
+    dg::arp_simulator::instance()->setLatency( std::chrono::microseconds( 20 ) );
+
+    test_register_frames();
+    test_read_hook();
+    test_faults();
+    test_commands();
+    test_reactor_ordering();
+
+    if ( failures ) {
+        std::cerr << failures << " failure(s)" << std::endl;
+        return 1;
+    }
+    std::cout << "arp_simulator: all tests passed" << std::endl;
+    return 0;
+}
@@ -26,19 +26,25 @@
 #include "array_wrapper.hpp" // copied from adportable
 #include "usbmanager.hpp"
 #include "log.hpp"
+#include "histogram.hpp"
+#include "reactor.hpp"
+#include "ticker.hpp"
+#include "usb_reactor.hpp"
 #include <infitofdefns/arpvoltage.hpp>
 #include <infitofdefns/avgr_arp.hpp>
 #include <tofdll2/ddr2_trig.hpp>
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <limits>
+#include <map>
 #include <fcntl.h>
 
-#ifdef WIN32
-enum { LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED,LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT };
-const char * libusb_error_name( int ) { return ""; }
-int libusb_bulk_transfer( libusb_device_handle *, unsigned char ep, unsigned char * data, int length, int *transferred, unsigned int timeout ) { return 0; }
-#endif
-
 #ifndef WIN32
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -48,6 +54,8 @@ int libusb_bulk_transfer( libusb_device_handle *, unsigned char ep, unsigned cha
 
 #if defined __linux__ && HAS_LIBUSB
 #  include <libusb-1.0/libusb.h>
+#else
+#  include "libusb_mock.hpp" // simulated device, see arp_simulator.hpp
 #endif
 
 #include <boost/format.hpp>
@@ -105,20 +113,84 @@ namespace dg {
         uint32_t iMask;
         uint32_t iMaxLoop;
     };
+
+    // A register table compiled ahead of execution.  Register operations that are not
+    // separated by a wait or a poll share one batch: a single OUT transfer carrying every
+    // frame, then one 8-byte reply per frame.  A poll contributes its first read to the
+    // batch before it and ends that batch.  Read-modify-writes resolve at compile time
+    // against values written earlier in the plan or held in the register shadow; only
+    // the unresolved ones cost a read round trip.  Consecutive waits merge, and several
+    // tables may be appended to one plan.
+    class transfer_plan {
+    public:
+        enum step_type { step_batch, step_wait, step_poll, step_bitwrite };
+
+        struct frame {
+            uint32_t addr;
+            uint32_t value;
+            bool read;
+            Arp_TblValueDetail * result; // table entry receiving a read value, if any
+        };
+
+        struct step {
+            step_type type;
+            std::vector< frame > frames;        // batch
+            std::chrono::microseconds duration; // wait; time budget of a poll
+            const Arp_TblValueDetail * detail;  // poll, bitwrite
+        };
+
+        transfer_plan( std::function< const uint32_t *( uint32_t ) > shadow = nullptr ) : shadow_( shadow ) {}
+
+        // false on an entry type the plan can not execute
+        bool append( Arp_TblValueDetail *, size_t nitem );
+
+        const std::vector< step >& steps() const { return steps_; }
+
+        // transfers the plan takes, poll retries not counted
+        size_t transfers() const;
+
+        // transfers an entry by entry walk of the same table takes
+        static size_t interpreted_transfers( const Arp_TblValueDetail *, size_t nitem );
+
+    private:
+        std::function< const uint32_t *( uint32_t ) > shadow_;
+        std::map< uint32_t, uint32_t > known_; // written earlier in this plan
+        std::vector< step > steps_;
+
+        step& batch();
+        const uint32_t * known( uint32_t addr ) const;
+    };
     
     class arpproxy::impl {
     public:
-        impl() : worker_( io_service_ )
-               , timer_( io_service_ )
+        impl() : own_io_service_( reactor::enabled() ? nullptr : new boost::asio::io_service() )
+               , io_service_( own_io_service_ ? *own_io_service_ : reactor::io_service() )
+               , worker_( io_service_ )
+               , ticker_( io_service_, std::chrono::seconds( 1 ) )
                , usbmanager_( new usbmanager() )
                , tick_( 1000 )
+               , usb_device_handle_( 0 )
                , service_count_( 0 )
-               , usb_device_handle_( 0 ) {
+               , front_( 0 )
+               , delta_size_( 0 )
+               , actuals_failed_( 0 )
+               , read_actuals_transfers_( 0 )
+               , shadow_writes_( 0 )
+               , shadow_suppressed_( 0 ) {
 
             log() << "initializing arp proxy...";
             
-            std::fill( actuals_data_.begin(), actuals_data_.end(), -1 );
+            for ( auto& buffer: actuals_data_ )
+                std::fill( buffer.begin(), buffer.end(), -1 );
+            std::fill( published_.begin(), published_.end(), std::numeric_limits< double >::quiet_NaN() );
+            for ( size_t i = 0; i < actuals_data_[ 0 ].size(); ++i ) {
+                actuals_oframe_[ i * 2 ] = 0x00000814;
+                actuals_oframe_[ i * 2 + 1 ] = ARP_OFFSET_HV + 4 * uint32_t( i );
+            }
             std::fill( setpts_data_.begin(), setpts_data_.end(), std::make_pair( 0.0, 0 ) );
+            shadow_.fill( 0 );
+            requested_.fill( 0 );
+            pending_.fill( 0 );
 
             usbmanager_->initialize( [this]( libusb_device * dev, libusb_hotplug_event event ){
                     if ( event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED ) {
@@ -128,19 +200,24 @@ namespace dg {
                     }
                 });
 
+            // libusb events for the default context, initialized by usbmanager, are handled on io_service_
+            usb_ = std::make_unique< usb_reactor >( io_service_ );
+
             log() << "starting timer...";            
 
-            timer_.expires_from_now( std::chrono::milliseconds( 1000 ) );
-            timer_.async_wait( [this]( const boost::system::error_code& ec ){ on_timer(ec); } );
+            ticker_.connect( [this]( size_t ){ on_tick(); } );
+            ticker_.start();
 
-            threads_.push_back( std::thread( [=]{ io_service_.run(); } ) );
+            if ( own_io_service_ )
+                threads_.push_back( std::thread( [=]{ io_service_.run(); } ) );
 
             log() << "timer started.";            
         }
 
         ~impl() {
-            timer_.cancel();
-            io_service_.stop();
+            ticker_.stop();
+            if ( own_io_service_ )
+                io_service_.stop();
             for ( auto& t: threads_ )
                 t.join();
         }
@@ -151,16 +228,28 @@ namespace dg {
 
         const std::pair< double, uint32_t >& setpoint( uint32_t addr ) const { return setpts_data_[ addr ]; }
 
-        uint32_t actual( uint32_t addr ) const { return actuals_data_[ addr ]; }
+        uint32_t actual( uint32_t addr ) const { return actuals_data_[ front_ ][ addr ]; }
+
+        // actuals that moved past their deadband at the last read, valid in the actuals handler
+        void write_actuals_delta( std::ostream& o ) const { o.write( delta_.data(), delta_size_ ); }
 
         void device_setvoltage( const std::string& id, double value );
         void device_setflag( const std::string& id, bool value );        
 
+        // actuals polling; phase locked with the bnc565 tick.  A period that is not
+        // positive is ignored.
+        void setPollPeriod( std::chrono::steady_clock::duration period ) { ticker_.setPeriod( period ); }
+
+        // reconcile the HV shadow register file against the hardware
+        void resync() { io_service_.post( [this]{ resync_shadow(); } ); }
+
     private:
-        boost::asio::io_service io_service_;
+        std::unique_ptr< boost::asio::io_service > own_io_service_; // null when the reactor is shared
+        boost::asio::io_service& io_service_;
         boost::asio::io_service::work worker_;
-        boost::asio::steady_timer timer_;
+        ticker ticker_;
         std::unique_ptr< usbmanager > usbmanager_;
+        std::unique_ptr< usb_reactor > usb_;
         std::vector< std::thread > threads_;
         size_t tick_;
         libusb_device_handle * usb_device_handle_;
@@ -168,8 +257,37 @@ namespace dg {
         std::mutex mutex_;
 
         std::array< std::pair<double, uint32_t>, 32 > setpts_data_; // <user value, device value>
-        std::array< uint32_t, 32 > actuals_data_;
+        std::array< std::array< uint32_t, 32 >, 2 > actuals_data_; // readers see actuals_data_[ front_ ]
+        std::atomic< size_t > front_;
         std::string ezusb_version_;
+
+        // change driven publishing; the buffers below are reused by every read
+        std::array< double, 32 > published_;   // last published world value per __actuals entry
+        std::array< char, 2048 > delta_;
+        size_t delta_size_;
+        std::chrono::steady_clock::time_point published_at_;
+        std::array< uint32_t, 64 > actuals_oframe_;
+        std::array< uint8_t, 32 * 8 > actuals_rdata_;
+        int actuals_failed_;
+        std::chrono::steady_clock::time_point actuals_t0_;
+
+        // register commands that went out and whose replies are still to be read, oldest
+        // first; only the front one has an IN transfer in flight.  Touched on the usb strand only
+        struct reply_reader {
+            uint8_t * data;
+            size_t length;
+            size_t received;
+            size_t transfers;
+            std::function< void( int rcode, size_t transfers ) > done;
+        };
+        std::deque< reply_reader > readers_;
+
+        // write-through shadow of the HV register block; a register is known once written or resynced
+        std::array< uint32_t, 32 > shadow_;
+        std::bitset< 32 > shadow_valid_;
+        // last value handed to async_reg_write per register, and how many of its writes are in flight
+        std::array< uint32_t, 32 > requested_;
+        std::array< size_t, 32 > pending_;
         
         void on_device_attached( libusb_device * dev ) {
 
@@ -182,38 +300,35 @@ namespace dg {
             }
         }
         
-        void on_device_detached( libusb_device * dev ) {
+        void on_device_detached( libusb_device * ) {
 
             do {
                 std::lock_guard< std::mutex > lock( mutex_ );
+                usb_->cancel( usb_device_handle_ );
                 usbmanager::usb_close( usb_device_handle_ );
+                shadow_valid_.reset();
             } while(0);
             
             notification_handler_( "{ \"notify\": [{ \"id\": \"status\", \"value\": \"offline\" } ]}" );
         }
         
-        void on_timer( const boost::system::error_code& ec ) {
-            if ( !ec ) {
-                namespace arp = infitof::arp;
+        void on_tick() {
+            namespace arp = infitof::arp;
                 
-                std::lock_guard< std::mutex > lock( mutex_ );
+            std::lock_guard< std::mutex > lock( mutex_ );
 
-                if ( usb_device_handle_ ) {
+            if ( usb_device_handle_ ) {
                 
-                    if ( tick_++ == 0 ) {
-                        read_device_version();
-                        io_service_.post( [this]{ handle_device_on( false ); } ); // HV Off
-                        io_service_.post( [this]{ handle_device_digitizer_initialize(); } );
-                    }
-
-                    if ( service_count_ == 0 ) {
-                        ++service_count_;
-                        io_service_.post( [this]{ handle_device_read_actuals(); --service_count_; } );
-                    }
+                if ( tick_++ == 0 ) {
+                    read_device_version();
+                    io_service_.post( [this]{ handle_device_on( false ); } ); // HV Off
+                    io_service_.post( [this]{ handle_device_digitizer_initialize(); } );
                 }
 
-                timer_.expires_from_now( std::chrono::milliseconds( 1000 ) );
-                timer_.async_wait( [this]( const boost::system::error_code& ec ){ on_timer(ec); } );
+                if ( service_count_ == 0 ) {
+                    ++service_count_; // released when the asynchronous read completes
+                    io_service_.post( [this]{ handle_device_read_actuals(); } );
+                }
             }
         }
 
@@ -231,6 +346,8 @@ namespace dg {
         int bulk_transfer( endpoint ep, const uint8_t * data, int length, int& transferred, uint32_t timeout = 1000 );
 
         void make_actual_status( std::ostream& );
+        void on_actuals_read();
+        size_t encode_actuals_delta();
 
         template<typename T> int bulk_transfer( endpoint ep, const T& data ) {
             int transferred(0);
@@ -247,15 +364,69 @@ namespace dg {
             uint32_t * p = outData.data();
             std::for_each( first, last, [&] ( const typename InputIt::value_type& v ) {
                     *p++ = 0x0f000c15; *p++ = uint32_t( v.first );  *p++ = uint32_t( v.second ); } );
-            return CmdRegVectorWriteHelper( outData.data(), count );
+            if ( !CmdRegVectorWriteHelper( outData.data(), count ) )
+                return false;
+            std::for_each( first, last, [&] ( const typename InputIt::value_type& v ) { update_shadow( uint32_t( v.first ), uint32_t( v.second ) ); } );
+            return true;
+        }
+
+        // one OUT transfer carrying every read frame, replies collected into data[0..count)
+        template<typename InputIt, typename OutputIt> bool CmdRegVectorRead( InputIt first, InputIt last, OutputIt data ) {
+            size_t count = std::distance( first, last );
+            std::vector< uint32_t > outData( count * 2 );
+            uint32_t * p = outData.data();
+            std::for_each( first, last, [&] ( uint32_t addr ) { *p++ = 0x00000814; *p++ = addr; } );
+            std::vector< uint32_t > inData( count );
+            if ( !CmdRegVectorReadHelper( outData.data(), inData.data(), count ) )
+                return false;
+            std::copy( inData.begin(), inData.end(), data );
+            return true;
         }
 
         bool CmdRegRead( uint32_t addr, uint32_t &data );
         bool CmdRegWrite( uint32_t addr, uint32_t data );
+
+        // queued behind earlier register commands; done( success ) is called once the reply is
+        // in, or at once when no device is attached
+        void async_reg_write( uint32_t addr, uint32_t data, std::function< void( bool ) > done );
+
+        // frames go out on RegBulkOut; once they are sent, the replies are read into
+        // replies[0..length) after those of every earlier command.  done( rcode, transfers )
+        // gets the number of IN transfers it took; nothing is read when the OUT failed
+        void async_reg_command( uint8_t * frames, size_t nbytes, uint8_t * replies, size_t length
+                                , std::function< void( int rcode, size_t transfers ) > done );
+        void read_replies();
+        void on_replies_read( int rcode, int transferred );
+
+        // HV register write through the shadow; nothing is sent when the register already holds data,
+        // or when the last write still in flight carries it
+        void hv_write( uint32_t index, uint32_t data );
+        bool resync_shadow();
+        void update_shadow( uint32_t addr, uint32_t data ) {
+            uint32_t index = ( addr - ARP_OFFSET_HV ) / 4;
+            if ( addr >= ARP_OFFSET_HV && index < shadow_.size() && ( addr & 3 ) == 0 ) {
+                shadow_[ index ] = data;
+                shadow_valid_.set( index );
+            }
+        }
+        const uint32_t * shadow( uint32_t addr ) const {
+            uint32_t index = ( addr - ARP_OFFSET_HV ) / 4;
+            return ( addr >= ARP_OFFSET_HV && index < shadow_.size() && ( addr & 3 ) == 0 && shadow_valid_.test( index ) ) ? &shadow_[ index ] : nullptr;
+        }
         bool CmdRegBitWrite( uint32_t addr, uint32_t data, uint32_t mask );
         bool CmdRegVectorWrite( const std::vector< std::pair< int32_t, int32_t > >& data );
         bool VectorInterpreter( Arp_TblValueDetail *, size_t nitem );
+        bool execute( const transfer_plan& );
+        bool poll_register( const Arp_TblValueDetail&, uint32_t value, std::chrono::microseconds budget );
         bool CmdRegVectorWriteHelper( const uint32_t *, size_t nitem );
+        bool CmdRegVectorReadHelper( const uint32_t *, uint32_t * data, size_t nitem );
+        bool CmdRegBatchHelper( const uint32_t * frames, size_t nwords, uint32_t * replies, size_t nreplies, size_t * transfers = nullptr );
+
+    public:
+        histogram read_actuals_latency_;
+        std::atomic< size_t > read_actuals_transfers_; // IN transfers of the last actuals read
+        std::atomic< size_t > shadow_writes_;          // HV register writes sent
+        std::atomic< size_t > shadow_suppressed_;      // HV register writes found unchanged in the shadow
     };
 
     namespace arp = infitof::arp;
@@ -459,31 +630,47 @@ namespace dg {
 
     };
 
-    static std::pair< const char *, std::function< std::string( const impl& x ) > > __actuals [] = {
-		{ "INJECTION.OUTER.ACT", [=](const impl& x){ return ( boost::format( "%.2lf" ) % arp::Vent_out::world_value( x.actual( arp::act_entOutVoltage ) ) ).str(); } }
-        , { "INJECTION.INNER.ACT", [=](const impl& x){ return ( boost::format("%.2lf") % arp::Vent_in::world_value( x.actual( arp::act_entInVoltage ) ) ).str(); } }
-        , { "EJECTION.OUTER.ACT",  [=](const impl& x){ return ( boost::format("%.2lf") % arp::Vext_out::world_value( x.actual( arp::act_extOutVoltage ) ) ).str(); } }
-        , { "EJECTION.INNER.ACT",  [=](const impl& x){ return ( boost::format("%.2lf") % arp::Vext_in::world_value( x.actual( arp::act_extInVoltage ) ) ).str(); } }
-        , { "GATE.OUTER.ACT",      [=](const impl& x){ return ( boost::format("%.2lf") % arp::Vsel_out::world_value( x.actual( arp::act_selOutVoltage ) ) ).str(); } }
-        , { "GATE.INNER.ACT",      [=](const impl& x){ return ( boost::format("%.2lf") % arp::Vsel_in::world_value( x.actual( arp::act_selInVoltage ) ) ).str(); } }
-        , { "ORBIT.OUTER.ACT",     [=](const impl& x){ return ( boost::format("%.2lf") % arp::Vtn_out::world_value( x.actual( arp::act_turnOutVoltage ) ) ).str(); } }
-        , { "ORBIT.INNER.ACT",     [=](const impl& x){ return ( boost::format("%.2lf") % arp::Vtn_in::world_value( x.actual( arp::act_turnInVoltage ) ) ).str(); } }
-        , { "Vmatsuda.ACT",        [=](const impl& x){ return ( boost::format("%.2lf") % arp::Vtn_m::world_value( x.actual( arp::act_turnM ) ) ).str(); } }
-        , { "Veinzel.ACT",         [=](const impl& x){ return ( boost::format("%.2lf") % arp::Veinzel::world_value( x.actual( arp::act_einzelVoltage ) ) ).str(); } }
-        , { "Vacc.ACT",            [=](const impl& x){ return ( boost::format("%.2lf") % arp::Vacc::world_value( x.actual( arp::act_accVoltage ) ) ).str(); } }
-        , { "Vpush.ACT",           [=](const impl& x){ return ( boost::format("%.2lf") % arp::Vpush::world_value( x.actual( arp::act_pushVoltage ) ) ).str(); } }
-        , { "Afilament.ACT",       [=](const impl& x){ return ( boost::format("%.2lf") % arp::Cfilament::world_value( x.actual( arp::act_filCurrent ) ) ).str(); } }
-        , { "Vion.ACT",            [=](const impl& x){ return ( boost::format("%.2lf") % arp::Vionization::world_value( x.actual( arp::act_ionVoltage ) ) ).str(); } }
-        , { "Vdetector.ACT",       [=](const impl& x){ return ( boost::format("%.2lf") % arp::Vdet::world_value( x.actual( arp::act_detVoltage ) ) ).str(); } }
-        , { "PressureGauge", [=] ( const impl& x ) {
-                double u = arp::VpressGauge::world_value( x.actual( arp::act_guageMonitor ) );
-                double p = std::pow( 10.0, ( ( u - 7.75 ) / 0.75 ) + 2 );
-                return ( boost::format( "%.4e" ) % p ).str();
-            }
-        }
-        , { "H20W.ACT",            [=]( const impl& x ){ return ( boost::format("%.2lf") % arp::Theat20::world_value( x.actual( arp::act_heater20WTemp ) ) ).str(); } }
-        , { "H50W.ACT",            [=]( const impl& x ){ return ( boost::format("%.2lf") % arp::Theat50::world_value( x.actual( arp::act_heater50WTemp ) ) ).str(); } }
-        , { "H100W.ACT",           [=]( const impl& x ){ return ( boost::format("%.2lf") % arp::Theat100::world_value( x.actual( arp::act_heater100WTemp ) ) ).str(); } }
+    // analog actuals are published when the world value moves by the deadband or more since
+    // it was last published; a relative deadband is a fraction of the published value
+    struct actual_item {
+        const char * id;
+        uint32_t addr;
+        double ( *world_value )( uint32_t );
+        const char * format;
+        double deadband;
+        bool relative;
+    };
+
+    static const actual_item __actuals [] = {
+        { "INJECTION.OUTER.ACT", arp::act_entOutVoltage,  []( uint32_t v ){ return double( arp::Vent_out::world_value( v ) ); },    "%.2lf", 0.1, false }
+        , { "INJECTION.INNER.ACT", arp::act_entInVoltage, []( uint32_t v ){ return double( arp::Vent_in::world_value( v ) ); },     "%.2lf", 0.1, false }
+        , { "EJECTION.OUTER.ACT", arp::act_extOutVoltage, []( uint32_t v ){ return double( arp::Vext_out::world_value( v ) ); },    "%.2lf", 0.1, false }
+        , { "EJECTION.INNER.ACT", arp::act_extInVoltage,  []( uint32_t v ){ return double( arp::Vext_in::world_value( v ) ); },     "%.2lf", 0.1, false }
+        , { "GATE.OUTER.ACT",     arp::act_selOutVoltage, []( uint32_t v ){ return double( arp::Vsel_out::world_value( v ) ); },    "%.2lf", 0.1, false }
+        , { "GATE.INNER.ACT",     arp::act_selInVoltage,  []( uint32_t v ){ return double( arp::Vsel_in::world_value( v ) ); },     "%.2lf", 0.1, false }
+        , { "ORBIT.OUTER.ACT",    arp::act_turnOutVoltage, []( uint32_t v ){ return double( arp::Vtn_out::world_value( v ) ); },    "%.2lf", 0.1, false }
+        , { "ORBIT.INNER.ACT",    arp::act_turnInVoltage, []( uint32_t v ){ return double( arp::Vtn_in::world_value( v ) ); },      "%.2lf", 0.1, false }
+        , { "Vmatsuda.ACT",       arp::act_turnM,         []( uint32_t v ){ return double( arp::Vtn_m::world_value( v ) ); },       "%.2lf", 0.1, false }
+        , { "Veinzel.ACT",        arp::act_einzelVoltage, []( uint32_t v ){ return double( arp::Veinzel::world_value( v ) ); },     "%.2lf", 0.1, false }
+        , { "Vacc.ACT",           arp::act_accVoltage,    []( uint32_t v ){ return double( arp::Vacc::world_value( v ) ); },        "%.2lf", 0.1, false }
+        , { "Vpush.ACT",          arp::act_pushVoltage,   []( uint32_t v ){ return double( arp::Vpush::world_value( v ) ); },       "%.2lf", 0.1, false }
+        , { "Afilament.ACT",      arp::act_filCurrent,    []( uint32_t v ){ return double( arp::Cfilament::world_value( v ) ); },   "%.2lf", 0.01, false }
+        , { "Vion.ACT",           arp::act_ionVoltage,    []( uint32_t v ){ return double( arp::Vionization::world_value( v ) ); }, "%.2lf", 0.1, false }
+        , { "Vdetector.ACT",      arp::act_detVoltage,    []( uint32_t v ){ return double( arp::Vdet::world_value( v ) ); },        "%.2lf", 0.1, false }
+        , { "PressureGauge",      arp::act_guageMonitor,  []( uint32_t v ){
+                double u = arp::VpressGauge::world_value( v );
+                return std::pow( 10.0, ( ( u - 7.75 ) / 0.75 ) + 2 );
+            }, "%.4e", 0.02, true }
+        , { "H20W.ACT",           arp::act_heater20WTemp, []( uint32_t v ){ return double( arp::Theat20::world_value( v ) ); },     "%.2lf", 0.1, false }
+        , { "H50W.ACT",           arp::act_heater50WTemp, []( uint32_t v ){ return double( arp::Theat50::world_value( v ) ); },     "%.2lf", 0.1, false }
+        , { "H100W.ACT",          arp::act_heater100WTemp, []( uint32_t v ){ return double( arp::Theat100::world_value( v ) ); },   "%.2lf", 0.1, false }
+    };
+
+    static_assert( sizeof( __actuals ) / sizeof( __actuals[ 0 ] ) <= 32, "published_ holds one value per actual" );
+
+    // registers rendered by make_actual_status
+    static const uint32_t __status_registers [] = {
+        arp::act_pumpValveCtrl, arp::act_devStateMonitor, arp::act_aux1_alarm, arp::act_aux2_alarm
     };
     
 }
@@ -536,19 +723,37 @@ arpproxy::setpts_json_response( std::ostream& o )
 void
 arpproxy::actuals_json_response( size_t tick, std::ostream& o )
 {
-    namespace arp = infitof::arp;
-
-
     o << "\"acts\": [";
-    o << boost::format( "{ \"id\": \"hvtick\", \"value\": \"%d\" }" ) % tick;
+    o << "{ \"id\": \"hvtick\", \"value\": \"" << tick << "\" }";
 
-	int n = 0;
-    for ( auto a: __actuals ) {
-		o << ", { \"id\": \"" << a.first << "\", \"value\": \"" << a.second(*impl_) << "\" }";
+    char value[ 32 ];
+    for ( const auto& a: __actuals ) {
+        std::snprintf( value, sizeof( value ), a.format, a.world_value( impl_->actual( a.addr ) ) );
+        o << ", { \"id\": \"" << a.id << "\", \"value\": \"" << value << "\" }";
     }
     o << "]";
 }
 
+void
+arpproxy::actuals_delta_json_response( std::ostream& o )
+{
+    impl_->write_actuals_delta( o );
+}
+
+void
+arpproxy::metrics_json_response( std::ostream& o )
+{
+    o << boost::format( "\"metrics\": { \"read_actuals_in_transfers\": %d, \"read_actuals\": " ) % impl_->read_actuals_transfers_.load();
+    impl_->read_actuals_latency_.write_json( o );
+    o << boost::format( ", \"hv_writes\": %d, \"hv_writes_suppressed\": %d }" ) % impl_->shadow_writes_.load() % impl_->shadow_suppressed_.load();
+}
+
+void
+arpproxy::resync()
+{
+    impl_->resync();
+}
+
 void
 arpproxy::flags_json_response( std::ostream& json )
 {
@@ -577,69 +782,190 @@ arpproxy::set( const std::string& item, bool value )
 }
 
 ////////////
+namespace {
+    uint32_t mask_shift( uint32_t mask ) {
+        int shift_count = 0;
+        for ( int j = 0 ; j < 32 && ( (mask >> j) & 0x01 ) == 0 ; j++ )
+            shift_count = j + 1;
+        return shift_count;
+    }
+}
+
+transfer_plan::step&
+transfer_plan::batch()
+{
+    if ( steps_.empty() || steps_.back().type != step_batch )
+        steps_.push_back( step{ step_batch, {}, std::chrono::microseconds( 0 ), nullptr } );
+    return steps_.back();
+}
+
+const uint32_t *
+transfer_plan::known( uint32_t addr ) const
+{
+    auto it = known_.find( addr );
+    if ( it != known_.end() )
+        return &it->second;
+    return shadow_ ? shadow_( addr ) : nullptr;
+}
+
+bool
+transfer_plan::append( Arp_TblValueDetail * details, size_t nitem )
+{
+    for ( auto it = details; it != details + nitem; ++it ) {
+        switch ( it->iType ) {
+        case ARP_TBLVAL_WRITE:
+            batch().frames.push_back( frame{ it->iAddr, uint32_t( it->llValue ), false, nullptr } );
+            known_[ it->iAddr ] = uint32_t( it->llValue );
+            break;
+        case ARP_TBLVAL_READ:
+            batch().frames.push_back( frame{ it->iAddr, 0, true, it } );
+            break;
+        case ARP_TBLVAL_READWRITE:
+            if ( auto value = known( it->iAddr ) ) {
+                uint32_t next = ( *value & ~it->iMask ) | ( uint32_t( it->llValue << mask_shift( it->iMask ) ) & it->iMask );
+                if ( next != *value )
+                    batch().frames.push_back( frame{ it->iAddr, next, false, nullptr } );
+                known_[ it->iAddr ] = next;
+            } else {
+                steps_.push_back( step{ step_bitwrite, {}, std::chrono::microseconds( 0 ), it } );
+            }
+            break;
+        case ARP_TBLVAL_WAIT:
+            if ( steps_.empty() || steps_.back().type != step_wait )
+                steps_.push_back( step{ step_wait, {}, std::chrono::microseconds( 0 ), nullptr } );
+            steps_.back().duration += std::chrono::microseconds( it->llValue );
+            break;
+        case ARP_TBLVAL_COMP:
+        case ARP_TBLVAL_COMP_N:
+            batch().frames.push_back( frame{ it->iAddr, 0, true, nullptr } );
+            steps_.push_back( step{ step_poll, {}, std::chrono::milliseconds( it->iMaxLoop + 1 ), it } ); // the interpreter's 1ms per loop
+            break;
+        default:
+            log() << boost::format( "transfer_plan: unsupported entry type %1% at 0x%2$x" ) % it->iType % it->iAddr;
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t
+transfer_plan::transfers() const
+{
+    size_t count = 0;
+    for ( const auto& step: steps_ ) {
+        if ( step.type == step_batch )
+            count += 1 + step.frames.size();
+        else if ( step.type == step_bitwrite )
+            count += 4;
+    }
+    return count;
+}
+
+size_t
+transfer_plan::interpreted_transfers( const Arp_TblValueDetail * details, size_t nitem )
+{
+    size_t count = 0;
+    for ( auto it = details; it != details + nitem; ++it ) {
+        if ( it->iType == ARP_TBLVAL_WRITE )
+            count += ( it == details || ( it - 1 )->iType != ARP_TBLVAL_WRITE ) ? 2 : 1;
+        else if ( it->iType == ARP_TBLVAL_READ || it->iType == ARP_TBLVAL_COMP || it->iType == ARP_TBLVAL_COMP_N )
+            count += 2;
+        else if ( it->iType == ARP_TBLVAL_READWRITE )
+            count += 4;
+    }
+    return count;
+}
+
 bool
 arpproxy::impl::VectorInterpreter( Arp_TblValueDetail * details, size_t nitem )
 {
-	bool	bResult( true );
-    
-    adportable::array_wrapper< Arp_TblValueDetail > vec( details, nitem );
+    transfer_plan plan( [this]( uint32_t addr ){ return shadow( addr ); } );
+    if ( !plan.append( details, nitem ) )
+        return false;
 
-    auto it = vec.begin();
-    
-    while ( it != vec.end() ) {
-        if ( it->iType == ARP_TBLVAL_WRITE ) {
-            std::vector< std::pair< uint32_t, uint32_t > > xdata;
-            xdata.push_back( std::make_pair( it->iAddr, uint32_t( it->llValue ) ) );
-            while ( ++it != vec.end() && it->iType == ARP_TBLVAL_WRITE )
-                xdata.push_back( std::make_pair( it->iAddr, uint32_t( it->llValue ) ) );
-            --it;
-            if ( !CmdRegVectorWrite( xdata.begin(), xdata.end() ) )
-                return false;
-        } else if ( it->iType == ARP_TBLVAL_READ ) {
-            uint32_t value;
-            if ( CmdRegRead( uint32_t(it->iAddr), value ) )
-                it->llValue = value;
-            else
+    log() << boost::format( "register plan: %1% entries in %2% steps, %3% transfers expected (%4% interpreted)" )
+        % nitem % plan.steps().size() % plan.transfers() % transfer_plan::interpreted_transfers( details, nitem );
+
+    return execute( plan );
+}
+
+bool
+arpproxy::impl::execute( const transfer_plan& plan )
+{
+    bool bResult( true );
+    uint32_t last_reply = 0;
+
+    for ( const auto& step: plan.steps() ) {
+        switch ( step.type ) {
+        case transfer_plan::step_batch: {
+            std::vector< uint32_t > frames;
+            frames.reserve( step.frames.size() * 3 );
+            for ( const auto& f: step.frames ) {
+                if ( f.read ) {
+                    frames.insert( frames.end(), { 0x00000814, f.addr } );
+                } else {
+                    frames.insert( frames.end(), { 0x0f000c15, f.addr, f.value } );
+                }
+            }
+            std::vector< uint32_t > replies( step.frames.size() );
+            if ( !CmdRegBatchHelper( frames.data(), frames.size(), replies.data(), replies.size() ) )
                 return false;
-        } else if ( it->iType == ARP_TBLVAL_READWRITE ) {
-            int shift_count = 0;
-            for ( int j = 0 ; ( (it->iMask >> j) & 0x01 ) == 0 ; j++ )
-                shift_count = j + 1;
-            if ( ! CmdRegBitWrite( it->iAddr, uint32_t(it->llValue << shift_count), uint32_t(it->iMask)) )
+            for ( size_t i = 0; i < step.frames.size(); ++i ) {
+                const auto& f = step.frames[ i ];
+                if ( f.result )
+                    f.result->llValue = replies[ i ];
+                if ( !f.read )
+                    update_shadow( f.addr, f.value );
+            }
+            last_reply = replies.back();
+            break;
+        }
+        case transfer_plan::step_wait:
+            std::this_thread::sleep_for( step.duration );
+            break;
+        case transfer_plan::step_bitwrite: {
+            const auto& d = *step.detail;
+            if ( ! CmdRegBitWrite( d.iAddr, uint32_t( d.llValue << mask_shift( d.iMask ) ), d.iMask ) )
                 return false;
-        } else if ( it->iType == ARP_TBLVAL_WAIT ) {
-            std::this_thread::sleep_for( std::chrono::microseconds( it->llValue ) );
-        } else if ( it->iType == ARP_TBLVAL_COMP ) {
-            uint32_t l_iComp;
-            uint32_t l_iLoop = 0;
-            do {
-                if (it->iMaxLoop < l_iLoop ) {
-                    bResult	= false;
-                    break;
-                }
-                std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
-                bResult = CmdRegRead( it->iAddr, l_iComp);
-                l_iLoop++;
-            } while ( (bResult != false) && ((l_iComp & it->iMask) != uint32_t( it->llValue )) );
-
-        } else if ( it->iType == ARP_TBLVAL_COMP_N ) {
-            uint32_t l_iComp;
-            uint32_t l_iLoop = 0;
-            do {
-                if ( it->iMaxLoop < l_iLoop )  {
-                    bResult = false;
-                    break;
-                }
-                std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
-                bResult = CmdRegRead( it->iAddr, l_iComp);
-                l_iLoop++;
-            } while ( (bResult != false) && ((l_iComp & it->iMask) == int( it->llValue )) );
+            break;
+        }
+        case transfer_plan::step_poll:
+            if ( !poll_register( *step.detail, last_reply, step.duration ) )
+                bResult = false;
+            break;
         }
-        ++it;
     }
 	return bResult;
 }
 
+bool
+arpproxy::impl::poll_register( const Arp_TblValueDetail& d, uint32_t value, std::chrono::microseconds budget )
+{
+    // value is the first read, done by the preceding batch; back off exponentially from there
+    auto satisfied = [&]( uint32_t v ) {
+        bool equal = ( v & d.iMask ) == uint32_t( d.llValue );
+        return d.iType == ARP_TBLVAL_COMP ? equal : !equal;
+    };
+
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    auto backoff = std::chrono::microseconds( 50 );
+    size_t reads = 1;
+
+    while ( !satisfied( value ) ) {
+        auto now = std::chrono::steady_clock::now();
+        if ( now >= deadline ) {
+            log() << boost::format( "poll 0x%x: 0x%x after %d reads" ) % d.iAddr % value % reads;
+            return false;
+        }
+        std::this_thread::sleep_for( std::min( backoff, std::chrono::duration_cast< std::chrono::microseconds >( deadline - now ) ) );
+        backoff = std::min( backoff * 2, std::chrono::microseconds( 8000 ) );
+        if ( !CmdRegRead( d.iAddr, value ) )
+            return false;
+        ++reads;
+    }
+    return true;
+}
+
 bool
 arpproxy::impl::CmdRegRead( uint32_t addr, uint32_t &data )
 {
@@ -690,8 +1016,10 @@ arpproxy::impl::CmdRegWrite( uint32_t addr, uint32_t data )
     if ( rcode == 0 ) {
         uint8_t iframe[8];
         rcode = bulk_transfer( RegBulkIn, iframe, sizeof( iframe ), transferred );
-        if ( rcode == 0 )
+        if ( rcode == 0 ) {
+            update_shadow( addr, data );
             return true;
+        }
     }
 
     log() << boost::format( "CmdRegWrie( 0x%x:0x%x ) %s." ) % addr % data % libusb_error_name( rcode );
@@ -702,12 +1030,21 @@ arpproxy::impl::CmdRegWrite( uint32_t addr, uint32_t data )
 bool
 arpproxy::impl::CmdRegBitWrite( uint32_t addr, uint32_t data, uint32_t mask )
 {
-    uint32_t value, rcode;
-    if ( (rcode = CmdRegRead( addr, value ) ) ) {
-        return (rcode = CmdRegWrite( addr, (value & ~mask) | (data & mask) ) ) == 0;
+    uint32_t value;
+    if ( auto known = shadow( addr ) ) {
+        value = *known;  // no read round trip for a shadowed register
+    } else if ( !CmdRegRead( addr, value ) ) {
+        log() << boost::format( "CmdRegBitWrite( 0x%x:0x%x ) read failed." ) % addr % data;
+        return false;
     }
-    log() << boost::format( "CmdRegBitWrie( 0x%x:0x%x ) %s." ) % addr % data % libusb_error_name( rcode );    
-    return false;
+
+    uint32_t next = ( value & ~mask ) | ( data & mask );
+    if ( next == value ) {
+        update_shadow( addr, value );
+        ++shadow_suppressed_;
+        return true;
+    }
+    return CmdRegWrite( addr, next );
 }
 
 bool
@@ -728,6 +1065,49 @@ arpproxy::impl::CmdRegVectorWriteHelper( const uint32_t * data, size_t nitem )
     return rcode == 0;
 }
 
+bool
+arpproxy::impl::CmdRegVectorReadHelper( const uint32_t * frames, uint32_t * data, size_t nitem )
+{
+    size_t transfers = 0;
+    if ( !CmdRegBatchHelper( frames, nitem * 2, data, nitem, &transfers ) )
+        return false;
+    read_actuals_transfers_ = transfers;
+    return true;
+}
+
+bool
+arpproxy::impl::CmdRegBatchHelper( const uint32_t * frames, size_t nwords, uint32_t * data, size_t nitem, size_t * ntransfers )
+{
+    int transferred, rcode;
+
+    if ( ( rcode = bulk_transfer( RegBulkOut
+                                  , reinterpret_cast< const uint8_t * >( frames ), int( nwords ) * 4, transferred ) ) != 0 ) {
+        log() << boost::format( "CmdRegBatch failed with code: %1%" ) % libusb_error_name( rcode );
+        return false;
+    }
+
+    // replies are 8 bytes each, value in the upper word; ask for all of them at once
+    // and continue where a short packet ended the transfer
+    std::vector< uint8_t > rdata( nitem * 8 );
+    size_t received = 0, transfers = 0;
+    while ( received < rdata.size() ) {
+        ++transfers;
+        if ( ( rcode = bulk_transfer( RegBulkIn, rdata.data() + received, int( rdata.size() - received ), transferred ) ) != 0 || transferred == 0 ) {
+            log() << boost::format( "CmdRegBatch: %1% of %2% replies, %3%" ) % ( received / 8 ) % nitem % libusb_error_name( rcode );
+            return false;
+        }
+        received += transferred;
+    }
+    if ( ntransfers )
+        *ntransfers = transfers;
+
+    for ( size_t i = 0; i < nitem; ++i ) {
+        const uint8_t * r = &rdata[ i * 8 ];
+        data[ i ] = ( r[7] << 24 ) | ( r[6] << 16 ) | ( r[5] << 8 ) | r[ 4 ];
+    }
+    return true;
+}
+
 #if !defined countof
 # define countof(x) (sizeof(x)/sizeof(x[0]))
 #endif
@@ -1046,6 +1426,7 @@ arpproxy::impl::handle_device_fpga_reset()
         std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
         rcode = bulk_transfer( CmdBulkOut, data2 );
     }
+    shadow_valid_.reset(); // the FPGA registers are back to their defaults
 
     log() << boost::format("handle_device_fpga_reset %1%") % libusb_error_name( rcode );            
 }
@@ -1077,7 +1458,7 @@ arpproxy::impl::handle_device_initialize()
     };
     const uint8_t CmdUsbCtrlInit2 [] = { CMD_SFR_WRITE, 0xb1, 0x40, CMD_SFR_WRITE, 0xb6, 0x40 };
     
-    timer_.cancel();
+    ticker_.stop();
     tick_ = 0;
 
     int rcode;
@@ -1086,9 +1467,9 @@ arpproxy::impl::handle_device_initialize()
         if ( (rcode = bulk_transfer( CmdBulkOut, CmdUsbCtrlInit2 ) ) == 0 ) {
             
             handle_device_fpga_reset();
+            resync_shadow();
             
-            timer_.expires_from_now( std::chrono::milliseconds( 1200 ) );
-            timer_.async_wait( [this]( const boost::system::error_code& ec ){ on_timer(ec); } );    
+            ticker_.start( std::chrono::milliseconds( 1200 ) ); // first tick after the fpga has settled
         }
     }
     
@@ -1098,11 +1479,230 @@ arpproxy::impl::handle_device_initialize()
 void
 arpproxy::impl::handle_device_read_actuals()
 {
-    uint32_t addr = 0;
-    for ( auto& a: actuals_data_ )
-        CmdRegRead( ARP_OFFSET_HV + 4 * addr++, a );
-    
-    actuals_handler_( tick_ );
+    // all read frames in one OUT transfer, all replies in one IN transfer continued past short packets.
+    // service_count_ admits one read at a time, so the frame and reply buffers are members.
+    const size_t count = actuals_data_[ 0 ].size();
+    actuals_t0_ = std::chrono::steady_clock::now();
+
+    async_reg_command( reinterpret_cast< uint8_t * >( actuals_oframe_.data() ), count * 8, actuals_rdata_.data(), count * 8
+                       , [this]( int rcode, size_t transfers ){
+                           actuals_failed_ = rcode;
+                           if ( rcode == 0 )
+                               read_actuals_transfers_ = transfers;
+                           on_actuals_read();
+                       });
+}
+
+void
+arpproxy::impl::on_actuals_read()
+{
+    const size_t count = actuals_data_[ 0 ].size();
+
+    if ( actuals_failed_ == 0 ) {
+        // fill the back buffer, then flip; the former front is the previous sample
+        auto& sample = actuals_data_[ front_ ^ 1 ];
+        for ( size_t k = 0; k < count; ++k ) {
+            const uint8_t * r = actuals_rdata_.data() + k * 8;
+            sample[ k ] = ( r[7] << 24 ) | ( r[6] << 16 ) | ( r[5] << 8 ) | r[ 4 ];
+        }
+        front_ ^= 1;
+
+        read_actuals_latency_.add( std::chrono::steady_clock::now() - actuals_t0_ );
+
+        const auto& previous = actuals_data_[ front_ ^ 1 ];
+        if ( std::any_of( std::begin( __status_registers ), std::end( __status_registers )
+                          , [&]( uint32_t addr ){ return sample[ addr ] != previous[ addr ]; } ) ) {
+            std::ostringstream o;
+            o << "{ \"notify\": [{ \"id\": \"status\", \"value\": \"";
+            make_actual_status( o );
+            o << "\" } ]}";
+            notification_handler_( o.str() );
+        }
+
+        // publish on change, and at least once a second so the client sees the tick advance
+        auto now = std::chrono::steady_clock::now();
+        if ( ( encode_actuals_delta() || now - published_at_ >= std::chrono::seconds( 1 ) ) && actuals_handler_ ) {
+            published_at_ = now;
+            actuals_handler_( tick_ );
+        }
+    } else {
+        log() << boost::format( "read actuals: %1%" ) % libusb_error_name( actuals_failed_ );
+    }
+    --service_count_;
+}
+
+size_t
+arpproxy::impl::encode_actuals_delta()
+{
+    const auto& sample = actuals_data_[ front_ ];
+    const auto& previous = actuals_data_[ front_ ^ 1 ];
+
+    size_t n = 0;
+    auto append = [&]( const char * format, auto... args ) {
+        int r = std::snprintf( delta_.data() + n, delta_.size() - n, format, args... );
+        n = std::min( n + size_t( std::max( r, 0 ) ), delta_.size() - 1 ); // sized for every actual; clamp regardless
+    };
+
+    append( "\"acts\":[{\"id\":\"hvtick\",\"value\":\"%zu\"}", tick_ );
+
+    size_t changed = 0;
+    for ( size_t i = 0; i < sizeof( __actuals ) / sizeof( __actuals[ 0 ] ); ++i ) {
+        const auto& a = __actuals[ i ];
+        if ( sample[ a.addr ] == previous[ a.addr ] && !std::isnan( published_[ i ] ) )
+            continue;
+        double value = a.world_value( sample[ a.addr ] );
+        double deadband = a.relative ? std::abs( published_[ i ] ) * a.deadband : a.deadband;
+        if ( std::abs( value - published_[ i ] ) < deadband ) // false while nothing is published yet
+            continue;
+        published_[ i ] = value;
+        ++changed;
+        append( ",{\"id\":\"%s\",\"value\":\"", a.id );
+        append( a.format, value );
+        append( "\"}" );
+    }
+    append( "]" );
+    delta_size_ = n;
+
+    return changed;
+}
+
+void
+arpproxy::impl::async_reg_write( uint32_t addr, uint32_t data, std::function< void( bool ) > done )
+{
+    auto oframe = std::make_shared< std::array< uint8_t, 12 > >( std::array< uint8_t, 12 >{{
+                0x15, 0x0C, 0, 0x0F
+                , uint8_t( (unsigned(addr) >>  0) & 0xff)
+                , uint8_t( (unsigned(addr) >>  8) & 0xff)
+                , uint8_t( (unsigned(addr) >> 16) & 0xff)
+                , uint8_t( (unsigned(addr) >> 24) & 0xff)
+                , uint8_t( (unsigned(data) >>  0) & 0xff)
+                , uint8_t( (unsigned(data) >>  8) & 0xff)
+                , uint8_t( (unsigned(data) >> 16) & 0xff)
+                , uint8_t( (unsigned(data) >> 24) & 0xff) }} );
+    auto iframe = std::make_shared< std::array< uint8_t, 8 > >();
+
+    async_reg_command( oframe->data(), oframe->size(), iframe->data(), iframe->size()
+                       , [=]( int rcode, size_t ){
+                           if ( rcode )
+                               log() << boost::format( "CmdRegWrite( 0x%x:0x%x ) %s." ) % addr % data % libusb_error_name( rcode );
+                           ( void )oframe;
+                           ( void )iframe;
+                           done( rcode == 0 );
+                       });
+}
+
+void
+arpproxy::impl::async_reg_command( uint8_t * frames, size_t nbytes, uint8_t * replies, size_t length
+                                   , std::function< void( int, size_t ) > done )
+{
+    do {
+        std::lock_guard< std::mutex > lock( mutex_ );
+        if ( usb_device_handle_ ) {
+            usb_->async_bulk_transfer( usb_device_handle_, RegBulkOut, frames, int( nbytes ), 1000
+                                       , [=]( int rcode, int ){
+                                           if ( rcode ) {
+                                               done( rcode, 0 ); // not sent, so no reply will come
+                                               return;
+                                           }
+                                           // OUT completions arrive in submission order, so this keeps the replies in command order
+                                           readers_.push_back( reply_reader{ replies, length, 0, 0, done } );
+                                           if ( readers_.size() == 1 )
+                                               read_replies();
+                                       });
+            return;
+        }
+    } while ( 0 );
+
+    done( LIBUSB_ERROR_NO_DEVICE, 0 );
+}
+
+void
+arpproxy::impl::read_replies()
+{
+    auto& r = readers_.front();
+    do {
+        std::lock_guard< std::mutex > lock( mutex_ );
+        if ( usb_device_handle_ ) {
+            ++r.transfers;
+            usb_->async_bulk_transfer( usb_device_handle_, RegBulkIn, r.data + r.received, int( r.length - r.received ), 1000
+                                       , [this]( int rcode, int transferred ){ on_replies_read( rcode, transferred ); } );
+            return;
+        }
+    } while ( 0 );
+
+    on_replies_read( LIBUSB_ERROR_NO_DEVICE, 0 );
+}
+
+void
+arpproxy::impl::on_replies_read( int rcode, int transferred )
+{
+    auto& r = readers_.front();
+    if ( rcode == 0 && transferred == 0 )
+        rcode = LIBUSB_ERROR_IO;
+    r.received += size_t( std::max( transferred, 0 ) );
+
+    if ( rcode == 0 && r.received < r.length ) {
+        read_replies(); // a short packet ended the transfer; continue where it stopped
+        return;
+    }
+
+    auto reader = std::move( r );
+    readers_.pop_front();
+    if ( !readers_.empty() )
+        read_replies();
+    reader.done( rcode, reader.transfers );
+}
+
+void
+arpproxy::impl::hv_write( uint32_t index, uint32_t data )
+{
+    do {
+        std::lock_guard< std::mutex > lock( mutex_ );
+        // while writes are in flight the shadow lags behind; compare with what was asked last
+        if ( pending_[ index ] ? requested_[ index ] == data : ( shadow_valid_.test( index ) && shadow_[ index ] == data ) ) {
+            ++shadow_suppressed_;
+            return;
+        }
+        requested_[ index ] = data;
+        ++pending_[ index ];
+    } while ( 0 );
+
+    ++shadow_writes_;
+    // the shadow takes the value once the FPGA acknowledged it, unless a newer write is queued
+    // behind it; after a failure the register is unknown, so that the next write of it goes out
+    async_reg_write( ARP_OFFSET_HV + index * 4, data, [this, index, data]( bool success ){
+            std::lock_guard< std::mutex > lock( mutex_ );
+            if ( --pending_[ index ] == 0 && success ) {
+                shadow_[ index ] = data;
+                shadow_valid_.set( index );
+            } else if ( !success ) {
+                shadow_valid_.reset( index );
+            }
+        });
+}
+
+bool
+arpproxy::impl::resync_shadow()
+{
+    std::array< uint32_t, 32 > addrs, values;
+    for ( size_t i = 0; i < addrs.size(); ++i )
+        addrs[ i ] = ARP_OFFSET_HV + 4 * uint32_t( i );
+
+    if ( !CmdRegVectorRead( addrs.begin(), addrs.end(), values.begin() ) ) {
+        shadow_valid_.reset(); // unknown; the next write of each register goes out
+        return false;
+    }
+
+    size_t differ = 0;
+    for ( size_t i = 0; i < values.size(); ++i ) {
+        if ( shadow_valid_.test( i ) && shadow_[ i ] != values[ i ] )
+            ++differ;
+        shadow_[ i ] = values[ i ];
+    }
+    shadow_valid_.set();
+
+    log() << boost::format( "HV shadow resynced, %1% register(s) differed from hardware" ) % differ;
+    return true;
 }
 
 void
@@ -1114,7 +1714,7 @@ arpproxy::impl::handle_device_setvoltage( uint32_t addr, double world_value )
         uint32_t device_value = it->second.device_value( world_value );
         setpts_data_[ addr ] = std::make_pair( world_value, device_value );
 
-        CmdRegWrite( ARP_OFFSET_HV + addr * 4, device_value );
+        hv_write( addr, device_value );
 
         if ( __verbose_level__ >= log::INFO )
             log() << boost::format( "handle_device_setvoltage( 0x%x, %d ) <= %.2f" ) % addr % device_value % world_value;
@@ -1137,7 +1737,7 @@ arpproxy::impl::handle_device_on( bool on )
     setpts_data_[ arp::setpt_pumpValveCtrl ].second &= ~0x2000; // vent valve to be closed
 
     auto addr = arp::setpt_pumpValveCtrl;
-    CmdRegWrite( ARP_OFFSET_HV + addr * 4, setpts_data_[ addr ].second );
+    hv_write( addr, setpts_data_[ addr ].second );
 
     handle_device_setflag( arp::setpt_aux1, -1, on );
 }
@@ -1151,7 +1751,7 @@ arpproxy::impl::handle_device_setflag( uint32_t addr, uint32_t mask, bool value
     
     if ( addr == arp::setpt_aux1 ) { // moduel on/off
 
-        if ( mask == ( -1 ) ) {
+        if ( mask == uint32_t( -1 ) ) {
             if ( value ) {
                 setpts_data_[ arp::setpt_aux1 ].second = 0x1fff;
                 setpts_data_[ arp::setpt_aux2 ].second |= 0x001e;
@@ -1159,19 +1759,19 @@ arpproxy::impl::handle_device_setflag( uint32_t addr, uint32_t mask, bool value
                 setpts_data_[ arp::setpt_aux1 ].second = 0x0001;
                 setpts_data_[ arp::setpt_aux2 ].second &= ~0x001e;
             }
-            CmdRegWrite( ARP_OFFSET_HV + arp::setpt_aux1 * 4, setpts_data_[ arp::setpt_aux1 ].second );
-            CmdRegWrite( ARP_OFFSET_HV + arp::setpt_aux2 * 4, setpts_data_[ arp::setpt_aux2 ].second );
+            hv_write( arp::setpt_aux1, setpts_data_[ arp::setpt_aux1 ].second );
+            hv_write( arp::setpt_aux2, setpts_data_[ arp::setpt_aux2 ].second );
         } else {
             uint32_t f = value ? mask : 0;
-            setpts_data_[ addr ].second = setpts_data_[ addr ].second & ~mask | f;
-            CmdRegWrite( ARP_OFFSET_HV + addr * 4, setpts_data_[ addr ].second );
+            setpts_data_[ addr ].second = ( setpts_data_[ addr ].second & ~mask ) | f;
+            hv_write( addr, setpts_data_[ addr ].second );
         }
 
     } else if ( addr == arp::setpt_aux2 ) { // Filament selection
 
         uint32_t f = value ? mask : 0;
-        setpts_data_[ arp::setpt_aux2 ].second = setpts_data_[ arp::setpt_aux2 ].second & ~mask | f; 
-        CmdRegWrite( ARP_OFFSET_HV + addr * 4, setpts_data_[ addr ].second );       
+        setpts_data_[ arp::setpt_aux2 ].second = ( setpts_data_[ arp::setpt_aux2 ].second & ~mask ) | f;
+        hv_write( addr, setpts_data_[ addr ].second );       
 
     } else if ( addr == infitof::arp::setpt_pumpValveCtrl ) {
 
@@ -1179,8 +1779,8 @@ arpproxy::impl::handle_device_setflag( uint32_t addr, uint32_t mask, bool value
         setpts_data_[ addr ].second &= ~0x2000; // vent valve to be closed
 
         uint32_t f = value ? mask : 0;
-        setpts_data_[ addr ].second = setpts_data_[ addr ].second & ~mask | f;
-        CmdRegWrite( ARP_OFFSET_HV + addr * 4, setpts_data_[ addr ].second );
+        setpts_data_[ addr ].second = ( setpts_data_[ addr ].second & ~mask ) | f;
+        hv_write( addr, setpts_data_[ addr ].second );
     }
 
     // check if flag changed.  this prevent event fire loop between bootstrap-toggle
@@ -1222,7 +1822,7 @@ int
 arpproxy::impl::bulk_transfer( endpoint ep, uint8_t * data, int length, int& transferred, uint32_t timeout )
 {
     if ( usb_device_handle_ ) {
-        return libusb_bulk_transfer( usb_device_handle_, ep, data, length, &transferred, timeout );
+        return usb_->bulk_transfer( usb_device_handle_, ep, data, length, transferred, timeout );
     }
     return -1;
 }
@@ -1231,7 +1831,7 @@ int
 arpproxy::impl::bulk_transfer( endpoint ep, const uint8_t * data, int length, int& transferred, uint32_t timeout )
 {
     if ( usb_device_handle_ ) {
-        return libusb_bulk_transfer( usb_device_handle_, ep, const_cast< uint8_t *>( data ), length, &transferred, timeout );
+        return usb_->bulk_transfer( usb_device_handle_, ep, const_cast< uint8_t *>( data ), length, transferred, timeout );
     }
     return -1;
 }
@@ -1261,44 +1861,29 @@ arpproxy::impl::device_setflag( const std::string& id, bool value )
 void
 arpproxy::impl::make_actual_status( std::ostream& o )
 {
-#if defined WIN32
-# pragma warning(disable:4800)
-#endif
-    class textcolor {
-        const char * true_color_;
-        const char * false_color_;
-    public:
-        textcolor( const char * true_color = "blue", const char * false_color = "red" )
-            : true_color_( true_color ), false_color_( false_color )
-            {}
-        
-        std::string operator()( bool state, const std::string& true_text, const std::string& false_text ) const {
-            return (boost::format( "<font color='%s'>%s</font>" ) % (state ? true_color_ : false_color_) % (state ? true_text : false_text)).str();
-        }
+    auto textile = [&o]( bool state, const char * true_text, const char * false_text ) -> std::ostream& {
+        return o << "<font color='" << ( state ? "blue" : "red" ) << "'>" << ( state ? true_text : false_text ) << "</font>";
     };
-    
-    textcolor textile;
-
-    uint32_t ion_vac_state = ( actuals_data_[ arp::act_pumpValveCtrl ] & 0xf0) >> 4;
-    uint32_t analyzer_vac_state = actuals_data_[ arp::act_pumpValveCtrl ] & 0x0f;
-
-    o << boost::format( "<b>I.S.:</b> VAC[%s] TMP[%s] DFP[%s] ST[0x%x]" )
-        % textile( actuals_data_[ arp::act_pumpValveCtrl ] & 0x800, "RDY", "!RDY" )
-        % textile( actuals_data_[ arp::act_devStateMonitor ] & 0x20, "ON", "OFF" )
-        % textile( actuals_data_[ arp::act_devStateMonitor ] & 0x80, "ON", "OFF" )
-        % ion_vac_state
-        << boost::format( " <b>Analyzer:</b> VAC[%s] TMP[%s] DFP[%s] ST[0x%x]" )
-        % textile( actuals_data_[ arp::act_pumpValveCtrl ] & 0x400, "RDY", "!RDY" )
-        % textile( actuals_data_[ arp::act_devStateMonitor ] & 0x10, "ON", "OFF" )
-        % textile( actuals_data_[ arp::act_devStateMonitor ] & 0x40, "ON", "OFF" )
-        % analyzer_vac_state;
-    o << boost::format( " <b>ALARM</b>[0x%x, 0x%x]" ) % actuals_data_[ arp::act_aux1_alarm ] % actuals_data_[ arp::act_aux2_alarm ];
-    o << boost::format( " DOOR=[%s]" ) % textile(!(actuals_data_[ arp::act_devStateMonitor ] & 0x800), "CLOSE", "OPEN");
-    // o << boost::format( " [%s]" ) % ((actuals_data_[ arp::act_devStateMonitor ] & 0x400) ? "LOCAL" : "REMOTE");
-    o << boost::format( " GAUGE[%s]" ) % textile( actuals_data_[ arp::act_devStateMonitor ] & 0x100, "ON", "OFF");
-    o << boost::format( " VENT[%s] STD.V[%s] SAMP.V[%s] IS.V[%s]" )
-        % textile( !(actuals_data_[ arp::act_devStateMonitor ] & 0x08), "CLOSE", "OPEN" )  // vent
-        % textile( !(actuals_data_[ arp::act_devStateMonitor ] & 0x04), "CLOSE", "OPEN" )  // std
-        % textile( !(actuals_data_[ arp::act_devStateMonitor ] & 0x02), "CLOSE", "OPEN" )  // samp
-        % textile( !(actuals_data_[ arp::act_devStateMonitor ] & 0x01), "CLOSE", "OPEN" ); // IS
+
+    const auto& actuals = actuals_data_[ front_ ];
+    uint32_t pump = actuals[ arp::act_pumpValveCtrl ];
+    uint32_t state = actuals[ arp::act_devStateMonitor ];
+
+    o << "<b>I.S.:</b> VAC[";    textile( pump & 0x800, "RDY", "!RDY" );
+    o << "] TMP[";               textile( state & 0x20, "ON", "OFF" );
+    o << "] DFP[";               textile( state & 0x80, "ON", "OFF" );
+    o << "] ST[0x" << std::hex << ( ( pump & 0xf0 ) >> 4 ) << std::dec << "]";
+    o << " <b>Analyzer:</b> VAC["; textile( pump & 0x400, "RDY", "!RDY" );
+    o << "] TMP[";               textile( state & 0x10, "ON", "OFF" );
+    o << "] DFP[";               textile( state & 0x40, "ON", "OFF" );
+    o << "] ST[0x" << std::hex << ( pump & 0x0f ) << std::dec << "]";
+    o << " <b>ALARM</b>[0x" << std::hex << actuals[ arp::act_aux1_alarm ] << ", 0x" << actuals[ arp::act_aux2_alarm ] << std::dec << "]";
+    o << " DOOR=[";              textile( !( state & 0x800 ), "CLOSE", "OPEN" );
+    // o << " [" << ( ( state & 0x400 ) ? "LOCAL" : "REMOTE" ) << "]";
+    o << "] GAUGE[";             textile( state & 0x100, "ON", "OFF" );
+    o << "] VENT[";              textile( !( state & 0x08 ), "CLOSE", "OPEN" );  // vent
+    o << "] STD.V[";             textile( !( state & 0x04 ), "CLOSE", "OPEN" );  // std
+    o << "] SAMP.V[";            textile( !( state & 0x02 ), "CLOSE", "OPEN" );  // samp
+    o << "] IS.V[";              textile( !( state & 0x01 ), "CLOSE", "OPEN" );  // IS
+    o << "]";
 }
@@ -49,9 +49,12 @@ namespace dg {
         void register_notification_handler( std::function<void( const std::string& )> );        
         void setpts_json_response( std::ostream& o );
         void actuals_json_response( size_t, std::ostream& o );
+        void actuals_delta_json_response( std::ostream& o ); // changed actuals only, call from the actuals handler
         void flags_json_response( std::ostream& o );        
+        void metrics_json_response( std::ostream& o ); // batched actuals read timing
         void set( const std::string&, double value );
         void set( const std::string&, bool value );        
+        void resync(); // reconcile the HV register shadow against the hardware
             
         class impl;
     private:
@@ -0,0 +1,180 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+// Regression test for arpproxy against the simulated EZ-USB/FPGA: device bring-up through
+// the FPGA reset handshake, the batched actuals read and its deadband delta, and HV setpoint
+// writes through the register shadow, including a setpoint changed back while its write is in
+// flight and a write the FPGA does not acknowledge.  Exits non-zero on the first failure.
+
+#include "arpproxy.hpp"
+#include "arp_simulator.hpp"
+#include <infitofdefns/avgr_arp.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+int __verbose_level__ = 0;
+bool __debug_mode__ = true;
+const char * __argv0__ = "arpproxy_test";
+
+namespace {
+
+    using dg::arp_simulator;
+
+    const uint32_t hv_offset = 0x00004800;
+
+    int failures = 0;
+
+    void check( bool cond, const std::string& what )
+    {
+        if ( !cond ) {
+            std::cerr << "FAIL: " << what << std::endl;
+            ++failures;
+        }
+    }
+
+    bool wait_for( std::function< bool() > cond, std::chrono::milliseconds timeout )
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while ( !cond() ) {
+            if ( std::chrono::steady_clock::now() > deadline )
+                return false;
+            std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+        }
+        return true;
+    }
+
+    // an integer member of the metrics json
+    long metric( dg::arpproxy& proxy, const std::string& key )
+    {
+        std::ostringstream o;
+        proxy.metrics_json_response( o );
+        auto json = o.str();
+        auto pos = json.find( "\"" + key + "\":" );
+        return pos == std::string::npos ? -1 : std::stol( json.substr( pos + key.size() + 3 ) );
+    }
+}
+
+int
+main( int, char ** )
+{
+    auto sim = arp_simulator::instance();
+    sim->setLatency( std::chrono::microseconds( 20 ) );
+    sim->on_read( 0x3c04, []( uint32_t v, size_t n ){ return n >= 3 ? v | 2 : v & ~2u; } ); // FPGA ready after a few polls
+    sim->setReg( 0x4320, 0x10000000 );
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector< std::string > deltas;
+
+    dg::arpproxy proxy;
+    proxy.register_notification_handler( []( const std::string& ){} );
+    proxy.register_actuals_handler( [&]( size_t ){
+            std::ostringstream o;
+            proxy.actuals_delta_json_response( o );
+            std::lock_guard< std::mutex > lock( mutex );
+            deltas.push_back( o.str() );
+            cond.notify_all();
+        });
+
+    do {
+        std::unique_lock< std::mutex > lock( mutex );
+        check( cond.wait_for( lock, std::chrono::seconds( 5 ), [&]{ return !deltas.empty(); } ), "actuals are read after the device comes up" );
+    } while ( 0 );
+
+    // the first delta carries every actual; later ones only what moved by the deadband (0.1 V)
+    // since it was last published
+    const uint32_t acc = hv_offset + 4 * infitof::arp::act_accVoltage;
+    auto delta = [&]( size_t i ){ std::lock_guard< std::mutex > lock( mutex ); return deltas.at( i ); };
+    auto ndeltas = [&]{ std::lock_guard< std::mutex > lock( mutex ); return deltas.size(); };
+    auto published = [&]( const std::string& d, const std::string& id ){ return d.find( "\"id\":\"" + id + "\"" ) != std::string::npos; };
+
+    check( ndeltas() > 0 && published( delta( 0 ), "Vacc.ACT" ) && published( delta( 0 ), "Vdetector.ACT" ) && published( delta( 0 ), "H100W.ACT" )
+           , "first delta publishes every actual" );
+
+    size_t seen = ndeltas(), last = 0;
+    auto reads = sim->stats().reg_reads;
+    sim->setReg( acc, 5 ); // 0.05 V
+    check( wait_for( [&]{ return sim->stats().reg_reads >= reads + 64; }, std::chrono::seconds( 3 ) ), "actuals are read again" );
+    sim->setReg( acc, 20 ); // 0.20 V
+    do {
+        std::unique_lock< std::mutex > lock( mutex );
+        check( cond.wait_for( lock, std::chrono::seconds( 3 ), [&]{ return deltas.size() > seen && published( deltas.back(), "Vacc.ACT" ); } )
+               , "a change beyond the deadband is published" );
+        last = deltas.size() - 1;
+    } while ( 0 );
+    for ( size_t i = seen; i < last; ++i )
+        check( !published( delta( i ), "Vacc.ACT" ), "a change within the deadband is not published" );
+    check( delta( last ).find( "{\"id\":\"Vacc.ACT\",\"value\":\"0.20\"}" ) != std::string::npos, "delta carries the new value" );
+    check( !published( delta( last ), "Vdetector.ACT" ), "unchanged actuals are left out of the delta" );
+
+    const uint32_t det = hv_offset + 4 * infitof::arp::setpt_detVoltage;
+
+    proxy.set( "Vdetector.SET", 12.34 );
+    check( wait_for( [&]{ return sim->reg( det ) == 1234; }, std::chrono::seconds( 1 ) ), "setpoint reaches the HV register" );
+    std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) ); // the reply is read after the request went out
+
+    long suppressed = metric( proxy, "hv_writes_suppressed" );
+    proxy.set( "Vdetector.SET", 12.34 );
+    check( wait_for( [&]{ return metric( proxy, "hv_writes_suppressed" ) == suppressed + 1; }, std::chrono::seconds( 1 ) )
+           , "unchanged setpoint is answered from the shadow" );
+
+    // X, Y, X back to back: the last write differs from the one before it, though not from the
+    // acknowledged value, so it must go out
+    long sent = metric( proxy, "hv_writes" );
+    proxy.set( "Vdetector.SET", 15.0 );
+    proxy.set( "Vdetector.SET", 12.34 );
+    check( wait_for( [&]{ return metric( proxy, "hv_writes" ) == sent + 2; }, std::chrono::seconds( 1 ) )
+           , "a setpoint changed back while in flight is sent again" );
+    std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+    check( sim->reg( det ) == 1234, "the register ends at the last setpoint" );
+
+    // a write the FPGA does not take must not enter the shadow, so that sending it again goes out
+    auto faults = sim->stats().faults;
+    sim->inject_write_fault( det, arp_simulator::error_pipe );
+    proxy.set( "Vdetector.SET", 20.0 );
+    check( wait_for( [&]{ return sim->stats().faults > faults; }, std::chrono::seconds( 1 ) ), "injected fault is hit" );
+    std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+    check( sim->reg( det ) == 1234, "failed write leaves the register" );
+
+    long writes = metric( proxy, "hv_writes" );
+    proxy.set( "Vdetector.SET", 20.0 );
+    check( wait_for( [&]{ return sim->reg( det ) == 2000; }, std::chrono::seconds( 1 ) ), "failed write is sent again" );
+    check( metric( proxy, "hv_writes" ) == writes + 1, "failed write is not answered from the shadow" );
+
+    if ( failures ) {
+        std::cerr << failures << " failure(s)" << std::endl;
+        return 1;
+    }
+    std::cout << "arpproxy: all tests passed" << std::endl;
+    return 0;
+}
@@ -25,11 +25,14 @@
 
 #include "bnc565.hpp"
 #include "log.hpp"
+#include "reactor.hpp"
+#include "registry.hpp"
 #include "serialport.hpp"
 #include "dgprotocols.hpp" // handle json
 #include <boost/format.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <fcntl.h>
@@ -53,17 +56,86 @@ namespace dg {
 
     std::atomic_flag lock = ATOMIC_FLAG_INIT;
 
-    const uint32_t resolution = 10;
+    // fields of 'to' that differ from 'from', compared in device ticks
+    static void
+    diff( const protocols<>& from, const protocols<>& to, bool with_state, std::vector< change_event >& changes )
+    {
+        if ( from.interval_ticks() != to.interval_ticks() )
+            changes.push_back( { change_interval, -1, to.interval_ticks() } );
+
+        if ( with_state && from.state() != to.state() )
+            changes.push_back( { change_trigger, -1, to.state() ? 1 : 0 } );
+
+        const auto& cur = *from.begin();
+        const auto& p = *to.begin();
+
+        uint32_t polarities = cur.polarities() ^ p.polarities();
+        uint32_t states = cur.states() ^ p.states();
+
+        for ( int ch = 0; ch < int( p.size ); ++ch ) {
+            if ( cur.delay_ticks( ch ) != p.delay_ticks( ch ) )
+                changes.push_back( { change_delay, ch, p.delay_ticks( ch ) } );
+            if ( cur.width_ticks( ch ) != p.width_ticks( ch ) )
+                changes.push_back( { change_width, ch, p.width_ticks( ch ) } );
+            if ( polarities & ( 1u << ch ) )
+                changes.push_back( { change_polarity, ch, p.polarity( ch ) } );
+            if ( states & ( 1u << ch ) )
+                changes.push_back( { change_state, ch, p.state( ch ) } );
+        }
+    }
+
+    // every field of the first protocol, for a download over an unknown image
+    static void
+    all_fields( const protocols<>& d, std::vector< change_event >& changes )
+    {
+        changes.push_back( { change_interval, -1, d.interval_ticks() } );
+        for ( int ch = 0; ch < int( protocol<>::size ); ++ch ) {
+            changes.push_back( { change_delay, ch, d.begin()->delay_ticks( ch ) } );
+            changes.push_back( { change_width, ch, d.begin()->width_ticks( ch ) } );
+            changes.push_back( { change_polarity, ch, d.begin()->polarity( ch ) } );
+            changes.push_back( { change_state, ch, d.begin()->state( ch ) } );
+        }
+    }
 
-    inline uint32_t
+    // the image after an acknowledged write
+    static void
+    apply( protocols<>& d, const change_event& c )
+    {
+        auto& p = *d.begin();
+        switch ( c.field ) {
+        case change_delay:    p.setDelayTicks( c.channel, c.value ); break;
+        case change_width:    p.setWidthTicks( c.channel, c.value ); break;
+        case change_polarity: p.setPolarity( c.channel, c.value != 0 ); break;
+        case change_state:    p.setState( c.channel, c.value != 0 ); break;
+        case change_interval: d.setIntervalTicks( c.value ); break;
+        case change_trigger:  d.setState( c.value != 0 ); break;
+        }
+    }
 
-    seconds_to_device( const double& t ) {
-        return static_cast< uint32_t >( ( t * 1.0e9 ) / resolution + 0.5 );
+    // a write or readback error on a change; state, polarity and trigger are flags, not times
+    static validation_error
+    change_error( validation_code code, const change_event& c )
+    {
+        bool flag = c.field == change_polarity || c.field == change_state || c.field == change_trigger;
+        return { 0, c.channel, code, c.value, flag ? flag_value : ticks_value };
     }
 
-    inline double
-    device_to_seconds( const uint32_t& t ) {
-        return ( t * resolution ) * 1.0e-9;
+    // queries sent back to back in one write; bounded by what the device input buffer holds
+    const size_t pipeline_depth = 16;
+
+    static std::string
+    scpi_command( const change_event& c )
+    {
+        const std::string channel = std::to_string( c.channel + 1 );
+        switch ( c.field ) {
+        case change_delay:    return ":PULSE" + channel + ":DELAY " + format_ticks( c.value, seconds_digits ) + "\r\n";
+        case change_width:    return ":PULSE" + channel + ":WIDTH " + format_ticks( c.value, seconds_digits ) + "\r\n";
+        case change_polarity: return ":PULSE" + channel + ( c.value ? ":POL INV\r\n" : ":POL NORM\r\n" );
+        case change_state:    return ":PULSE" + channel + ( c.value ? ":STATE ON\r\n" : ":STATE OFF\r\n" );
+        case change_interval: return ":PULSE0:PER " + format_ticks( c.value, seconds_digits ) + "\r\n";
+        case change_trigger:  return c.value ? ":PULSE0:STATE ON\r\n" : ":PULSE0:STATE OFF\r\n";
+        }
+        return std::string();
     }
 }
 
@@ -72,8 +144,7 @@ using namespace dg;
 bnc565 *
 bnc565::instance()
 {
-    static bnc565 __instance;
-    return &__instance;
+    return registry::instance()->find( registry::instance()->default_id() );
 }
 
 bnc565::operator bool () const
@@ -84,16 +155,49 @@ bnc565::operator bool () const
 bool
 bnc565::state() const
 {
-    if ( usb_->is_open() )
+    if ( usb_->is_open() ) {
+        std::lock_guard< std::mutex > lock( image_mutex_ );
         return protocols_.state();
+    }
     return false;
 }
 
+dg::protocols<>
+bnc565::image() const
+{
+    std::lock_guard< std::mutex > lock( image_mutex_ );
+    return protocols_;
+}
+
+void
+bnc565::update_image( const dg::protocols<>& next, bool with_state )
+{
+    std::vector< change_event > changes;
+
+    do {
+        std::lock_guard< std::mutex > lock( image_mutex_ );
+
+        diff( protocols_, next, with_state, changes );
+
+        protocols_.setIntervalTicks( next.interval_ticks() );
+        if ( with_state ) {
+            protocols_.setState( next.state() );
+            protocols_.setIdn( next.idn() );
+            protocols_.setFull( next.full() );
+        }
+        *protocols_.begin() = *next.begin();
+    } while ( 0 );
+
+    if ( !changes.empty() )
+        change_handler_( changes );
+}
+
 bnc565::~bnc565()
 {
-    timer_.cancel();
-    
-    io_service_.stop();
+    ticker_.stop();
+
+    if ( own_io_service_ )
+        io_service_.stop();
 
     for ( auto& t: threads_ )
         t.join();
@@ -101,32 +205,52 @@ bnc565::~bnc565()
     log() << "memmap closed";
 }
 
-bnc565::bnc565() : timer_( io_service_ )
-                 , tick_( 0 )
-                 , deviceType_( NONE )
+bnc565::bnc565() : deviceType_( NONE )
+                 , own_io_service_( reactor::enabled() ? nullptr : new boost::asio::io_service() )
+                 , io_service_( own_io_service_ ? *own_io_service_ : reactor::io_service() )
+                 , ticker_( io_service_, std::chrono::seconds( 1 ) )
+                 , commands_c_( 0 )
+                 , retries_c_( 0 )
+                 , timeouts_c_( 0 )
+                 , resent_c_( 0 )
+                 , verify_( false )
+                 , image_valid_( false )
+                 , sync_( validator::t0() )
+                 , sync_valid_( false )
+                 , fetch_in_progress_( false )
+                 , fetch_generation_( 0 )
+                 , fetch_result_( false )
+                 , fetch_freshness_( 0 )
+                 , fetch_epoch_( 0 )
 {
-    boost::system::error_code ec;
-    timer_.expires_from_now( std::chrono::milliseconds( 1000 ) );
-    timer_.async_wait( [this]( const boost::system::error_code& ec ){ on_timer(ec); } );
+    ticker_.start();
 
-    threads_.push_back( std::thread( [=]{ io_service_.run(); } ) );
+    if ( own_io_service_ )
+        threads_.push_back( std::thread( [=]{ reactor::configure_thread(); io_service_.run(); } ) );
 }
 
 void
-bnc565::on_timer( const boost::system::error_code& ec )
+bnc565::setTickPeriod( std::chrono::steady_clock::duration period )
 {
-    if ( !ec ) {
-        ++tick_;
-        handler_( tick_ );
-    }
-    timer_.expires_from_now( std::chrono::milliseconds( 1000 ) );
-    timer_.async_wait( [this]( const boost::system::error_code& ec ){ on_timer(ec); } );    
+    ticker_.setPeriod( period );
+}
+
+std::chrono::steady_clock::duration
+bnc565::tickPeriod() const
+{
+    return ticker_.period();
 }
 
 boost::signals2::connection
 bnc565::register_handler( const tick_handler_t::slot_type & subscriber )
 {
-    return handler_.connect( subscriber );
+    return ticker_.connect( subscriber );
+}
+
+boost::signals2::connection
+bnc565::register_change_handler( const change_handler_t::slot_type & subscriber )
+{
+    return change_handler_.connect( subscriber );
 }
 
 std::pair<double, double>
@@ -140,106 +264,378 @@ bnc565::setPulse( uint32_t channel, const std::pair<double, double>& t )
 {
 }
 
+bool
+bnc565::commit( const dg::protocols<>& d, std::vector< validation_error >& errors )
+{
+    return _commit( d, errors, verify_ );
+}
+
 void
-bnc565::commit( const dg::protocols<>& d )
+bnc565::setVerify( bool verify )
 {
-    const auto& p = *d.begin();
+    verify_ = verify;
+}
+
+bool
+bnc565::_commit( const dg::protocols<>& d, std::vector< validation_error >& errors, bool verify )
+{
+    scheduler::scoped_lock lock( scheduler_, priority_commit );
+
+    if ( !sync_valid_ )
+        query_sync();
+
+    if ( ! validator( sync_sources() )( d, errors ) )
+        return false;
+
     std::string reply;
 
     // dg::protocols<>::write_json( std::cout, d );
 
-    _xsend( (boost::format(":PULSE0:PER %1%\r\n") % d.interval() ).str().c_str(), reply, "ok", 10 );
-    
-    for ( int ch = 1; ch <= p.size; ++ch ) {
-        
-        const auto& v = p[ ch - 1 ];
-        const char * state = std::get< dg::pulse_state >( v ) ? "ON" : "OFF";
-        const char * pol = std::get< dg::pulse_polarity >( v ) ? "NORM" : "INV";
-        std::string delay = ( boost::format( "%g" ) % std::get< dg::pulse_delay >( v ) ).str();
-        std::string width = ( boost::format( "%g" ) % std::get< dg::pulse_width >( v ) ).str();
-        
-        _xsend( (boost::format(":PULSE%1%:STATE %2%\r\n") % ch % state ).str().c_str(), reply, "ok", 10 );
-        
-        _xsend( (boost::format(":PULSE%1%:POL %2%\r\n")   % ch % pol ).str().c_str(), reply, "ok", 10 );
-        
-        _xsend( (boost::format(":PULSE%1%:DELAY %2%\r\n") % ch % delay ).str().c_str(), reply, "ok", 10 );
-        
-        _xsend( (boost::format(":PULSE%1%:WIDTH %2%\r\n") % ch % width ).str().c_str(), reply, "ok", 10 );
+    // only fields that differ from a device-confirmed image; everything otherwise
+    std::vector< change_event > changes;
+    if ( image_valid_ )
+        diff( image(), d, false, changes );
+    else
+        all_fields( d, changes );
+
+    // the image takes only what the device acknowledged
+    auto next = image();
+    std::vector< change_event > failed;
+    for ( const auto& c: changes ) {
+        if ( _xsend( scpi_command( c ).c_str(), reply, "ok", 10 ) )
+            apply( next, c );
+        else
+            failed.push_back( c );
+    }
+
+    invalidate_fetch();
+
+    if ( !failed.empty() ) {
+        image_valid_ = false; // a NAKed write may have been applied anyway; send everything next time
+        update_image( next, false );
+        for ( const auto& c: failed )
+            errors.push_back( change_error( write_failed, c ) );
+        return false;
     }
+
+    update_image( d, false );
+
+    if ( verify && usb_->is_open() ) {
+        std::vector< change_event > mismatches;
+        this->verify( d, mismatches );
+        for ( const auto& m: mismatches )
+            errors.push_back( change_error( readback_mismatch, m ) );
+        return mismatches.empty();
+    }
+
+    return true;
+}
+
+// :PULSE0:PER and every channel's STATE, WIDTH, DELAY and POL as pipelined queries; false
+// if a reply is missing or unreadable
+bool
+bnc565::readback( dg::protocols<>& d )
+{
+    static const char * fields [] = { "STATE", "WIDTH", "DELAY", "POL" };
+
+    std::vector< std::string > queries{ ":PULSE0:PER?\r\n" };
+    for ( size_t ch = 0; ch < protocol<>::size; ++ch )
+        for ( auto field: fields )
+            queries.push_back( ( boost::format( ":PULSE%1%:%2%?\r\n" ) % ( ch + 1 ) % field ).str() );
+
+    std::vector< std::string > replies;
+    if ( ! _xsend( queries, replies ) )
+        return false;
+
+    try {
+        auto reply = replies.begin();
+        d.setInterval( boost::lexical_cast< double >( *reply++ ) );
+
+        auto& protocol = *d.begin();
+        for ( size_t ch = 0; ch < protocol.size; ++ch ) {
+            protocol.setState( ch, boost::lexical_cast< int >( *reply++ ) );
+            protocol.setWidth( ch, boost::lexical_cast< double >( *reply++ ) );
+            protocol.setDelay( ch, boost::lexical_cast< double >( *reply++ ) );
+            protocol.setPolarity( ch, ( *reply == "NORM" || *reply == "HIGH" ) ? dg::positive_polarity : dg::negative_polarity );
+            ++reply;
+        }
+    } catch ( boost::bad_lexical_cast& ex ) {
+        log( log::ERR ) << boost::format( "%1%:%2% readback: %3%" ) % __FILE__ % __LINE__ % ex.what();
+        return false;
+    }
+    return true;
+}
+
+// compares a readback with the request in ticks and re-sends only the fields that differ,
+// once; mismatches holds what the device still reports differently
+void
+bnc565::verify( const dg::protocols<>& d, std::vector< change_event >& mismatches )
+{
+    std::string reply;
+
+    for ( int round = 0;; ++round ) {
+        auto r = image();
+        mismatches.clear();
+        if ( readback( r ) ) {
+            diff( r, d, false, mismatches );
+            update_image( r, false );
+        } else {
+            all_fields( d, mismatches );
+        }
+
+        if ( mismatches.empty() || round == 1 )
+            break;
+
+        log( log::WARN ) << boost::format( "%1%: %2% field(s) differ after commit, re-sending" ) % ttyname_ % mismatches.size();
+        for ( const auto& c: mismatches )
+            _xsend( scpi_command( c ).c_str(), reply, "ok", 10 );
+        resent_c_ += mismatches.size();
+    }
+    invalidate_fetch();
+}
+
+bool
+bnc565::update( const std::vector< change_event >& changes, std::vector< validation_error >& errors )
+{
+    bool trigger_off = std::any_of( changes.begin(), changes.end(), []( const change_event& c ){
+            return c.field == change_trigger && c.value == 0; } );
+
+    // switching the trigger off is always allowed, whatever the table holds
+    bool only_off = std::all_of( changes.begin(), changes.end(), []( const change_event& c ){
+            return c.field == change_trigger && c.value == 0; } );
+
+    scheduler::scoped_lock lock( scheduler_, trigger_off ? priority_emergency : priority_control );
+
+    if ( ! usb_->is_open() )
+        return false; // nothing reached the device, so nothing enters the image
+
+    if ( ! only_off ) {
+        if ( !sync_valid_ )
+            query_sync();
+
+        auto next = image();
+        for ( const auto& c: changes )
+            apply( next, c );
+        if ( ! validator( sync_sources() )( next, errors ) )
+            return false;
+    }
+
+    // the image takes only what the device acknowledged
+    auto d = image();
+    std::string reply;
+    bool success = true;
+
+    for ( const auto& c: changes ) {
+        if ( _xsend( scpi_command( c ).c_str(), reply, "ok", 10 ) )
+            apply( d, c );
+        else
+            success = false;
+    }
+
+    invalidate_fetch();
+    if ( ! success )
+        image_valid_ = false; // a NAKed write may have been applied anyway; the next commit sends everything
+    update_image( d, true );
+
+    return success;
+}
+
+validator::sync_type
+bnc565::sync_sources() const
+{
+    std::lock_guard< std::mutex > lock( image_mutex_ );
+    return sync_;
+}
+
+// scheduler must be held; replies are 'T0' or 'CHA'..'CHH'
+void
+bnc565::query_sync()
+{
+    auto sync = validator::t0();
+    bool success = bool( *this );
+
+    for ( size_t ch = 0; success && ch < sync.size(); ++ch ) {
+        std::string reply;
+        if ( _xsend( ( boost::format( ":PULSE%1%:SYNC?\r\n" ) % ( ch + 1 ) ).str().c_str(), reply ) && reply[0] != '?' ) {
+            if ( reply.size() == 3 && reply.compare( 0, 2, "CH" ) == 0 && reply[ 2 ] >= 'A' && reply[ 2 ] <= 'H' )
+                sync[ ch ] = reply[ 2 ] - 'A';
+        } else {
+            success = false;
+        }
+    }
+
+    std::lock_guard< std::mutex > lock( image_mutex_ );
+    sync_ = sync;
+    sync_valid_ = success;
 }
 
 bool
 bnc565::fetch( dg::protocols<>& d )
+{
+    std::unique_lock< std::mutex > lock( fetch_mutex_ );
+
+    if ( fetch_in_progress_ ) {
+        // attach to the query sequence already on the line
+        auto generation = fetch_generation_;
+        fetch_cond_.wait( lock, [&]{ return fetch_generation_ != generation; } );
+        d = fetch_data_;
+        return fetch_result_;
+    }
+
+    if ( fetch_generation_ && ( std::chrono::steady_clock::now() - fetch_time_ ) < fetch_freshness_ ) {
+        d = fetch_data_;
+        return fetch_result_;
+    }
+
+    fetch_in_progress_ = true;
+
+    // a commit or update may take the line at a command boundary; a result that spans one is
+    // half before, half after, so query again
+    bool clean = false;
+    for ( int attempt = 0; attempt < 3 && !clean; ++attempt ) {
+        auto epoch = fetch_epoch_;
+        dg::protocols<> r( d );
+        lock.unlock();
+        clean = _fetch( r, epoch );
+        lock.lock();
+        if ( clean )
+            d = r;
+    }
+
+    if ( !clean )
+        d = image(); // the writes keep coming; hand out what was last acknowledged, uncached
+
+    fetch_data_ = d;
+    fetch_result_ = true;
+    fetch_time_ = clean ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    ++fetch_generation_;
+    fetch_in_progress_ = false;
+    fetch_cond_.notify_all();
+
+    return true;
+}
+
+void
+bnc565::setFetchFreshness( std::chrono::milliseconds window )
+{
+    std::lock_guard< std::mutex > lock( fetch_mutex_ );
+    fetch_freshness_ = window;
+}
+
+void
+bnc565::invalidate_fetch()
+{
+    std::lock_guard< std::mutex > lock( fetch_mutex_ );
+    fetch_time_ = std::chrono::steady_clock::time_point();
+    ++fetch_epoch_;
+}
+
+bool
+bnc565::_fetch( dg::protocols<>& d, uint64_t epoch )
 {
     if ( usb_->is_open() ) {
+        scheduler::scoped_lock lock( scheduler_, priority_poll );
         std::string reply;
 
         if ( _xsend( "*IDN?\r\n", reply ) && reply[0] != '?' ) // identify
             d.setIdn( reply );
+
+        if ( !sync_valid_ )
+            query_sync();
         
         if ( _xsend( ":INST:FULL?\r\n", reply ) && reply[0] != '?' )
             d.setFull( reply );
         
-        if ( _xsend( ":PULSE0:STATE?\r\n", reply ) ) {
-            if ( reply[0] != '?' ) {
-                try {
-                    d.setState( boost::lexical_cast<int>(reply) );
-                } catch ( std::exception& ex ) {
-                    log( log::ERR ) << boost::format( "%1%:%2% %3% (%4%)" ) % __FILE__ % __LINE__ % ex.what() % reply;
-                }
+        // every field the image holds; one that does not read back keeps a stale value
+        size_t failed = 0;
+
+        if ( _xsend( ":PULSE0:STATE?\r\n", reply ) && reply[0] != '?' ) {
+            try {
+                d.setState( boost::lexical_cast<int>(reply) );
+            } catch ( std::exception& ex ) {
+                log( log::ERR ) << boost::format( "%1%:%2% %3% (%4%)" ) % __FILE__ % __LINE__ % ex.what() % reply;
+                ++failed;
             }
+        } else {
+            ++failed;
         }
-        if ( _xsend( ":PULSE0:PER?\r\n", reply ) ) {
-            if ( reply[0] != '?' ) {
-                try {
-                    d.setInterval( boost::lexical_cast<double>(reply) );
-                } catch ( std::exception& ex ) {
-                    log( log::ERR ) << boost::format( "%1%:%2% %3% (%4%)" ) % __FILE__ % __LINE__ % ex.what() % reply;
-                }
+        if ( _xsend( ":PULSE0:PER?\r\n", reply ) && reply[0] != '?' ) {
+            try {
+                d.setInterval( boost::lexical_cast<double>(reply) );
+            } catch ( std::exception& ex ) {
+                log( log::ERR ) << boost::format( "%1%:%2% %3% (%4%)" ) % __FILE__ % __LINE__ % ex.what() % reply;
+                ++failed;
             }
+        } else {
+            ++failed;
         }
 
         auto& protocol = *d.begin();
     
         for ( size_t ch = 0; ch < protocol.size; ++ch ) {
             try {
-                if ( _xsend( ( boost::format( ":PULSE%1%:STATE?\r\n" ) % (ch+1) ).str().c_str(), reply ) ) {
-                    protocol.state( ch ) = boost::lexical_cast<int>(reply);
-                }
-                if ( _xsend( ( boost::format( ":PULSE%1%:WIDTH?\r\n" ) % (ch+1) ).str().c_str(), reply ) ) {
-                    protocol.width( ch ) = boost::lexical_cast<double>(reply); // seconds
-                }
-                if ( _xsend( ( boost::format( ":PULSE%1%:DELAY?\r\n" ) % (ch+1) ).str().c_str(), reply ) ) {
-                    protocol.delay( ch ) = boost::lexical_cast<double>(reply); // seconds
-                }
-                if ( _xsend( ( boost::format( ":PULSE%1%:POL?\r\n" ) % (ch+1) ).str().c_str(), reply ) ) {
-                    protocol.polarity( ch ) = ( reply == "NORM" || reply == "HIGH" ) ? dg::positive_polarity : dg::negative_polarity;
-                }                
+                if ( _xsend( ( boost::format( ":PULSE%1%:STATE?\r\n" ) % (ch+1) ).str().c_str(), reply ) )
+                    protocol.setState( ch, boost::lexical_cast<int>(reply) );
+                else
+                    ++failed;
+                if ( _xsend( ( boost::format( ":PULSE%1%:WIDTH?\r\n" ) % (ch+1) ).str().c_str(), reply ) )
+                    protocol.setWidth( ch, boost::lexical_cast<double>(reply) ); // seconds
+                else
+                    ++failed;
+                if ( _xsend( ( boost::format( ":PULSE%1%:DELAY?\r\n" ) % (ch+1) ).str().c_str(), reply ) )
+                    protocol.setDelay( ch, boost::lexical_cast<double>(reply) ); // seconds
+                else
+                    ++failed;
+                if ( _xsend( ( boost::format( ":PULSE%1%:POL?\r\n" ) % (ch+1) ).str().c_str(), reply ) )
+                    protocol.setPolarity( ch, ( reply == "NORM" || reply == "HIGH" ) ? dg::positive_polarity : dg::negative_polarity );
+                else
+                    ++failed;
             } catch ( boost::bad_lexical_cast& ex ) {
                 log( log::ERR ) << boost::format( "%1%:%2% %3% (%4%)" ) % __FILE__ % __LINE__ % ex.what() % reply;
+                ++failed; // and the rest of the channel
             }
         }
+
+        // writers invalidate while holding the line, which this fetch holds again now
+        do {
+            std::lock_guard< std::mutex > guard( fetch_mutex_ );
+            if ( fetch_epoch_ != epoch )
+                return false;
+        } while ( 0 );
+
+        if ( failed ) {
+            // the caller gets what did read back; the image is left alone and the next
+            // commit sends everything
+            log( log::WARN ) << boost::format( "%1%: %2% field(s) did not read back" ) % ttyname_ % failed;
+            image_valid_ = false;
+            return true;
+        }
+
+        image_valid_ = true;
+        update_image( d, true );
+        return true;
     } else {
         // fill debug data
         d.setIdn( "debug::IDN" );
         d.setFull( "debug::inst::full" );
 
         auto& protocol = *d.begin();
-        for ( int i = 0; i < protocol.size; ++i ) {
-            std::get< dg::pulse_delay >( protocol[ i ] ) = i * 1.0e-6 + 0.1e-6; // 1.1us
-            std::get< dg::pulse_width >( protocol[ i ] ) = (i + 1) * 0.10 * 1.0e-6;  // 100ns
-            std::get< dg::pulse_polarity >( protocol[ i ] ) = ( i & 01 ) ? true : false;
-            std::get< dg::pulse_state >( protocol[ i ] ) = ( i & 01 ) ? false : true;
+        for ( size_t i = 0; i < protocol.size; ++i ) {
+            protocol.setDelay( i, i * 1.0e-6 + 0.1e-6 ); // 1.1us
+            protocol.setWidth( i, (i + 1) * 0.10 * 1.0e-6 );  // 100ns
+            protocol.setPolarity( i, ( i & 01 ) ? true : false );
+            protocol.setState( i, ( i & 01 ) ? false : true );
         }
     }
-    protocols_ = d;
+    update_image( d, true );
 
     return true;
 }
 
-const std::string&
+std::string
 bnc565::idn() const
 {
+    std::lock_guard< std::mutex > lock( image_mutex_ );
     return protocols_.idn();
 }
 
@@ -257,12 +653,14 @@ bnc565::peripheral_terminate()
         usb_.reset();
     }
 
-    io_service_.stop();
+    if ( own_io_service_ ) {
+        io_service_.stop();
 
-    for ( auto& t: threads_ )
-        t.join();
+        for ( auto& t: threads_ )
+            t.join();
 
-    threads_.clear();
+        threads_.clear();
+    }
 
     return true;
 }
@@ -270,59 +668,83 @@ bnc565::peripheral_terminate()
 bool
 bnc565::peripheral_query_device_data( bool verbose )
 {
-    std::lock_guard< std::mutex > lock( xlock_ );
+    scheduler::scoped_lock lock( scheduler_, priority_poll );
 
+    auto d = image();
     std::string reply;
 
     if ( _xsend( "*IDN?\r\n", reply ) && reply[0] != '?' ) { // identify
-        protocols_.setIdn( reply );
+        d.setIdn( reply );
     }
 
+    query_sync();
+
     if ( verbose )
         std::cout << "*IDN? : " << reply << std::endl;
 
     if ( _xsend( ":INST:FULL?\r\n", reply ) && reply[0] != '?' ) {
-        protocols_.setFull( reply );
+        d.setFull( reply );
     }
     
     if ( verbose )
         std::cout << "INST:FULL? : << reply " << std::endl;
 
+    // every field the image holds; one that does not read back keeps a stale value
+    size_t failed = 0;
+
     // To status (on|off)
-    if ( _xsend( ":PULSE0:STATE?\r\n", reply ) ) {
-        if ( reply[0] != '?' ) {
-            try {
-                int value = boost::lexical_cast<int>(reply);
-                protocols_.setState( value );
-            } catch ( std::exception& ex ) {
-                log( log::ERR ) << boost::format( "%1%:%2% %3% (%4%)" ) % __FILE__ % __LINE__ % ex.what() % reply;
-            }
+    if ( _xsend( ":PULSE0:STATE?\r\n", reply ) && reply[0] != '?' ) {
+        try {
+            int value = boost::lexical_cast<int>(reply);
+            d.setState( value );
+        } catch ( std::exception& ex ) {
+            log( log::ERR ) << boost::format( "%1%:%2% %3% (%4%)" ) % __FILE__ % __LINE__ % ex.what() % reply;
+            ++failed;
         }
+    } else {
+        ++failed;
     }
     if ( verbose )
         std::cout << ":PULSE0:STATE? : " << reply << std::endl;
 
-    auto& protocol = *protocols_.begin();
+    // the image is marked device-confirmed below; commit would otherwise skip an interval
+    // equal to the default one
+    if ( _xsend( ":PULSE0:PER?\r\n", reply ) && reply[0] != '?' ) {
+        try {
+            d.setInterval( boost::lexical_cast<double>(reply) );
+        } catch ( std::exception& ex ) {
+            log( log::ERR ) << boost::format( "%1%:%2% %3% (%4%)" ) % __FILE__ % __LINE__ % ex.what() % reply;
+            ++failed;
+        }
+    } else {
+        ++failed;
+    }
+
+    auto& protocol = *d.begin();
     
-    for ( int i = 0; i < protocol.size; ++i ) {
+    for ( size_t i = 0; i < protocol.size; ++i ) {
         const char * loc = "";
         try {
-            if ( _xsend( ( boost::format( ":PULSE%1%:STATE?\r\n" ) % (i+1) ).str().c_str(), reply ) ) {
-                loc = "STATE";
-                protocol.state( i ) = boost::lexical_cast<int>(reply);
-            }
-            if ( _xsend( ( boost::format( ":PULSE%1%:WIDTH?\r\n" ) % (i+1) ).str().c_str(), reply ) ) {
-                loc = "WIDTH";
-                protocol.width( i ) = boost::lexical_cast<double>(reply);
-            }
-            if ( _xsend( ( boost::format( ":PULSE%1%:DELAY?\r\n" ) % (i+1) ).str().c_str(), reply ) ) {
-                loc = "DELAY";
-                protocol.delay( i ) = boost::lexical_cast<double>(reply);
-            }
-            if ( _xsend( ( boost::format( ":PULSE%1%:POL?\r\n" ) % (i+1) ).str().c_str(), reply ) ) {
-                loc = "POL";
-                protocol.polarity( i ) = ( reply == "NORM" || reply == "HIGH" ) ? dg::positive_polarity : dg::negative_polarity;
-            }
+            loc = "STATE";
+            if ( _xsend( ( boost::format( ":PULSE%1%:STATE?\r\n" ) % (i+1) ).str().c_str(), reply ) )
+                protocol.setState( i, boost::lexical_cast<int>(reply) );
+            else
+                ++failed;
+            loc = "WIDTH";
+            if ( _xsend( ( boost::format( ":PULSE%1%:WIDTH?\r\n" ) % (i+1) ).str().c_str(), reply ) )
+                protocol.setWidth( i, boost::lexical_cast<double>(reply) );
+            else
+                ++failed;
+            loc = "DELAY";
+            if ( _xsend( ( boost::format( ":PULSE%1%:DELAY?\r\n" ) % (i+1) ).str().c_str(), reply ) )
+                protocol.setDelay( i, boost::lexical_cast<double>(reply) );
+            else
+                ++failed;
+            loc = "POL";
+            if ( _xsend( ( boost::format( ":PULSE%1%:POL?\r\n" ) % (i+1) ).str().c_str(), reply ) )
+                protocol.setPolarity( i, ( reply == "NORM" || reply == "HIGH" ) ? dg::positive_polarity : dg::negative_polarity );
+            else
+                ++failed;
             
             if ( verbose )
                 std::cout << boost::format( ":PULSE%1%" ) % (i+1)
@@ -333,9 +755,20 @@ bnc565::peripheral_query_device_data( bool verbose )
                           << std::endl;
         } catch ( boost::bad_lexical_cast& ex ) {
             log( log::ERR ) << boost::format( "%1%:%2% %3% (%4%) %5%" ) % __FILE__ % __LINE__ % ex.what() % reply % loc;
+            ++failed; // and the rest of the channel
         }
     }
 
+    if ( failed ) {
+        // fields that did not read back would hold stale values; the next commit sends everything
+        log( log::WARN ) << boost::format( "%1%: %2% field(s) did not read back" ) % ttyname_ % failed;
+        image_valid_ = false;
+        return false;
+    }
+
+    image_valid_ = bool( *this );
+    update_image( d, true );
+
     return true;
 }
 
@@ -363,7 +796,12 @@ bnc565::handle_receive( const char * data, std::size_t length )
 bool
 bnc565::xsend( const char * data, std::string& reply )
 {
+    scheduler::scoped_lock lock( scheduler_, priority_control );
+
     bool res = _xsend( data, reply );
+    invalidate_fetch();
+    sync_valid_ = false;  // raw command text may have changed a sync source
+    image_valid_ = false; // or any field; the next commit sends everything
 
     std::string text( data );
     std::size_t pos = text.find_first_of( "\r" );
@@ -380,12 +818,17 @@ bnc565::_xsend( const char * data, std::string& reply )
 
     if ( usb_->is_open() ) {
 
+        scheduler_.yield(); // command boundary
+
         std::unique_lock< std::mutex > lock( mutex_ );
 
-        if ( usb_->write( data, std::strlen( data ), 20000 ) ) { // write with timeout(us)
+        ++commands_c_;
+        auto t0 = std::chrono::steady_clock::now();
+        if ( write( data, lock ) ) {
             xsend_timeout_c_ = 0;
 
-            if ( cond_.wait_for( lock, std::chrono::microseconds( 200000 ) ) != std::cv_status::timeout ) {
+            if ( wait_reply( lock ) ) {
+                reply_latency_.add( std::chrono::steady_clock::now() - t0 );
                 reply_timeout_c_ = 0;
                 if ( que_.empty() ) {
                     std::cout << "Error: cond.wait return with empty que"; 
@@ -402,15 +845,57 @@ bnc565::_xsend( const char * data, std::string& reply )
                 return true;
             } else {
                 reply_timeout_c_++;
+                timeouts_c_++;
             }
         } else {
             xsend_timeout_c_++;
+            timeouts_c_++;
         }
         return false;
     }
     return false;
 }
 
+bool
+bnc565::write( const char * data, std::unique_lock< std::mutex >& lock )
+{
+    if ( own_io_service_ )
+        return usb_->write( data, std::strlen( data ), 20000 ); // write with timeout(us)
+
+    // single threaded: discard stale replies that nobody has read yet
+    lock.unlock();
+    while ( usb_->read_inline( 0 ) )
+        ;
+    lock.lock();
+    que_.clear();
+    return usb_->write_inline( data, std::strlen( data ), 20000 );
+}
+
+bool
+bnc565::wait_reply( std::unique_lock< std::mutex >& lock, size_t count )
+{
+    // a pipelined burst allows for the wire time of the later replies, ~16 characters each
+    const auto timeout = std::chrono::microseconds( 200000 + int64_t( count - 1 ) * 160 * 1000000 / std::max( baud_, 1 ) );
+
+    if ( own_io_service_ ) {
+        if ( count == 1 )
+            return cond_.wait_for( lock, timeout ) != std::cv_status::timeout;
+        return cond_.wait_for( lock, timeout, [&]{ return que_.size() >= count; } );
+    }
+
+    // single threaded: poll the port on this thread until a line has been received
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    lock.unlock();
+    for ( auto now = std::chrono::steady_clock::now(); now < deadline; now = std::chrono::steady_clock::now() ) {
+        usb_->read_inline( std::chrono::duration_cast< std::chrono::microseconds >( deadline - now ).count() );
+        std::lock_guard< std::mutex > guard( mutex_ );
+        if ( que_.size() >= count )
+            break;
+    }
+    lock.lock();
+    return que_.size() >= count;
+}
+
 bool
 bnc565::_xsend( const char * data, std::string& reply, const std::string& expect, size_t ntry )
 {
@@ -420,13 +905,60 @@ bnc565::_xsend( const char * data, std::string& reply, const std::string& expect
         return false;
     }
     
-    while ( ntry-- ) {
+    for ( size_t i = 0; i < ntry; ++i ) {
+        if ( i )
+            ++retries_c_;
         if ( _xsend( data, reply ) && reply == expect )
             return true;
     }
     return false;
 }
 
+// queries written back to back, pipeline_depth at a time; one reply line per query
+bool
+bnc565::_xsend( const std::vector< std::string >& queries, std::vector< std::string >& replies )
+{
+    replies.clear();
+
+    if ( ! usb_->is_open() )
+        return false;
+
+    for ( size_t i = 0; i < queries.size(); i += pipeline_depth ) {
+        size_t n = std::min( pipeline_depth, queries.size() - i );
+
+        std::string burst;
+        for ( size_t k = i; k < i + n; ++k )
+            burst += queries[ k ];
+
+        scheduler_.yield(); // burst boundary
+
+        std::unique_lock< std::mutex > lock( mutex_ );
+        que_.clear();
+        commands_c_ += n;
+
+        if ( ! write( burst.c_str(), lock ) ) {
+            xsend_timeout_c_++;
+            timeouts_c_++;
+            return false;
+        }
+        if ( ! wait_reply( lock, n ) ) {
+            reply_timeout_c_++;
+            timeouts_c_++;
+            que_.clear();
+            return false;
+        }
+        replies.insert( replies.end(), que_.begin(), que_.begin() + n );
+        que_.clear();
+    }
+    return true;
+}
+
+bnc565::counters
+bnc565::command_counters() const
+{
+    return counters{ commands_c_, retries_c_, timeouts_c_, resent_c_ };
+}
+
 bool
 bnc565::initialize( const std::string& ttyname, int baud )
 {
@@ -446,21 +978,18 @@ bnc565::initialize( const std::string& ttyname, int baud )
     baud_ = baud;
 
     usb_->async_reader( [=]( const char * send, std::size_t length ){ handle_receive( send, length ); } );
-    usb_->start();
-
-    threads_.push_back( std::thread( boost::bind( &boost::asio::io_service::run, &io_service_ ) ) );
-
-    std::string reply;
 
-    if ( _xsend( "*IDN?\r\n", reply ) && reply[0] != '?' ) { // identify
-        protocols_.setIdn( reply );
+    if ( own_io_service_ ) {
+        // replies are delivered by this thread while the constructor's one may be blocked in a tick handler
+        usb_->start();
+        threads_.push_back( std::thread( [=]{ reactor::configure_thread(); io_service_.run(); } ) );
     }
 
-    if ( _xsend( ":INST:FULL?\r\n", reply ) && reply[0] != '?' ) {
-        protocols_.setFull( reply );
-    }
+    scheduler::scoped_lock lock( scheduler_, priority_control );
 
-    peripheral_query_device_data( false );
+    std::string reply;
+
+    peripheral_query_device_data( false ); // identify and read pulses
 
     return true;
 }
@@ -468,19 +997,65 @@ bnc565::initialize( const std::string& ttyname, int baud )
 bool
 bnc565::switch_connect( bool onoff, std::string& reply )
 {
+    // trigger off pre-empts everything else on the serial line
+    scheduler::scoped_lock lock( scheduler_, onoff ? priority_control : priority_emergency );
+
     if ( ! usb_->is_open() ) {
         if ( ! initialize( ttyname_, baud_ ) )
             reply = ( boost::format( "Error: %1% for tty device '%2%'; " ) % usb_->error_code() % ttyname_ ).str();
     }
     std::string rep;
-    if ( bool res = _xsend( (boost::format(":PULSE0:STATE %1%\r\n") % (onoff ? "ON" : "OFF")).str().c_str(), rep, "ok", 10 ) ) {
-        protocols_.setState( onoff );
+    if ( _xsend( (boost::format(":PULSE0:STATE %1%\r\n") % (onoff ? "ON" : "OFF")).str().c_str(), rep, "ok", 10 ) ) {
+        auto d = image();
+        d.setState( onoff );
+        update_image( d, true );
+        invalidate_fetch();
         reply += rep;
         return true;
     }
     return false;
 }
 
+bool
+bnc565::stage( const dg::protocols<>& d, std::vector< validation_error >& errors, bool& off )
+{
+    scheduler::scoped_lock lock( scheduler_, priority_commit );
+
+    std::string reply;
+    off = usb_->is_open() && _xsend( ":PULSE0:STATE OFF\r\n", reply, "ok", 10 );
+    if ( ! off )
+        return false;
+
+    auto idle = image();
+    idle.setState( false );
+    update_image( idle, true );
+
+    return _commit( d, errors, true );
+}
+
+bool
+bnc565::arm( const std::function< void() >& ready
+             , std::chrono::steady_clock::time_point& sent, std::chrono::steady_clock::time_point& acked )
+{
+    // hold the line across the barrier so that no poll gets in between
+    scheduler::scoped_lock lock( scheduler_, priority_control );
+
+    ready();
+
+    std::string reply;
+    sent = std::chrono::steady_clock::now();
+    bool res = usb_->is_open() && _xsend( ":PULSE0:STATE ON\r\n", reply, "ok", 10 );
+    acked = std::chrono::steady_clock::now();
+
+    if ( res ) {
+        auto d = image();
+        d.setState( true );
+        update_image( d, true );
+        invalidate_fetch();
+    }
+    return res;
+}
+
 bool
 bnc565::reset()
 {
@@ -489,6 +1064,11 @@ bnc565::reset()
 
     // adportable::debug(__FILE__, __LINE__) << "BNC555::reset";
 
+    scheduler::scoped_lock lock( scheduler_, priority_commit );
+    invalidate_fetch();
+    image_valid_ = false; // the next commit sends every field
+    sync_valid_ = false;
+
     std::string reply;
 
     if ( _xsend( "*RST\r\n", reply, "ok", 10 ) ) {
@@ -525,11 +1105,13 @@ bnc565::reset()
 void
 bnc565::setInterval( double v )
 {
+    std::lock_guard< std::mutex > lock( image_mutex_ );
     protocols_.setInterval( v );
 }
 
 double
 bnc565::interval() const
 {
+    std::lock_guard< std::mutex > lock( image_mutex_ );
     return protocols_.interval();
 }
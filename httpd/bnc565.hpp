@@ -26,7 +26,12 @@
 #pragma once
 
 #include "dgprotocols.hpp"
+#include "histogram.hpp"
+#include "ticker.hpp"
+#include "scheduler.hpp"
+#include "validator.hpp"
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <utility>
 #include <cstdint>
@@ -42,13 +47,26 @@ class serialport;
 
 namespace dg {
 
+    enum change_field { change_delay, change_width, change_polarity, change_state, change_interval, change_trigger };
+
+    // a change in the cached device image; channel is -1 for interval and trigger
+    struct change_event {
+        change_field field;
+        int channel;
+        tick_type value;   // device ticks for delay, width and interval; 0 or 1 otherwise
+    };
+
+    class registry;
+
     class bnc565 { // : public std::enable_shared_from_this< bnc565 > {
         bnc565();
+        friend class registry;
     public:
         ~bnc565();
 
         enum DeviceType { NONE, HELIO, DE0 };
 
+        // the default device of the registry
         static bnc565 * instance();
 
         operator bool () const;
@@ -60,15 +78,40 @@ namespace dg {
         void setPulse( uint32_t channel, const std::pair< double, double >& );
         std::pair<double, double> pulse( uint32_t channel ) const;
         
-        typedef boost::signals2::signal< void( size_t ) > tick_handler_t;
+        typedef ticker::tick_handler_t tick_handler_t;
 
         boost::signals2::connection register_handler( const tick_handler_t::slot_type& );
 
-        const std::string& idn() const;
+        void setTickPeriod( std::chrono::steady_clock::duration );
+        std::chrono::steady_clock::duration tickPeriod() const;
+        size_t missed_ticks() const { return ticker_.missed(); }
+
+        typedef boost::signals2::signal< void( const std::vector< change_event >& ) > change_handler_t;
+
+        // fired whenever a commit, fetch or trigger switch changes the cached image
+        boost::signals2::connection register_change_handler( const change_handler_t::slot_type& );
+
+        dg::protocols<> image() const;
+
+        std::string idn() const;
 
-        void commit( const dg::protocols<>& );
+        // validated against the device sync chains first; nothing is sent if errors is not empty.
+        // In verify mode the download is read back, and fields that still differ after a
+        // re-send are returned as readback_mismatch errors.
+        bool commit( const dg::protocols<>&, std::vector< validation_error >& errors );
 
+        void setVerify( bool );
+        bool verify() const { return verify_; }
+
+        // send only the given fields; the image is updated with the acknowledged ones.  The
+        // image with the changes applied is validated first, as for commit, and nothing is sent
+        // if errors is not empty; false with no errors means a write was not acknowledged
+        bool update( const std::vector< change_event >&, std::vector< validation_error >& errors );
+
+        // concurrent callers share a single serial query sequence; a result younger
+        // than the freshness window is returned without touching the device
         bool fetch( dg::protocols<>& );
+        void setFetchFreshness( std::chrono::milliseconds );
 
         inline boost::asio::io_service& io_service() { return io_service_; }
 
@@ -83,31 +126,92 @@ namespace dg {
         bool initialize( const std::string&, int baud );
         bool reset();
         bool switch_connect( bool, std::string& );
+
+        // two-phase apply, see registry::commit_all.  stage switches the trigger off and
+        // commits with a readback, regardless of the verify mode; off tells whether the
+        // trigger off was acknowledged, also when the commit then fails.
+        bool stage( const dg::protocols<>&, std::vector< validation_error >& errors, bool& off );
+
+        // takes the serial line, calls ready (a barrier shared with the other units) and
+        // switches the trigger on; sent and acked bracket the moment the unit armed
+        bool arm( const std::function< void() >& ready
+                  , std::chrono::steady_clock::time_point& sent, std::chrono::steady_clock::time_point& acked );
+
+        const dg::scheduler& command_scheduler() const { return scheduler_; }
+
+        validator::sync_type sync_sources() const;
+
+        // serial traffic since startup
+        struct counters {
+            size_t commands;  // writes to the device
+            size_t retries;   // repeated writes for a missing or unexpected reply
+            size_t timeouts;  // write or reply timeouts
+            size_t resent;    // fields written again after a readback
+        };
+        counters command_counters() const;
+
+        // lateness of the tick and time from command write to reply
+        const histogram& timer_jitter() const { return ticker_.jitter(); }
+        const histogram& reply_latency() const { return reply_latency_; }
         
     private:
         DeviceType deviceType_;
-        size_t tick_;
-        tick_handler_t handler_; // tick handler
-        boost::asio::io_service io_service_;
-        boost::asio::steady_timer timer_; // interrupts simulator
+        change_handler_t change_handler_;
+        std::unique_ptr< boost::asio::io_service > own_io_service_; // null when the reactor is shared
+        boost::asio::io_service& io_service_;
+        ticker ticker_;
         std::vector< std::thread > threads_;
-        void on_timer( const boost::system::error_code& ec );
         //
         std::unique_ptr< serialport > usb_;
         std::condition_variable cond_;
         std::mutex mutex_;
-        std::mutex xlock_;
+        dg::scheduler scheduler_;
         std::string receiving_data_;
         std::vector< std::string > que_;
+        histogram reply_latency_;
+        bool write( const char * data, std::unique_lock< std::mutex >& );
+        bool wait_reply( std::unique_lock< std::mutex >&, size_t count = 1 );
         std::string ttyname_;
         int baud_;
         std::atomic< size_t > xsend_timeout_c_;
         std::atomic< size_t > reply_timeout_c_;
+        std::atomic< size_t > commands_c_;
+        std::atomic< size_t > retries_c_;
+        std::atomic< size_t > timeouts_c_;
+        std::atomic< size_t > resent_c_;
+        std::atomic< bool > verify_;
 
+        mutable std::mutex image_mutex_;
         dg::protocols<> protocols_;
+        std::atomic< bool > image_valid_; // protocols_ has been read back from the device since reset
+        validator::sync_type sync_;       // guarded by image_mutex_
+        std::atomic< bool > sync_valid_;
+
+        void query_sync();
+
+        bool _commit( const dg::protocols<>&, std::vector< validation_error >&, bool verify );
+        bool readback( dg::protocols<>& );
+        void verify( const dg::protocols<>&, std::vector< change_event >& mismatches );
+
+        // single-flight fetch
+        std::mutex fetch_mutex_;
+        std::condition_variable fetch_cond_;
+        bool fetch_in_progress_;
+        uint64_t fetch_generation_;
+        bool fetch_result_;
+        dg::protocols<> fetch_data_;
+        std::chrono::steady_clock::time_point fetch_time_;
+        std::chrono::milliseconds fetch_freshness_;
+        uint64_t fetch_epoch_;  // bumped by invalidate_fetch; a fetch spanning a bump is torn
+
+        // false if the device was written while the queries were on the line
+        bool _fetch( dg::protocols<>&, uint64_t epoch );
+        void invalidate_fetch();
+        void update_image( const dg::protocols<>&, bool with_state );
 
         bool _xsend( const char * data, std::string& );
         bool _xsend( const char * data, std::string&, const std::string& expect, size_t ntry );
+        bool _xsend( const std::vector< std::string >& queries, std::vector< std::string >& replies );
         void handle_receive( const char * data, std::size_t length );
     };
 }
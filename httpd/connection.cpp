@@ -12,6 +12,8 @@
 #include "dgctl.hpp"
 #include "connection_manager.hpp"
 #include "request_handler.hpp"
+#include <boost/algorithm/string/predicate.hpp>
+#include <algorithm>
 #include <utility>
 #include <vector>
 #include <iostream>
@@ -19,16 +21,34 @@
 namespace http {
 namespace server {
 
-    connection::connection(boost::asio::ip::tcp::socket socket,
+    connection::connection(boost::asio::io_service& io_service, std::size_t slot,
                            connection_manager& manager, request_handler& handler)
-        : socket_(std::move(socket))
+        : socket_(io_service)
+        , slot_(slot)
         , connection_manager_(manager)
         , request_handler_(handler)
         , sse_connected_( false )
+        , websocket_( false )
+        , ws_closing_( false )
     {
         //busy_.clear();
     }
 
+    void
+    connection::reset(boost::asio::ip::tcp::socket socket)
+    {
+        socket_ = std::move(socket);
+        request_ = request();
+        request_parser_.reset();
+        reply_ = reply();
+        sse_connected_ = false;
+        websocket_ = false;
+        ws_decoder_ = websocket::decoder();
+        std::lock_guard< std::mutex > lock( mutex_ );
+        write_queue_.clear();
+        ws_closing_ = false;
+    }
+
     void
     connection::start()
     {
@@ -50,14 +70,20 @@ namespace server {
             [this, self](boost::system::error_code ec, std::size_t bytes_transferred) {
                 if (!ec) {
                     request_parser::result_type result;
+                    char * consumed;
                     
                     // std::string debug( buffer_.data(), bytes_transferred );
                     // std::cerr << "---- connection::do_read --->\n" << debug << "\n<----- end do_read." << std::endl;
                     
-                    std::tie(result, std::ignore) = request_parser_.parse(
+                    std::tie(result, consumed) = request_parser_.parse(
                         request_, buffer_.data(), buffer_.data() + bytes_transferred);
                     
-                    if (result == request_parser::good) {
+                    if ( result == request_parser::good && request_.uri == "/dg/ws" && websocket::is_upgrade( request_ ) ) {
+                        // frames the client sent along with the upgrade request
+                        ws_decoder_.append( consumed, buffer_.data() + bytes_transferred );
+                        connection_manager_.ws_start( shared_from_this() );
+
+                    } else if (result == request_parser::good) {
                         request_handler_.handle_request( request_, reply_ );
 
                         auto it = std::find_if( reply_.headers.begin(), reply_.headers.end(), []( const header& h ){
@@ -99,38 +125,44 @@ namespace server {
                                      }
                                  });
     }
-#if 0
+
     void
-    connection::do_sse_write()
+    connection::do_queued_write()
     {
         auto self(shared_from_this());
 
         boost::asio::async_write(socket_
-                                 , reply_.to_sse_buffers()
+                                 , boost::asio::buffer( *write_queue_.front() )
                                  , [this, self](boost::system::error_code ec, std::size_t) {
                                      if ( ec ) {
                                          std::cerr << ec.message() << std::endl;
+                                         do {
+                                             std::lock_guard< std::mutex > lock( mutex_ );
+                                             write_queue_.clear();
+                                         } while ( 0 );
                                          boost::system::error_code ignored_ec;
                                          socket_.shutdown( boost::asio::ip::tcp::socket::shutdown_both, ignored_ec );
-                                         connection_manager_.sse_stop( shared_from_this() ); // remove
+                                         if ( websocket_ )
+                                             connection_manager_.ws_stop( shared_from_this() );
+                                         else
+                                             connection_manager_.sse_stop( shared_from_this() ); // remove
+                                         return;
                                      }
-                                     //busy_.clear();
-                                 });
-    }
-#endif
-    void
-    connection::do_sse_write( std::shared_ptr< reply > reply )
-    {
-        auto self(shared_from_this());
-
-        boost::asio::async_write(socket_
-                                 , reply->to_sse_buffers()
-                                 , [this, self, reply](boost::system::error_code ec, std::size_t) {
-                                     if ( ec ) {
-                                         std::cerr << ec.message() << std::endl;
+                                     bool closed = false;
+                                     do {
+                                         std::lock_guard< std::mutex > lock( mutex_ );
+                                         if ( !write_queue_.empty() )
+                                             write_queue_.pop_front();
+                                         if ( !write_queue_.empty() )
+                                             do_queued_write();
+                                         else
+                                             closed = ws_closing_;
+                                     } while ( 0 );
+                                     if ( closed ) {
+                                         // the close frame of a failed websocket is out
                                          boost::system::error_code ignored_ec;
                                          socket_.shutdown( boost::asio::ip::tcp::socket::shutdown_both, ignored_ec );
-                                         connection_manager_.sse_stop( shared_from_this() ); // remove
+                                         connection_manager_.ws_stop( shared_from_this() );
                                      }
                                  });
     }
@@ -144,51 +176,106 @@ namespace server {
         reply_.headers.push_back( { "Content-Type", "text/event-stream" } );
         reply_.headers.push_back( { "Cache-Control", "no-cache" } );
 
-        // auto dbufs = reply_.to_sse_buffers();
-        // for ( auto& d : dbufs )
-        //     std::cerr << boost::asio::buffer_cast<const char *>(d);
+        auto header = std::make_shared< std::string >();
+        for ( const auto& b: reply_.to_sse_buffers( true ) )
+            header->append( boost::asio::buffer_cast< const char * >( b ), boost::asio::buffer_size( b ) );
 
-        auto self(shared_from_this());
-        boost::asio::async_write(socket_
-                                 , reply_.to_sse_buffers( true )
-                                 , [this, self](boost::system::error_code ec, std::size_t) {
-                                     if ( ec )
-                                         std::cerr << ec.message() << std::endl;
-                                 } );
-        return true;
+        return send( header );
     }
-    
+
     bool
-    connection::sse_write( const std::string& data, const std::string& id, const std::string& event )
+    connection::ws_start()
+    {
+        websocket_ = true;
+        return send( std::make_shared< const std::string >( websocket::handshake( request_ ) ) );
+    }
+
+    void
+    connection::ws_read()
     {
-        // ---
-        auto reply = std::make_shared< http::server::reply >();
-        reply->headers.clear();
-        reply->headers.push_back( { "data", data } );
-        if ( !id.empty() )
-            reply->headers.push_back( { "id", id } );
+        if ( !handle_ws_messages() )
+            return;
 
-        if ( !event.empty() )
-            reply->headers.push_back( { "event", event } );
+        auto self(shared_from_this());
+        socket_.async_read_some(
+            boost::asio::buffer(buffer_),
+            [this, self](boost::system::error_code ec, std::size_t bytes_transferred) {
+                if ( !ec ) {
+                    ws_decoder_.append( buffer_.data(), buffer_.data() + bytes_transferred );
+                    ws_read();
+                } else if ( ec != boost::asio::error::operation_aborted ) {
+                    connection_manager_.ws_stop( shared_from_this() );
+                }
+            });
+    }
 
-        do_sse_write( reply );
-#if 0
-		std::lock_guard< std::mutex > lock( mutex_ );
-        while ( busy_.test_and_set() ) {}
+    bool
+    connection::handle_ws_messages()
+    {
+        websocket::opcode op;
+        std::string payload;
+        websocket::decoder::result_type result;
 
-        reply_.headers.clear();
-        reply_.headers.push_back( { "data", data } );
-        
-        if ( !id.empty() )
-            reply_.headers.push_back( { "id", id } );
+        while ( ( result = ws_decoder_.next( op, payload ) ) == websocket::decoder::good ) {
+            switch ( op ) {
+            case websocket::text:
+                send( websocket::encode( websocket::text, dg::dgctl::instance()->ws_request( payload ) ) );
+                break;
+            case websocket::ping:
+                send( websocket::encode( websocket::pong, payload ) );
+                break;
+            case websocket::close:
+                // echo the close; the client then closes the socket, which ends do_ws_read
+                send( websocket::encode( websocket::close, payload.substr( 0, 2 ) ) );
+                return true;
+            case websocket::pong:
+                break;
+            default: // binary
+                send( websocket::encode( websocket::text, "{ \"error\": \"binary frames are not supported\" }" ) );
+                break;
+            }
+        }
 
-        if ( !event.empty() )
-            reply_.headers.push_back( { "event", event } );
+        if ( result == websocket::decoder::bad ) {
+            ws_fail( ws_decoder_.close_code() ); // protocol violation or oversized message
+            return false;
+        }
+        return true;
+    }
+
+    void
+    connection::ws_fail( unsigned short code )
+    {
+        const char status[] = { char( code >> 8 ), char( code & 0xff ) };
 
-        do_sse_write();
-#endif
+        std::lock_guard< std::mutex > lock( mutex_ );
+        if ( ws_closing_ )
+            return;
+        ws_closing_ = true; // nothing is queued after the close frame
+        write_queue_.push_back( websocket::encode( websocket::close, std::string( status, sizeof( status ) ) ) );
+        if ( write_queue_.size() == 1 )
+            do_queued_write();
+    }
+    
+    bool
+    connection::send( std::shared_ptr< const std::string > data )
+    {
+        std::lock_guard< std::mutex > lock( mutex_ );
+        if ( ws_closing_ )
+            return false;
+        write_queue_.push_back( data );
+        if ( write_queue_.size() == 1 )
+            do_queued_write();
         return true;
     }
 
+    std::string
+    connection::request_header( const std::string& name ) const
+    {
+        auto it = std::find_if( request_.headers.begin(), request_.headers.end(), [&]( const header& h ){
+                return boost::iequals( h.name, name ); } );
+        return it != request_.headers.end() ? it->value : std::string();
+    }
+
 } // namespace server
 } // namespace http
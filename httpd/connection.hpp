@@ -15,11 +15,14 @@
 #include "request.hpp"
 #include "request_handler.hpp"
 #include "request_parser.hpp"
+#include "websocket.hpp"
 #include <boost/asio.hpp>
 #include <array>
 #include <atomic>
+#include <deque>
 #include <memory>
 #include <mutex>
+#include <string>
 
 namespace http {
 namespace server {
@@ -34,9 +37,15 @@ public:
     connection(const connection&) = delete;
     connection& operator=(const connection&) = delete;
 
-    /// Construct a connection with the given socket.
-    explicit connection(boost::asio::ip::tcp::socket socket,
-                        connection_manager& manager, request_handler& handler);
+    /// Construct an idle connection for the given slot of a connection_pool.
+    connection(boost::asio::io_service& io_service, std::size_t slot,
+               connection_manager& manager, request_handler& handler);
+
+    /// Take over an accepted socket, discarding what the previous client left.
+    void reset(boost::asio::ip::tcp::socket socket);
+
+    /// Index in the connection_pool.
+    std::size_t slot() const { return slot_; }
 
     /// Start the first asynchronous operation for the connection.
     void start();
@@ -44,8 +53,21 @@ public:
     /// Stop all asynchronous operations associated with the connection.
     void stop();
 
+    /// Queue the event-stream response header.
     bool sse_start();
-    bool sse_write( const std::string& data, const std::string& id, const std::string& event );
+
+    /// Queue the 101 Switching Protocols response.
+    bool ws_start();
+
+    /// Dispatch buffered websocket messages and read more frames.
+    void ws_read();
+
+    /// Queue an encoded SSE event or websocket frame; the buffer may be shared
+    /// between connections.
+    bool send( std::shared_ptr< const std::string > );
+
+    /// Value of a request header, or empty if the client did not send it.
+    std::string request_header( const std::string& name ) const;
 
 private:
     /// Perform an asynchronous read operation.
@@ -54,12 +76,20 @@ private:
     /// Perform an asynchronous write operation.
     void do_write();
     
-    // void do_sse_write();
-    void do_sse_write( std::shared_ptr< reply > );    
+    /// Write the front of write_queue_; mutex_ must be held.
+    void do_queued_write();
+
+    /// Dispatch complete websocket messages; false if the connection failed.
+    bool handle_ws_messages();
+
+    /// Send a close frame with the status code, then drop the connection.
+    void ws_fail( unsigned short code );
 
     /// Socket for the connection.
     boost::asio::ip::tcp::socket socket_;
 
+    std::size_t slot_;
+
     /// The manager for this connection.
     connection_manager& connection_manager_;
 
@@ -79,8 +109,17 @@ private:
     reply reply_;
 
     bool sse_connected_;
+    bool websocket_;
+
+    /// A close frame is queued; guarded by mutex_.
+    bool ws_closing_;
+
+    /// Frames received after the upgrade request.
+    websocket::decoder ws_decoder_;
+
+    /// Pending SSE or websocket writes; only one async_write is outstanding at a time.
+    std::deque< std::shared_ptr< const std::string > > write_queue_;
 	std::mutex mutex_;
-    // std::atomic_flag busy_;
 };
 
 typedef std::shared_ptr<connection> connection_ptr;
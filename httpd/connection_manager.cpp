@@ -10,13 +10,46 @@
 
 #include "connection_manager.hpp"
 #include "dgctl.hpp"
+#include "registry.hpp"
+#include "websocket.hpp"
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/lexical_cast.hpp>
+#include <chrono>
 #include <iostream>
 
 namespace http {
 namespace server {
 
-    connection_manager::connection_manager() : sse_connected_( false )
+    constexpr std::size_t connection_manager::sse_ring_size;
+
+    static std::shared_ptr< const std::string >
+    sse_encode( const std::string& data, const std::string& id, const std::string& event )
     {
+        auto encoded = std::make_shared< std::string >();
+        encoded->reserve( data.size() + id.size() + event.size() + 32 );
+        if ( !id.empty() )
+            encoded->append( "id: " ).append( id ).append( "\r\n" );
+        if ( !event.empty() )
+            encoded->append( "event: " ).append( event ).append( "\r\n" );
+        encoded->append( "data: " ).append( data ).append( "\r\n\r\n" );
+        return encoded;
+    }
+
+    connection_manager::connection_manager( std::size_t max_connections ) : connections_( max_connections )
+                                                                          , sse_connected_( false )
+                                                                          , sse_last_id_( 0 )
+                                                                          , sse_boot_( std::to_string( std::chrono::duration_cast< std::chrono::microseconds >(
+                                                                                           std::chrono::system_clock::now().time_since_epoch() ).count() ) )
+    {
+        sse_ring_.fill( { 0, nullptr } );
+
+        dg::dgctl::instance(); // the default device exists even if none was added
+        for ( const auto& device: dg::registry::instance()->ids() ) {
+            sse_subscriptions_.emplace_back( dg::dgctl::instance( device )->register_sse_handler(
+                                                 [this] ( const std::string& d, const std::string& id, const std::string& ev ){
+                                                     sse_handler( d, id, ev );  } ) );
+        }
+        sse_connected_ = true;
     }
 
     connection_manager::~connection_manager()
@@ -33,7 +66,7 @@ namespace server {
     connection_manager::start(connection_ptr c)
     {
         std::lock_guard< std::mutex > lock( mutex_ );
-        connections_.insert(c);
+        connections_[ c->slot() ] = c;
         c->start();
     }
 
@@ -41,7 +74,8 @@ namespace server {
     connection_manager::stop(connection_ptr c)
     {
         std::lock_guard< std::mutex > lock( mutex_ );
-        connections_.erase( c );
+        if ( connections_[ c->slot() ] == c )
+            connections_[ c->slot() ].reset();
         c->stop();
     }
 
@@ -49,23 +83,65 @@ namespace server {
     connection_manager::stop_all()
     {
         std::lock_guard< std::mutex > lock( mutex_ );
-        for (auto c: connections_)
+        for (auto& c: connections_) {
+            if ( c )
+                c->stop();
+            c.reset();
+        }
+        for (auto c: ws_objects_)
+            c->stop();
+        ws_objects_.clear();
+        // event streams too: a pooled connection must be back in the pool before the server goes
+        for (auto c: sse_objects_)
             c->stop();
-        connections_.clear();
+        sse_objects_.clear();
+        update_stream_clients();
     }
 
     void
     connection_manager::sse_start( connection_ptr c ) 
     {
-        if ( !sse_connected_ ) {
-			dg::dgctl::instance()->register_sse_handler( [this] ( const std::string& d, const std::string& id, const std::string& ev ){
-                    sse_handler( d, id, ev );  } );
-            sse_connected_ = true;
-        }
         std::lock_guard< std::mutex > lock( mutex_ );
         sse_objects_.insert( c );
-        connections_.erase( c );
+        connections_[ c->slot() ].reset();
         c->sse_start();
+        update_stream_clients();
+
+        // ids are '<boot>-<seq>'; an id of another daemon run says nothing about what the
+        // client has missed, have it reload the full status
+        auto last = c->request_header( "Last-Event-ID" );
+        if ( !last.empty() ) {
+            uint64_t seq = 0;
+            auto dash = last.find( '-' );
+            if ( dash != std::string::npos && last.compare( 0, dash, sse_boot_ ) == 0
+                 && boost::conversion::try_lexical_convert( last.substr( dash + 1 ), seq ) )
+                sse_replay( c, seq );
+            else
+                c->send( sse_encode( "{}", "", "resync" ) );
+        }
+    }
+
+    // mutex_ must be held
+    void
+    connection_manager::sse_replay( connection_ptr c, uint64_t last_event_id )
+    {
+        if ( last_event_id == sse_last_id_ )
+            return;
+
+        uint64_t oldest = sse_last_id_ > sse_ring_size ? sse_last_id_ - sse_ring_size + 1 : 1;
+
+        if ( last_event_id > sse_last_id_ || last_event_id + 1 < oldest ) {
+            // an id never issued, or a gap no longer in memory; have the client reload the
+            // full status
+            c->send( sse_encode( "{}", "", "resync" ) );
+            return;
+        }
+
+        for ( uint64_t id = last_event_id + 1; id <= sse_last_id_; ++id ) {
+            const auto& ev = sse_ring_[ id % sse_ring_size ];
+            if ( ev.id == id && ev.encoded )
+                c->send( ev.encoded );
+        }
     }
 
     void
@@ -74,6 +150,30 @@ namespace server {
         std::lock_guard< std::mutex > lock( mutex_ );        
         sse_objects_.erase( c );
         c->stop();
+        update_stream_clients();
+    }
+
+    void
+    connection_manager::ws_start( connection_ptr c )
+    {
+        do {
+            std::lock_guard< std::mutex > lock( mutex_ );
+            ws_objects_.insert( c );
+            connections_[ c->slot() ].reset();
+            c->ws_start(); // handshake is queued ahead of any broadcast
+            update_stream_clients();
+        } while ( 0 );
+        // outside the lock; frames already received may issue commands that broadcast
+        c->ws_read();
+    }
+
+    void
+    connection_manager::ws_stop( connection_ptr c )
+    {
+        std::lock_guard< std::mutex > lock( mutex_ );
+        ws_objects_.erase( c );
+        c->stop();
+        update_stream_clients();
     }
 
     void
@@ -83,15 +183,42 @@ namespace server {
         for ( auto c: sse_objects_ )
             c->stop();
         sse_objects_.clear();
+        update_stream_clients();
+    }
+
+    void
+    connection_manager::update_stream_clients()
+    {
+        for ( const auto& device: dg::registry::instance()->ids() )
+            dg::dgctl::instance( device )->setStreamClients( sse_objects_.size() + ws_objects_.size() );
     }
 
     void
-	connection_manager::sse_handler( const std::string& data, const std::string& id, const std::string& event )
+	connection_manager::sse_handler( const std::string& data, const std::string&, const std::string& event )
     {
         std::lock_guard< std::mutex > lock( mutex_ );
-        if ( ! sse_objects_.empty() ) {
-            for ( auto c : sse_objects_ )
-				c->sse_write( data, id, event );
+
+        std::shared_ptr< const std::string > encoded;
+
+        if ( event == "tick" || boost::algorithm::ends_with( event, ".tick" ) ) {
+            // transient; leaves the client's Last-Event-ID untouched
+            encoded = sse_encode( data, "", event );
+        } else {
+            ++sse_last_id_;
+            encoded = sse_encode( data, sse_boot_ + "-" + std::to_string( sse_last_id_ ), event );
+            sse_ring_[ sse_last_id_ % sse_ring_size ] = { sse_last_id_, encoded };
+        }
+
+        for ( auto c : sse_objects_ )
+            c->send( encoded );
+
+        if ( !ws_objects_.empty() ) {
+            auto dot = event.find( '.' );
+            auto frame = websocket::encode( websocket::text, dot == std::string::npos ? data
+                                            : "{ \"device\": \"" + event.substr( 0, dot ) + "\", \"event\": \"" + event.substr( dot + 1 )
+                                            + "\", \"data\": " + data + " }" );
+            for ( auto c : ws_objects_ )
+                c->send( frame );
         }
     }
 
@@ -13,8 +13,14 @@
 
 
 #include "connection.hpp"
+#include <boost/signals2/connection.hpp>
+#include <array>
+#include <cstdint>
+#include <memory>
 #include <mutex>
 #include <set>
+#include <string>
+#include <vector>
 
 namespace http {
 namespace server {
@@ -28,26 +34,63 @@ public:
     connection_manager& operator=(const connection_manager&) = delete;
 
     ~connection_manager();
-    connection_manager();
+
+    /// Room for max_connections connections of a connection_pool.
+    explicit connection_manager( std::size_t max_connections );
 
     void start(connection_ptr c);
     void stop(connection_ptr c);
     void stop_all();
 
+    /// Start an event stream; replays buffered events newer than the
+    /// client's Last-Event-ID header.
     void sse_start( connection_ptr c );
     void sse_stop( connection_ptr c );
     void sse_stop_all();
 
+    /// Switch a connection to websocket; it then receives every broadcast
+    /// event as a text frame.
+    void ws_start( connection_ptr c );
+    void ws_stop( connection_ptr c );
+
+    /// Broadcast an event.  Every event except 'tick' gets the next event id,
+    /// '<boot>-<seq>' (the id argument is ignored), and is kept in the replay ring.  Events of a
+    /// device other than the default are named '<device>.<event>'; websocket
+    /// clients get them as { "device": ..., "event": ..., "data": ... }.
 	void sse_handler( const std::string&, const std::string& id, const std::string& );
     
     inline bool sse_connected() const { return sse_connected_; }
     void sse_connected( bool );
 
 private:
-    /// The managed connections.
-    std::set<connection_ptr> connections_;
+    /// The managed connections, indexed by connection::slot.
+    std::vector<connection_ptr> connections_;
     std::set<connection_ptr> sse_objects_;
+    std::set<connection_ptr> ws_objects_;
     bool sse_connected_;
+
+    /// Recently sent events, indexed by id % sse_ring_size.
+    static constexpr std::size_t sse_ring_size = 256;
+    struct sse_event {
+        uint64_t id;
+        std::shared_ptr< const std::string > encoded;
+    };
+    std::array< sse_event, sse_ring_size > sse_ring_;
+    uint64_t sse_last_id_;
+
+    /// Start time of this daemon run, the prefix of every event id; a client's
+    /// Last-Event-ID from an earlier run gets a resync instead of a replay.
+    const std::string sse_boot_;
+
+    /// Subscribed from construction so that events are buffered before the first client;
+    /// one subscription per device.
+    std::vector< boost::signals2::scoped_connection > sse_subscriptions_;
+
+    /// last_event_id is the sequence part of an id of this run.
+    void sse_replay( connection_ptr c, uint64_t last_event_id );
+
+    /// Tell dgctl how many clients receive events; call with mutex_ held.
+    void update_stream_clients();
     std::mutex mutex_;
 };
 
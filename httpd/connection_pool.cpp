@@ -0,0 +1,61 @@
+//
+// connection_pool.cpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "connection_pool.hpp"
+#include <utility>
+
+namespace http {
+namespace server {
+
+connection_pool::connection_pool(boost::asio::io_service& io_service, std::size_t capacity,
+    connection_manager& manager, request_handler& handler)
+{
+  connections_.reserve(capacity);
+  free_.reserve(capacity);
+  for (std::size_t slot = 0; slot < capacity; ++slot) {
+    connections_.emplace_back(new connection(io_service, slot, manager, handler));
+    free_.push_back(connections_.back().get());
+  }
+}
+
+connection_ptr connection_pool::acquire(boost::asio::ip::tcp::socket& socket)
+{
+  connection* c = nullptr;
+  do {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty())
+      return connection_ptr();
+    c = free_.back();
+    free_.pop_back();
+  } while (0);
+
+  c->reset(std::move(socket));
+
+  // The connection's weak this keeps the deleter alive after release, so let
+  // go of the pool there or the two keep each other alive.
+  auto self(shared_from_this());
+  return connection_ptr(c, [self](connection* c) mutable {
+    auto pool(std::move(self));
+    pool->release(c);
+  });
+}
+
+void connection_pool::release(connection* c)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.push_back(c);
+}
+
+std::size_t connection_pool::in_use() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return connections_.size() - free_.size();
+}
+
+} // namespace server
+} // namespace http
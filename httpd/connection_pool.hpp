@@ -0,0 +1,65 @@
+//
+// connection_pool.hpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_CONNECTION_POOL_HPP
+#define HTTP_CONNECTION_POOL_HPP
+
+#include "connection.hpp"
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace http {
+namespace server {
+
+class connection_manager;
+class request_handler;
+
+/// A fixed number of connection objects, constructed with the server and reused
+/// for every accepted socket.  The pointers handed out return their connection
+/// to the pool instead of deleting it, and keep the pool alive so that a pointer
+/// released late never dangles.  A connection still refers to the server's
+/// connection_manager and request_handler, though: the server closes every
+/// socket (connection_manager::stop_all) and leaves run() before it is
+/// destroyed, so no handler of a connection runs after that.
+class connection_pool
+  : public std::enable_shared_from_this<connection_pool>
+{
+public:
+  connection_pool(const connection_pool&) = delete;
+  connection_pool& operator=(const connection_pool&) = delete;
+
+  /// Construct capacity connections on the given io_service.
+  connection_pool(boost::asio::io_service& io_service, std::size_t capacity,
+      connection_manager& manager, request_handler& handler);
+
+  /// Move the socket into a free connection; null, with the socket left in
+  /// place, when every connection is in use.
+  connection_ptr acquire(boost::asio::ip::tcp::socket& socket);
+
+  std::size_t capacity() const { return connections_.size(); }
+
+  /// Connections handed out and not yet returned.
+  std::size_t in_use() const;
+
+private:
+  void release(connection* c);
+
+  std::vector<std::unique_ptr<connection> > connections_;
+
+  /// Free connections, most recently released last.
+  std::vector<connection*> free_;
+  mutable std::mutex mutex_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_CONNECTION_POOL_HPP
@@ -26,22 +26,69 @@
 #include "config.h"
 #include "dgctl.hpp"
 #include "bnc565.hpp"
+#include "library.hpp"
+#include "registry.hpp"
 #include "log.hpp"
 #include "pugixml.hpp"
 #include "dgprotocols.hpp"
 #include <boost/exception/all.hpp>
 #include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
+#include <algorithm>
+#include <iterator>
 #include <sstream>
 #include <iostream>
 #include <fstream>
+#include <ratio>
 
 namespace dg {
 
     struct time {
         static double scale_to_ms( double t ) { return t * 1.0e6; }
     };
+
+    // commit and, for the default device, record as the table to restore at boot; the
+    // reply text is shared by commit.json and library.load, which names the entry
+    static void
+    commit_and_activate( bnc565& device, bool is_default, const protocols<>& protocols, bool is_active, std::ostream& o
+                         , const std::string& name = std::string(), uint32_t version = 0 )
+    {
+        std::vector< validation_error > errors;
+
+        if ( device.commit( protocols, errors ) ) {
+            if ( is_default )
+                library::instance()->activate( protocols, name, version );
+            o << "COMMIT SUCCESS; " << ( is_active ? "(trigger is active)" : ( "trigger is not active" ) );
+        } else {
+            validator::write_json( o, errors );
+        }
+    }
+
+    // indexed by change_field; also the ids accepted by a websocket 'set'
+    static const char * change_names [] = { "PULSE.DELAY", "PULSE.WIDTH", "PULSE.POL", "PULSE.STATE", "interval", "state" };
+
+    // delay, width and interval in microseconds, same as status.json
+    static std::string
+    delta_json( const std::vector< change_event >& changes )
+    {
+        const auto& names = change_names;
+
+        std::ostringstream o;
+        o << "{ \"delta\": [";
+        for ( const auto& c: changes ) {
+            o << ( &c == &changes.front() ? " " : ", " );
+            o << "{ \"id\": \"" << names[ c.field ] << "\", \"ch\": " << c.channel << ", \"value\": ";
+            if ( c.field == change_delay || c.field == change_width || c.field == change_interval )
+                o << format_ticks( c.value, microseconds_digits );
+            else
+                o << c.value;
+            o << " }";
+        }
+        o << " ] }";
+        return o.str();
+    }
     
 }
 
@@ -49,16 +96,20 @@ extern bool __debug_mode__;
 
 using namespace dg;
 
-dgctl::dgctl() : is_active_( false )
-               , is_dirty_( false )
-               , pulser_interval_( 0.001 ) // 0.001s
+dgctl::dgctl( bnc565& device, const std::string& id ) : device_( device )
+                                                       , id_( id )
+                                                       , is_active_( false )
+                                                       , is_dirty_( false )
+                                                       , pulser_interval_( 0.001 ) // 0.001s
+                                                       , stream_clients_( 0 )
+                                                       , tick_state_( -1 )
 {
     update();
     
-    bnc565::instance()->register_handler( [&]( size_t tick ){
-            bool state = bnc565::instance()->state();
-            auto json = ( boost::format( "{ \"state\": {\"tick\":\"%1%\", \"state\":\"%2%\"} }" ) % tick % state ).str();
-            sse_handler_( json, "", "tick" );
+    device_.register_handler( [&]( size_t tick ){ on_tick( tick ); } );
+
+    device_.register_change_handler( [&]( const std::vector< change_event >& changes ){
+            sse_handler_( delta_json( changes ), "", event_name( "delta" ) );
         });
 }
 
@@ -66,11 +117,47 @@ dgctl::~dgctl()
 {
 }
 
+void
+dgctl::on_tick( size_t tick )
+{
+    if ( stream_clients_ == 0 ) {
+        tick_state_ = -1; // a client connecting later gets the state on its first tick
+        return;
+    }
+
+    // at high tick rates only a state change is sent, plus a once a second heartbeat
+    int state = device_.state() ? 1 : 0;
+    auto now = std::chrono::steady_clock::now();
+    if ( state == tick_state_ && now - tick_sent_ < std::chrono::seconds( 1 ) )
+        return;
+
+    tick_state_ = state;
+    tick_sent_ = now;
+    sse_handler_( ( boost::format( "{ \"state\": {\"tick\":\"%1%\", \"state\":\"%2%\"} }" ) % tick % state ).str(), "", event_name( "tick" ) );
+}
+
+void
+dgctl::setStreamClients( size_t n )
+{
+    stream_clients_ = n;
+}
+
+std::string
+dgctl::event_name( const char * event ) const
+{
+    return id_.empty() ? event : id_ + "." + event;
+}
+
 dgctl *
 dgctl::instance()
 {
-    static dgctl __instance;
-    return &__instance;
+    return registry::instance()->controller( registry::instance()->default_id() );
+}
+
+dgctl *
+dgctl::instance( const std::string& id )
+{
+    return registry::instance()->controller( id );
 }
 
 void
@@ -79,10 +166,10 @@ dgctl::update()
     int channel = 0;
 
     for ( auto& pulse: pulses_ )
-        pulse = bnc565::instance()->pulse( channel++ );
+        pulse = device_.pulse( channel++ );
     
-    //pulser_interval_ = bnc565::instance()->interval();
-    //uint32_t trig = bnc565::instance()->trigger();
+    //pulser_interval_ = device_.interval();
+    //uint32_t trig = device_.trigger();
 }
 
 size_t
@@ -131,35 +218,35 @@ dgctl::end() const
 double
 dgctl::pulser_interval() const
 {
-    return bnc565::instance()->interval();
+    return device_.interval();
 }
 
 void
 dgctl::pulser_interval( double v )
 {
-    bnc565::instance()->setInterval( v );
+    device_.setInterval( v );
 }
 
 void
 dgctl::commit()
 {
-    if ( *(bnc565::instance()) )
+    if ( device_ )
         return;
     
     int channel = 0;
 
     for ( auto& pulse: pulses_ )
-        bnc565::instance()->setPulse( channel++, pulse );
+        device_.setPulse( channel++, pulse );
 
-    bnc565::instance()->setInterval( pulser_interval_ );
+    device_.setInterval( pulser_interval_ );
 
-    //bnc565::instance()->commit();
+    //device_.commit();
 }
 
 bool
 dgctl::activate_trigger()
 {
-    //bnc565::instance()->activate_trigger();
+    //device_.activate_trigger();
     is_active_ = true;
     return true;
 }
@@ -167,7 +254,7 @@ dgctl::activate_trigger()
 bool
 dgctl::deactivate_trigger()
 {
-    //bnc565::instance()->deactivate_trigger();
+    //device_.deactivate_trigger();
     is_active_ = false;
     return true;
 }
@@ -187,31 +274,74 @@ dgctl::http_request( const std::string& method, const std::string& request_path,
 
     if ( request_path == "/dg/ctl?banner" ) {
 
-        o << "<h2>BNC 565 V" << PACKAGE_VERSION " S/N " << bnc565::instance()->idn() << "</h2>";
+        o << "<h2>BNC 565 V" << PACKAGE_VERSION " S/N " << device_.idn() << "</h2>";
         rep += o.str();
 
     } else if ( request_path == "/dg/ctl?status.json" ) {
 
         dg::protocols<> p;
-        if ( bnc565::instance()->fetch( p ) ) {
+        if ( device_.fetch( p ) ) {
             if ( dg::protocols<>::write_json( o, p ) )
                 rep += o.str();
             // dg::protocols<>::write_json( std::cout, p );
         }
 
+    } else if ( request_path == "/dg/ctl?status.xml" ) {
+
+        dg::protocols<> p;
+        if ( device_.fetch( p ) ) {
+            if ( dg::protocols<>::write_xml( o, p ) )
+                rep += o.str();
+        }
+
+    } else if ( request_path.compare( 0, 19, "/dg/ctl?commit.xml=", 19 ) == 0 ) {
+
+        std::string payload( request_path.substr( 19 ) ); // parsed in place
+        dg::protocols<> protocols;
+        std::vector< validation_error > errors;
+
+        if ( dg::protocols<>::read_xml( &payload[ 0 ], payload.size(), protocols, errors ) ) {
+            commit_and_activate( device_, id_.empty(), protocols, is_active(), o );
+            rep = o.str();
+        } else if ( ! errors.empty() ) {
+            validator::write_json( o, errors );
+            rep = o.str();
+        } else {
+            rep = "Error: malformed protocol xml";
+        }
+
+    } else if ( request_path == "/dg/ctl?scheduler.json" ) {
+
+        device_.command_scheduler().write_json( o );
+        rep += o.str();
+
+    } else if ( request_path == "/dg/ctl?jitter.json" ) {
+
+        o << boost::format( "{ \"missed_ticks\": %d, \"timer\": " ) % device_.missed_ticks();
+        device_.timer_jitter().write_json( o );
+        o << ", \"reply\": ";
+        device_.reply_latency().write_json( o );
+        o << " }";
+        rep += o.str();
+
     } else if ( request_path.compare( 0, 20, "/dg/ctl?commit.json=", 20 ) == 0 ) {
 
         std::stringstream payload( request_path.substr( 20 ) );
         dg::protocols<> protocols;
+        std::vector< validation_error > errors;
         
         try {
-            if ( dg::protocols<>::read_json( payload, protocols ) ) {
+            if ( dg::protocols<>::read_json( payload, protocols, errors ) ) {
 
                 // dg::protocols<>::write_json( std::cout, protocols );
 
-                bnc565::instance()->commit( protocols );
-                o << "COMMIT SUCCESS; " << ( is_active() ? "(trigger is active)" : ( "trigger is not active" ) );
+                commit_and_activate( device_, id_.empty(), protocols, is_active(), o );
+                rep = o.str();
+            } else if ( ! errors.empty() ) {
+                validator::write_json( o, errors );
                 rep = o.str();
+            } else {
+                rep = "Error: malformed protocol json";
             }
         } catch ( std::exception& e ) {
             rep = boost::diagnostic_information( e );
@@ -229,7 +359,7 @@ dgctl::http_request( const std::string& method, const std::string& request_path,
                 auto text = item.second.get_value< std::string >();
                 if ( !text.empty() ) {
                     std::string reply;
-                    if ( bnc565::instance()->xsend( (text + "\r\n").c_str(), rep ) ) {
+                    if ( device_.xsend( (text + "\r\n").c_str(), rep ) ) {
                         rep += reply;
                     } else {
                         rep += "Error";
@@ -251,7 +381,7 @@ dgctl::http_request( const std::string& method, const std::string& request_path,
                 if ( auto id = item.second.get_optional<std::string>( "id" ) ) {
                     if ( auto value = item.second.get_optional<bool>( "value" ) ) {
                         if ( ( id.get() == "switch-connect" ) ) {
-                            bnc565::instance()->switch_connect( value.get(), rep );
+                            device_.switch_connect( value.get(), rep );
                         }
                     }
                 }
@@ -262,6 +392,40 @@ dgctl::http_request( const std::string& method, const std::string& request_path,
             log() << boost::diagnostic_information( e );
         } 
         
+    } else if ( request_path == "/dg/ctl?library" ) {
+
+        library::instance()->write_json( o );
+        rep = o.str();
+
+    } else if ( request_path.compare( 0, 21, "/dg/ctl?library.save=", 21 ) == 0 ) {
+
+        // saves what the device runs now
+        auto name = request_path.substr( 21 );
+        if ( uint32_t version = library::instance()->save( name, device_.image() ) )
+            o << boost::format( "SAVED %1%@%2%" ) % name % version;
+        else
+            o << boost::format( "Error: could not save '%1%'" ) % name;
+        rep = o.str();
+
+    } else if ( request_path.compare( 0, 21, "/dg/ctl?library.load=", 21 ) == 0 ) {
+
+        // name or name@version
+        auto name = request_path.substr( 21 );
+        uint32_t version = 0;
+        auto at = name.find_last_of( '@' );
+        if ( at != std::string::npos ) {
+            try {
+                version = boost::lexical_cast< uint32_t >( name.substr( at + 1 ) );
+                name.erase( at );
+            } catch ( boost::bad_lexical_cast& ) {
+            }
+        }
+        if ( auto protocols = library::instance()->load( name, version ) )
+            commit_and_activate( device_, id_.empty(), protocols.get(), is_active(), o, name, version );
+        else
+            o << boost::format( "Error: no protocol '%1%' in library" ) % request_path.substr( 21 );
+        rep = o.str();
+
     } else if ( request_path == "/dg/ctl?events" ) {
         
         rep = "SSE";
@@ -275,6 +439,94 @@ dgctl::http_request( const std::string& method, const std::string& request_path,
     return true;
 }
 
+// { "set": [ { "id": "PULSE.DELAY", "ch": 0, "value": 1.5 }, ... ] } -- same ids and units as the 'delta' event
+// { "get": "status" }
+std::string
+dgctl::ws_request( const std::string& message )
+{
+    std::ostringstream o;
+    std::stringstream payload( message );
+
+    try {
+        boost::property_tree::ptree pt;
+        boost::property_tree::read_json( payload, pt );
+
+        // { "device": "<id>", ... } addresses another device
+        auto device = pt.get< std::string >( "device", "" );
+        if ( !device.empty() && device != id_ && !( id_.empty() && device == registry::instance()->default_id() ) ) {
+            if ( auto ctl = dgctl::instance( device ) )
+                return ctl->ws_request( message );
+            return ( boost::format( "{ \"error\": \"unknown device '%s'\" }" ) % device ).str();
+        }
+
+        if ( auto set = pt.get_child_optional( "set" ) ) {
+
+            std::vector< change_event > changes;
+            std::vector< validation_error > errors;
+
+            for ( const auto& item: set.get() ) {
+                auto id = item.second.get< std::string >( "id" );
+                auto it = std::find_if( std::begin( change_names ), std::end( change_names ), [&]( const char * name ){ return id == name; } );
+                if ( it == std::end( change_names ) )
+                    return ( boost::format( "{ \"error\": \"unknown id '%s'\" }" ) % id ).str();
+
+                change_event c{ change_field( std::distance( std::begin( change_names ), it ) ), -1, 0 };
+                double value = item.second.get< double >( "value" );
+
+                if ( c.field == change_delay || c.field == change_width || c.field == change_polarity || c.field == change_state ) {
+                    c.channel = item.second.get< int >( "ch" );
+                    if ( c.channel < 0 || c.channel >= int( protocol<>::size ) )
+                        return ( boost::format( "{ \"error\": \"channel %d out of range\" }" ) % c.channel ).str();
+                }
+
+                if ( c.field == change_delay || c.field == change_width || c.field == change_interval ) {
+                    if ( ! representable( value / std::micro::den ) ) { // us
+                        errors.push_back( { 0, c.channel, invalid_value, 0 } );
+                        continue;
+                    }
+                    c.value = seconds_to_ticks( value / std::micro::den );
+                } else {
+                    c.value = value != 0;
+                }
+
+                changes.push_back( c );
+            }
+
+            if ( ! errors.empty() ) {
+                validator::write_json( o, errors ); // nothing is sent if any value is unusable
+                return o.str();
+            }
+
+            bool success = device_.update( changes, errors );
+            if ( id_.empty() && errors.empty() )
+                library::instance()->activate( device_.image() );
+
+            if ( success )
+                o << boost::format( "{ \"ack\": %d }" ) % changes.size();
+            else if ( ! errors.empty() )
+                validator::write_json( o, errors ); // same as a rejected commit.json
+            else
+                o << "{ \"error\": \"device did not acknowledge\" }";
+
+        } else if ( pt.get< std::string >( "get", "" ) == "status" ) {
+
+            dg::protocols<> p;
+            if ( device_.fetch( p ) )
+                dg::protocols<>::write_json( o, p );
+
+        } else {
+            o << "{ \"error\": \"unknown request\" }";
+        }
+
+    } catch ( std::exception& e ) {
+        log() << boost::diagnostic_information( e );
+        o.str( "" );
+        o << "{ \"error\": \"malformed request\" }";
+    }
+
+    return o.str();
+}
+
 // void
 // dgctl::register_sse_handler( std::function< void( const std::string&, const std::string&, const std::string& ) > f )
 // {
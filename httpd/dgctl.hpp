@@ -29,6 +29,7 @@
 #include <boost/signals2.hpp>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <mutex>
 #include <utility>
@@ -41,13 +42,19 @@
 namespace dg {
 
     class fpga;
+    class bnc565;
+    class registry;
 
     class dgctl {
         std::mutex mutex_;
-        dgctl();
+        // id is empty for the default device; other devices prefix their event names with 'id.'
+        dgctl( bnc565&, const std::string& id );
+        friend class registry;
     public:
         ~dgctl();
+        // controller of the default device, or of the device with the id (null if unknown)
         static dgctl * instance();
+        static dgctl * instance( const std::string& id );
         enum { nitem = 6 };
         typedef std::pair<double, double> value_type;
         typedef std::array< value_type, nitem >::iterator iterator;
@@ -73,17 +80,30 @@ namespace dg {
         void update();
         bool http_request( const std::string& method, const std::string& request_path, std::string& );
 
+        // one JSON message from a websocket client; returns the JSON reply
+        std::string ws_request( const std::string& message );
+
         typedef boost::signals2::signal< void( const std::string&, const std::string&, const std::string& ) > sse_handler_t;
 
         boost::signals2::connection register_sse_handler( const sse_handler_t::slot_type& );
+
+        // number of connected SSE and websocket clients; no tick is formatted without one
+        void setStreamClients( size_t );
         // void register_sse_handler( std::function< void( const std::string&, const std::string&, const std::string& ) > );
 
     private:
+        bnc565& device_;
+        std::string id_;
         bool is_active_;
         bool is_dirty_;
         double pulser_interval_;
         std::array< value_type, nitem > pulses_;
         sse_handler_t sse_handler_;
+        std::atomic< size_t > stream_clients_;
+        int tick_state_; // last state sent with a tick, -1 if none
+        std::chrono::steady_clock::time_point tick_sent_;
+        void on_tick( size_t tick );
+        std::string event_name( const char * ) const;
         // std::vector< std::function< void( const std::string&, const std::string&, const std::string& ) > > event_handlers_;
         // std::shared_ptr< adportable::dg::protocols > protocols_;
     };
@@ -25,7 +25,12 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
 #include <tuple>
 
 namespace dg {
@@ -38,34 +43,213 @@ namespace dg {
 
     size_t constexpr delay_pulse_count = 8;
 
+    uint32_t constexpr resolution = 10; // ns, device timing resolution
+
+    // device time unit, one tick is 'resolution' ns
+    typedef int64_t tick_type;
+
+    // longest delay, width or period the device takes, either sign for a delay
+    double constexpr max_seconds = 1000.0;
+    tick_type constexpr max_ticks = tick_type( max_seconds * 1.0e9 / resolution );
+
+    // decimal places of a tick count expressed in seconds and in microseconds
+    unsigned constexpr seconds_digits = 8;
+    unsigned constexpr microseconds_digits = 2;
+
+    // Plain loops over contiguous arrays, without branches or calls, so that the
+    // compiler vectorizes them; no intrinsics to stay portable across gcc and msvc.
+    namespace kernel {
+
+        // round src * factor to the nearest integer; adding and removing 2^52 rounds
+        // in SSE2 arithmetic.  Values beyond max_ticks saturate and nan becomes 0, so the
+        // conversion is always defined; check with not_representable first to reject them
+        inline void to_ticks( const double * src, tick_type * dst, size_t n, double factor ) {
+            const double magic = 4503599627370496.0;
+            const double limit = double( max_ticks );
+            for ( size_t i = 0; i < n; ++i ) {
+                double x = src[ i ] * factor;
+                x = ( x == x ) ? x : 0.0;
+                x = ( x < limit ) ? x : limit;
+                x = ( x > -limit ) ? x : -limit;
+                double r = ( x >= 0 ) ? ( x + magic ) - magic : ( x - magic ) + magic;
+                dst[ i ] = tick_type( r );
+            }
+        }
+
+        // bit n is set for a src[ n ] * unit (seconds) that is nan, infinite or beyond max_seconds
+        inline uint32_t not_representable( const double * src, size_t n, double unit ) {
+            uint32_t mask = 0;
+            for ( size_t i = 0; i < n; ++i ) {
+                bool bad = !( std::abs( src[ i ] * unit ) <= max_seconds );
+                mask |= uint32_t( bad ) << i;
+            }
+            return mask;
+        }
+
+        inline void to_seconds( const tick_type * src, double * dst, size_t n ) {
+            for ( size_t i = 0; i < n; ++i )
+                dst[ i ] = double( src[ i ] ) * ( resolution * 1.0e-9 );
+        }
+
+        // bit n is set for channel n with a negative start, a width below one tick
+        // or a pulse that does not end within the interval
+        inline uint32_t out_of_range( const tick_type * delay, const tick_type * width, size_t n, tick_type interval ) {
+            uint32_t mask = 0;
+            for ( size_t i = 0; i < n; ++i ) {
+                bool bad = ( delay[ i ] < 0 ) | ( width[ i ] < 1 ) | ( delay[ i ] + width[ i ] > interval );
+                mask |= uint32_t( bad ) << i;
+            }
+            return mask;
+        }
+    }
+
+    inline bool representable( double seconds ) {
+        return kernel::not_representable( &seconds, 1, 1.0 ) == 0;
+    }
+
+    // saturates; see kernel::to_ticks
+    inline tick_type seconds_to_ticks( double t ) {
+        tick_type ticks;
+        kernel::to_ticks( &t, &ticks, 1, 1.0e9 / resolution );
+        return ticks;
+    }
+
+    inline double ticks_to_seconds( tick_type t ) {
+        double seconds;
+        kernel::to_seconds( &t, &seconds, 1 );
+        return seconds;
+    }
+
+    // exact decimal text of ticks / 10^digits without trailing zeros, e.g.
+    // format_ticks( 123, seconds_digits ) == "0.00000123"
+    inline std::string format_ticks( tick_type ticks, unsigned digits ) {
+        char buf[ 48 ];
+        char * p = buf + sizeof( buf );
+        uint64_t u = ticks < 0 ? uint64_t( -( ticks + 1 ) ) + 1 : uint64_t( ticks );
+        bool fraction = false;
+        for ( unsigned i = 0; i < digits; ++i, u /= 10 ) {
+            if ( u % 10 || fraction ) {
+                *--p = char( '0' + u % 10 );
+                fraction = true;
+            }
+        }
+        if ( fraction )
+            *--p = '.';
+        do {
+            *--p = char( '0' + u % 10 );
+        } while ( u /= 10 );
+        if ( ticks < 0 )
+            *--p = '-';
+        return std::string( p, buf + sizeof( buf ) );
+    }
+
+    // One pulse table, stored as structure of arrays.  Delays and widths are held
+    // in device ticks, which are compared and formatted; the seconds arrays are
+    // derived from them, so every value is quantized to the device resolution.
+    // Polarity and state are bitmasks indexed by channel.
     template< size_t _size = delay_pulse_count >
     class protocol {
+        static_assert( _size <= 32, "polarity and state masks hold 32 channels" );
     public:
         static size_t constexpr size = _size;
 
-        protocol() {}
-            
-        protocol( const protocol& t ) : pulses_( t.pulses_ ) {
+        protocol() : polarity_( 0 ), state_( 0 ) {
+            delay_ticks_.fill( 0 );
+            width_ticks_.fill( 0 );
+            delay_.fill( 0 );
+            width_.fill( 0 );
+        }
+
+        protocol( const protocol& t ) = default;
+        protocol& operator = ( const protocol& ) = default;
+
+        bool operator == ( const protocol& t ) const {
+            return polarity_ == t.polarity_ && state_ == t.state_
+                && delay_ticks_ == t.delay_ticks_ && width_ticks_ == t.width_ticks_;
+        }
+        bool operator != ( const protocol& t ) const { return !( *this == t ); }
+
+        // tuple view of a channel, for code that handles a single pulse
+        delay_pulse_type operator []( int ch ) const {
+            return delay_pulse_type( delay_[ ch ], width_[ ch ], polarity( ch ), state( ch ) );
+        }
+
+        void set( int ch, const delay_pulse_type& t ) {
+            setDelay( ch, std::get< pulse_delay >( t ) );
+            setWidth( ch, std::get< pulse_width >( t ) );
+            setPolarity( ch, std::get< pulse_polarity >( t ) );
+            setState( ch, std::get< pulse_state >( t ) );
         }
 
-        delay_pulse_type& operator []( int index ) {
-            return pulses_ [ index ];
+        double delay( int ch ) const { return delay_[ ch ]; }  // seconds
+        double width( int ch ) const { return width_[ ch ]; }
+        tick_type delay_ticks( int ch ) const { return delay_ticks_[ ch ]; }
+        tick_type width_ticks( int ch ) const { return width_ticks_[ ch ]; }
+
+        // false, and the channel unchanged, for a value that is not representable
+        bool setDelay( int ch, double seconds ) {
+            if ( ! representable( seconds ) )
+                return false;
+            setDelayTicks( ch, seconds_to_ticks( seconds ) );
+            return true;
+        }
+        bool setWidth( int ch, double seconds ) {
+            if ( ! representable( seconds ) )
+                return false;
+            setWidthTicks( ch, seconds_to_ticks( seconds ) );
+            return true;
+        }
+        void setDelayTicks( int ch, tick_type t ) { delay_ticks_[ ch ] = t; delay_[ ch ] = ticks_to_seconds( t ); }
+        void setWidthTicks( int ch, tick_type t ) { width_ticks_[ ch ] = t; width_[ ch ] = ticks_to_seconds( t ); }
+
+        // whole table; unit is the length of one src unit in seconds, e.g. 1.0e-6 for us.
+        // Returns the channels that are not representable; those are left unchanged
+        uint32_t setDelays( const double * src, double unit ) {
+            return assign_seconds( src, unit, delay_ticks_, delay_ );
         }
-            
-        const delay_pulse_type& operator []( int index ) const {
-            return pulses_ [ index ];
+        uint32_t setWidths( const double * src, double unit ) {
+            return assign_seconds( src, unit, width_ticks_, width_ );
         }
 
-        const std::array< delay_pulse_type, size >& pulses() const {
-            return pulses_;
+        // whole table in device ticks, as stored by the protocol library
+        void assign( const tick_type * delays, const tick_type * widths, uint32_t polarities, uint32_t states ) {
+            std::copy( delays, delays + _size, delay_ticks_.begin() );
+            std::copy( widths, widths + _size, width_ticks_.begin() );
+            kernel::to_seconds( delay_ticks_.data(), delay_.data(), _size );
+            kernel::to_seconds( width_ticks_.data(), width_.data(), _size );
+            polarity_ = polarities;
+            state_ = states;
         }
 
-        double& delay( int ch )  { return std::get< pulse_delay > ( pulses_[ ch ] ); }
-        double& width( int ch )  { return std::get< pulse_width > ( pulses_[ ch ] ); }
-        bool& polarity( int ch ) { return std::get< pulse_polarity > ( pulses_[ ch ] ); }
-        int& state( int ch )     { return std::get< pulse_state > ( pulses_[ ch ] ); }
-        
+        bool polarity( int ch ) const { return polarity_ & ( 1u << ch ); }
+        bool state( int ch ) const    { return state_ & ( 1u << ch ); }
+        void setPolarity( int ch, bool v ) { polarity_ = ( polarity_ & ~( 1u << ch ) ) | ( uint32_t( v ) << ch ); }
+        void setState( int ch, bool v )    { state_ = ( state_ & ~( 1u << ch ) ) | ( uint32_t( v ) << ch ); }
+
+        const std::array< double, _size >& delays() const { return delay_; }
+        const std::array< double, _size >& widths() const { return width_; }
+        const std::array< tick_type, _size >& delay_ticks() const { return delay_ticks_; }
+        const std::array< tick_type, _size >& width_ticks() const { return width_ticks_; }
+        uint32_t polarities() const { return polarity_; }
+        uint32_t states() const { return state_; }
+
     private:
-        std::array< delay_pulse_type, _size > pulses_;  // delay, width, inv, state
+        static uint32_t assign_seconds( const double * src, double unit
+                                        , std::array< tick_type, _size >& ticks, std::array< double, _size >& seconds ) {
+            std::array< tick_type, _size > t;
+            kernel::to_ticks( src, t.data(), _size, unit * 1.0e9 / resolution );
+            uint32_t bad = kernel::not_representable( src, _size, unit );
+            for ( size_t ch = 0; ch < _size; ++ch )
+                ticks[ ch ] = ( bad & ( 1u << ch ) ) ? ticks[ ch ] : t[ ch ];
+            kernel::to_seconds( ticks.data(), seconds.data(), _size );
+            return bad;
+        }
+
+        std::array< tick_type, _size > delay_ticks_;
+        std::array< tick_type, _size > width_ticks_;
+        std::array< double, _size > delay_;
+        std::array< double, _size > width_;
+        uint32_t polarity_;  // bit set = negative
+        uint32_t state_;     // bit set = on
     };
 }
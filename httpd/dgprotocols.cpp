@@ -24,12 +24,19 @@
 **************************************************************************/
 
 #include "dgprotocols.hpp"
+#include "validator.hpp"
+#include "pugixml.hpp"
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/exception/all.hpp>
 #include <boost/format.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <ratio>
 
 static void
@@ -48,11 +55,21 @@ print( const boost::property_tree::ptree& pt )
 // using namespace adportable::dg;
 
 namespace dg {
-    
+
+    // an invalid_value error for each channel set in mask
+    static void
+    invalid_values( int protocol, uint32_t mask, std::vector< validation_error >& errors )
+    {
+        for ( size_t ch = 0; mask && ch < delay_pulse_count; ++ch )
+            if ( mask & ( 1u << ch ) )
+                errors.push_back( { protocol, int( ch ), invalid_value, 0 } );
+    }
+
     template<> bool
-    protocols< protocol<> >::read_json( std::istream& json, protocols< protocol<> >& protocols )
+    protocols< protocol<> >::read_json( std::istream& json, protocols< protocol<> >& protocols, std::vector< validation_error >& errors )
     {
         protocols.protocols_.clear();
+        size_t count = errors.size();
         
         boost::property_tree::ptree pt;
         
@@ -63,36 +80,40 @@ namespace dg {
                 protocols.state_ = state.get();
             
             if ( auto interval = pt.get_optional< double >( "protocols.interval" ) ) {
-                protocols.interval_ = interval.get() / std::micro::den; // us
+                if ( ! protocols.setInterval( interval.get() / std::micro::den ) ) // us
+                    errors.push_back( { -1, -1, invalid_value, 0 } );
             }
 
             for ( const auto& v : pt.get_child( "protocols.protocol" ) ) {
 
                 protocol<delay_pulse_count> data;
-                int index = 0;
-                if ( auto value = v.second.get_optional< int >( "index" ) )
-                    index = value.get();
-
+                std::array< double, delay_pulse_count > delays = {{ 0 }}, widths = {{ 0 }}; // us
                 size_t ch(0);
                 for ( const auto& pulse: v.second.get_child( "pulses" ) ) {
 
-                    auto& x = data[ ch ];
                     if ( ch < protocol<>::size ) {
                         if ( auto delay = pulse.second.get_optional< double >( "delay" ) )
-                            std::get< dg::pulse_delay >( x ) = delay.value() / std::micro::den;
+                            delays[ ch ] = delay.value();
                         if ( auto width = pulse.second.get_optional< double >( "width" ) )
-                            std::get< dg::pulse_width >( x ) = width.value() / std::micro::den;
+                            widths[ ch ] = width.value();
                         if ( auto pol = pulse.second.get_optional< bool >( "polarity" ) )
-                            std::get< dg::pulse_polarity >( x ) = pol.get();
+                            data.setPolarity( ch, pol.get() );
                         if ( auto state = pulse.second.get_optional< bool >( "state" ) )
-                            std::get< dg::pulse_state >( x ) = state.get();
+                            data.setState( ch, state.get() );
                     }
                     ++ch;
                 }
+
+                // whole table us -> device ticks
+                int index = int( protocols.protocols_.size() );
+                invalid_values( index, data.setDelays( delays.data(), 1.0 / std::micro::den ), errors );
+                invalid_values( index, data.setWidths( widths.data(), 1.0 / std::micro::den ), errors );
+
                 protocols.protocols_.emplace_back( data );
             }
 
-            return true;
+            // the device needs at least the first table
+            return !protocols.protocols_.empty() && errors.size() == count;
         
         } catch ( std::exception& e ) {
             // std::cout << boost::diagnostic_information( e );
@@ -101,6 +122,13 @@ namespace dg {
         return false;
     }
 
+    template<> bool
+    protocols< protocol<> >::read_json( std::istream& json, protocols< protocol<> >& protocols )
+    {
+        std::vector< validation_error > errors;
+        return read_json( json, protocols, errors );
+    }
+
     /////////////////////
         
     template<> bool
@@ -111,7 +139,7 @@ namespace dg {
         pt.put( "idn", protocols.idn() );
         pt.put( "inst_full", protocols.full() );
     
-        pt.put( "protocols.interval", ( boost::format( "%g" ) % ( protocols.interval_ * std::micro::den ) ).str() ); // seconds --> us
+        pt.put( "protocols.interval", format_ticks( protocols.interval_, microseconds_digits ) ); // us
         pt.put( "protocols.state", protocols.state_ );
     
         boost::property_tree::ptree pv;
@@ -126,13 +154,13 @@ namespace dg {
         
             boost::property_tree::ptree xpulses;
         
-            for ( const auto& pulse: protocol.pulses() ) {
+            for ( size_t ch = 0; ch < protocol.size; ++ch ) {
                 boost::property_tree::ptree xpulse;
 
-                xpulse.put( "delay", ( boost::format( "%g" ) % ( std::get<dg::pulse_delay>(pulse) * std::micro::den ) ).str() );
-                xpulse.put( "width", ( boost::format( "%g" ) % ( std::get<dg::pulse_width>(pulse) * std::micro::den ) ).str() );
-                xpulse.put( "polarity", std::get<dg::pulse_polarity>(pulse) );
-                xpulse.put( "state", std::get<dg::pulse_state>(pulse) );
+                xpulse.put( "delay", format_ticks( protocol.delay_ticks( ch ), microseconds_digits ) ); // us
+                xpulse.put( "width", format_ticks( protocol.width_ticks( ch ), microseconds_digits ) );
+                xpulse.put( "polarity", protocol.polarity( ch ) );
+                xpulse.put( "state", int( protocol.state( ch ) ) );
                 
                 xpulses.push_back( std::make_pair( "", xpulse ) );
             }
@@ -149,5 +177,128 @@ namespace dg {
         return true;
     }
 
+    /////////////////////
+
+    // <protocols interval="1000" state="0">
+    //   <protocol index="0">
+    //     <pulse ch="0" delay="1.1" width="0.1" polarity="false" state="1"/>
+    //     ...
+    // times in microseconds, same as json; the element may be nested in a larger document
+    template<> bool
+    protocols< protocol<> >::read_xml( char * buffer, size_t size, protocols< protocol<> >& protocols, std::vector< validation_error >& errors )
+    {
+        size_t count = errors.size();
+        pugi::xml_document doc;
+        if ( ! doc.load_buffer_inplace( buffer, size, pugi::parse_minimal ) )
+            return false;
+
+        auto xprotocols = doc.find_node( []( pugi::xml_node node ){ return std::strcmp( node.name(), "protocols" ) == 0; } );
+        if ( ! xprotocols )
+            return false;
+
+        protocols.protocols_.clear();
+
+        if ( auto state = xprotocols.attribute( "state" ) )
+            protocols.state_ = state.as_int();
+
+        if ( auto interval = xprotocols.attribute( "interval" ) ) {
+            if ( ! protocols.setInterval( interval.as_double() / std::micro::den ) )
+                errors.push_back( { -1, -1, invalid_value, 0 } );
+        }
+
+        for ( auto xprotocol: xprotocols.children( "protocol" ) ) {
+
+            protocol< delay_pulse_count > data;
+            std::array< double, delay_pulse_count > delays = {{ 0 }}, widths = {{ 0 }}; // us
+
+            size_t ch( 0 );
+            for ( auto pulse: xprotocol.children( "pulse" ) ) {
+                size_t index = pulse.attribute( "ch" ).as_uint( unsigned( ch ) );
+                if ( index < protocol<>::size ) {
+                    delays[ index ] = pulse.attribute( "delay" ).as_double();
+                    widths[ index ] = pulse.attribute( "width" ).as_double();
+                    data.setPolarity( index, pulse.attribute( "polarity" ).as_bool() );
+                    data.setState( index, pulse.attribute( "state" ).as_bool() );
+                }
+                ++ch;
+            }
+
+            int index = int( protocols.protocols_.size() );
+            invalid_values( index, data.setDelays( delays.data(), 1.0 / std::micro::den ), errors );
+            invalid_values( index, data.setWidths( widths.data(), 1.0 / std::micro::den ), errors );
+
+            protocols.protocols_.emplace_back( data );
+        }
+
+        // the device needs at least the first table
+        return !protocols.protocols_.empty() && errors.size() == count;
+    }
+
+    template<> bool
+    protocols< protocol<> >::read_xml( char * buffer, size_t size, protocols< protocol<> >& protocols )
+    {
+        std::vector< validation_error > errors;
+        return read_xml( buffer, size, protocols, errors );
+    }
+
+    template<> bool
+    protocols< protocol<> >::write_xml( std::ostream& o, const protocols< protocol<> >& protocols )
+    {
+        pugi::xml_document doc;
+
+        auto xprotocols = doc.append_child( "protocols" );
+        xprotocols.append_attribute( "interval" ).set_value( format_ticks( protocols.interval_, microseconds_digits ).c_str() );
+        xprotocols.append_attribute( "state" ).set_value( protocols.state_ );
+
+        int protocolIndex( 0 );
+        for ( const auto& protocol: protocols.protocols_ ) {
+
+            auto xprotocol = xprotocols.append_child( "protocol" );
+            xprotocol.append_attribute( "index" ).set_value( protocolIndex++ );
+
+            for ( size_t ch = 0; ch < protocol.size; ++ch ) {
+                auto xpulse = xprotocol.append_child( "pulse" );
+                xpulse.append_attribute( "ch" ).set_value( unsigned( ch ) );
+                xpulse.append_attribute( "delay" ).set_value( format_ticks( protocol.delay_ticks( ch ), microseconds_digits ).c_str() );
+                xpulse.append_attribute( "width" ).set_value( format_ticks( protocol.width_ticks( ch ), microseconds_digits ).c_str() );
+                xpulse.append_attribute( "polarity" ).set_value( protocol.polarity( ch ) );
+                xpulse.append_attribute( "state" ).set_value( int( protocol.state( ch ) ) );
+            }
+        }
+
+        doc.save( o, "  " );
+        return bool( o );
+    }
+
+    /////////////////////
+
+    template<> bool
+    protocols< protocol<> >::load( const std::string& path, protocols< protocol<> >& protocols )
+    {
+        std::ifstream in( path, std::ios::binary );
+        if ( ! in )
+            return false;
+
+        if ( boost::iequals( boost::filesystem::path( path ).extension().string(), ".xml" ) ) {
+            std::vector< char > buffer( ( std::istreambuf_iterator< char >( in ) ), std::istreambuf_iterator< char >() );
+            return read_xml( buffer.data(), buffer.size(), protocols );
+        }
+
+        return read_json( in, protocols );
+    }
+
+    template<> bool
+    protocols< protocol<> >::save( const std::string& path, const protocols< protocol<> >& protocols )
+    {
+        std::ofstream o( path );
+        if ( ! o )
+            return false;
+
+        if ( boost::iequals( boost::filesystem::path( path ).extension().string(), ".xml" ) )
+            return write_xml( o, protocols );
+
+        return write_json( o, protocols );
+    }
+
 }
 
@@ -30,29 +30,61 @@
 #include <vector>
 
 namespace dg {
+
+    struct validation_error;
     
     template< typename protocol_type = protocol< delay_pulse_count > >
     class protocols {
     public:
         protocols() : protocols_( 1 )
-                    , interval_( 1.0e-3 )
+                    , interval_( seconds_to_ticks( 1.0e-3 ) )
                     , state_( 0 ) {
         }
         
-        protocols( const protocols& t ) : interval_( t.interval_ )
+        protocols( const protocols& t ) : idn_( t.idn_ )
+                                        , inst_full_( t.inst_full_ )
+                                        , interval_( t.interval_ )
+                                        , state_( t.state_ )
                                         , protocols_( t.protocols_ ) {
         }
+
+        protocols& operator = ( const protocols& ) = default;
+
+        // timing and states only; idn and inst_full are not part of the setting
+        bool operator == ( const protocols& t ) const {
+            return interval_ == t.interval_ && state_ == t.state_ && protocols_ == t.protocols_;
+        }
+        bool operator != ( const protocols& t ) const { return !( *this == t ); }
         
+        // false on a malformed document or a value that is not representable; errors
+        // gets an invalid_value entry for each such value
         static bool read_json( std::istream&, protocols<protocol<> >& );
+        static bool read_json( std::istream&, protocols<protocol<> >&, std::vector< validation_error >& errors );
         static bool write_json( std::ostream&, const protocols<protocol<> >& );
+
+        // parsed in place; the buffer is modified
+        static bool read_xml( char * buffer, size_t size, protocols<protocol<> >& );
+        static bool read_xml( char * buffer, size_t size, protocols<protocol<> >&, std::vector< validation_error >& errors );
+        static bool write_xml( std::ostream&, const protocols<protocol<> >& );
+
+        // json or xml by file extension
+        static bool load( const std::string& path, protocols<protocol<> >& );
+        static bool save( const std::string& path, const protocols<protocol<> >& );
         
         double interval() const {
-            return interval_;
+            return ticks_to_seconds( interval_ );
         }
         
-        void setInterval( double interval ) {
-            interval_ = interval;
+        // false, and the interval unchanged, for a value that is not representable
+        bool setInterval( double interval ) {
+            if ( ! representable( interval ) )
+                return false;
+            interval_ = seconds_to_ticks( interval );
+            return true;
         }
+
+        tick_type interval_ticks() const { return interval_; }
+        void setIntervalTicks( tick_type t ) { interval_ = t; }
         
         const protocol_type& operator [] ( int idx ) const {
             return protocols_[ idx ];
@@ -91,7 +123,7 @@ namespace dg {
     private:
         std::string idn_;
         std::string inst_full_;
-        double interval_;
+        tick_type interval_;
         int state_;
         std::vector< protocol_type > protocols_;
     };
@@ -0,0 +1,88 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#include "histogram.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+
+using namespace dg;
+
+histogram::histogram() : count_( 0 )
+                       , total_( clock_type::duration::zero() )
+                       , max_( clock_type::duration::zero() )
+{
+    bins_.fill( 0 );
+}
+
+void
+histogram::add( clock_type::duration d )
+{
+    auto us = std::chrono::duration_cast< std::chrono::microseconds >( d ).count();
+
+    size_t bin = 0;
+    while ( us > 0 && bin < bins_.size() - 1 ) {
+        us >>= 1;
+        ++bin;
+    }
+
+    std::lock_guard< std::mutex > lock( mutex_ );
+    ++bins_[ bin ];
+    ++count_;
+    total_ += d;
+    max_ = std::max( max_, d );
+}
+
+void
+histogram::clear()
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+    bins_.fill( 0 );
+    count_ = 0;
+    total_ = max_ = clock_type::duration::zero();
+}
+
+void
+histogram::write_json( std::ostream& o ) const
+{
+    using namespace std::chrono;
+
+    std::lock_guard< std::mutex > lock( mutex_ );
+
+    double avg = count_ ? duration_cast< duration< double, std::micro > >( total_ ).count() / count_ : 0;
+    o << boost::format( "{ \"count\": %d, \"avg_us\": %.1f, \"max_us\": %d, \"bins\": [" )
+        % count_ % avg % duration_cast< microseconds >( max_ ).count();
+
+    const char * sep = " ";
+    for ( size_t i = 0; i < bins_.size(); ++i ) {
+        if ( bins_[ i ] == 0 )
+            continue;
+        if ( i == bins_.size() - 1 )
+            o << sep << boost::format( "{ \"lt_us\": null, \"count\": %d }" ) % bins_[ i ];
+        else
+            o << sep << boost::format( "{ \"lt_us\": %d, \"count\": %d }" ) % ( uint64_t( 1 ) << i ) % bins_[ i ];
+        sep = ", ";
+    }
+    o << " ] }";
+}
@@ -0,0 +1,58 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+
+namespace dg {
+
+    // Latency histogram with power of two microsecond bins; bin 0 counts samples
+    // below 1 us, bin i counts [2^(i-1), 2^i) us, the last bin everything above.
+    class histogram {
+    public:
+        histogram();
+
+        typedef std::chrono::steady_clock clock_type;
+
+        void add( clock_type::duration );
+        void clear();
+
+        // { "count": n, "avg_us": x, "max_us": y, "bins": [ { "lt_us": 1, "count": n }, ... ] }
+        void write_json( std::ostream& ) const;
+
+    private:
+        mutable std::mutex mutex_;
+        std::array< uint64_t, 24 > bins_;
+        uint64_t count_;
+        clock_type::duration total_;
+        clock_type::duration max_;
+    };
+
+}
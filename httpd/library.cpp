@@ -0,0 +1,444 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "library.hpp"
+#include "log.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+namespace dg {
+
+    namespace {
+
+        const char magic[ 8 ] = { 'D', 'G', 'L', 'I', 'B', 0, 0, 1 }; // last byte is the format version
+
+        struct file_header {
+            char magic[ 8 ];
+            uint64_t used;      // bytes in use, including this header
+            uint64_t active;    // offset of the active record, 0 if none
+            uint64_t reserved;
+        };
+
+        struct record_header {
+            char name[ library::name_size ]; // empty for an activated, unnamed table
+            uint32_t version;
+            uint32_t count;     // pulse tables that follow
+            int64_t interval;   // ticks
+            int64_t saved;      // seconds since epoch
+            int32_t state;
+            uint32_t used;      // pulse tables in use, less than count in a slot; 0 in older files
+        };
+
+        struct pulse_table {
+            tick_type delay[ delay_pulse_count ];
+            tick_type width[ delay_pulse_count ];
+            uint32_t polarities;
+            uint32_t states;
+        };
+
+        const uint64_t initial_size = 64 * 1024;
+
+        inline uint64_t record_size( uint32_t count ) {
+            return sizeof( record_header ) + count * sizeof( pulse_table );
+        }
+    }
+}
+
+using namespace dg;
+
+library::library()
+{
+}
+
+library::~library()
+{
+    if ( region_ )
+        region_->flush();
+}
+
+library *
+library::instance()
+{
+    static library __instance;
+    return &__instance;
+}
+
+bool
+library::is_open() const
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+    return bool( region_ );
+}
+
+bool
+library::open( const std::string& path )
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+
+    region_.reset();
+    file_.reset();
+    index_.clear();
+    slots_.clear();
+    path_ = path;
+
+    try {
+        boost::filesystem::path file( path );
+        boost::system::error_code ec;
+        if ( file.has_parent_path() )
+            boost::filesystem::create_directories( file.parent_path(), ec );
+
+        if ( ! boost::filesystem::exists( file ) ) {
+            file_header h = { { 0 }, sizeof( file_header ), 0, 0 };
+            std::copy( std::begin( magic ), std::end( magic ), h.magic );
+            std::ofstream o( path, std::ios::binary );
+            o.write( reinterpret_cast< const char * >( &h ), sizeof( h ) );
+            if ( ! o )
+                return false;
+        }
+
+        if ( ! map( std::max< uint64_t >( initial_size, boost::filesystem::file_size( file ) ) ) )
+            return false;
+
+    } catch ( std::exception& ex ) {
+        log( log::ERR ) << boost::format( "library %1%: %2%" ) % path % ex.what();
+        region_.reset();
+        file_.reset();
+        return false;
+    }
+
+    auto h = static_cast< const file_header * >( region_->get_address() );
+    if ( std::memcmp( h->magic, magic, sizeof( magic ) ) != 0 ) {
+        log( log::ERR ) << boost::format( "library %1%: not a protocol library" ) % path;
+        region_.reset();
+        file_.reset();
+        return false;
+    }
+
+    return scan();
+}
+
+// mutex_ must be held; offsets stay valid across a remap, pointers do not
+bool
+library::map( uint64_t size )
+{
+    using namespace boost::interprocess;
+
+    region_.reset();
+    file_.reset();
+
+    if ( boost::filesystem::file_size( path_ ) < size )
+        boost::filesystem::resize_file( path_, size );
+
+    file_.reset( new file_mapping( path_.c_str(), read_write ) );
+    region_.reset( new mapped_region( *file_, read_write ) );
+
+    return true;
+}
+
+bool
+library::reserve( uint64_t bytes )
+{
+    auto h = static_cast< const file_header * >( region_->get_address() );
+    if ( h->used + bytes <= region_->get_size() )
+        return true;
+
+    try {
+        region_->flush();
+        return map( std::max< uint64_t >( region_->get_size() * 2, h->used + bytes ) );
+    } catch ( std::exception& ex ) {
+        log( log::ERR ) << boost::format( "library %1%: %2%" ) % path_ % ex.what();
+    }
+    return false;
+}
+
+bool
+library::scan()
+{
+    auto base = static_cast< const char * >( region_->get_address() );
+    auto h = reinterpret_cast< const file_header * >( base );
+    uint64_t used = std::min< uint64_t >( h->used, region_->get_size() );
+
+    uint64_t offset = sizeof( file_header );
+    while ( offset + sizeof( record_header ) <= used ) {
+        auto rec = reinterpret_cast< const record_header * >( base + offset );
+        if ( offset + record_size( rec->count ) > used )
+            break; // torn write at the tail; everything before it is intact
+        std::string name( rec->name, strnlen( rec->name, name_size ) );
+        if ( ! name.empty() )
+            index_[ name ].push_back( offset );
+        else
+            slots_.push_back( offset );
+        offset += record_size( rec->count );
+    }
+
+    if ( offset != h->used ) {
+        log( log::WARN ) << boost::format( "library %1%: truncated at %2% of %3% bytes" ) % path_ % offset % h->used;
+        static_cast< file_header * >( region_->get_address() )->used = offset;
+    }
+    return true;
+}
+
+uint64_t
+library::append( const std::string& name, uint32_t version, const protocols<>& p )
+{
+    const uint32_t count = uint32_t( p.size() );
+
+    if ( ! reserve( record_size( count ) ) )
+        return 0;
+
+    auto h = static_cast< file_header * >( region_->get_address() );
+    uint64_t offset = h->used;
+
+    auto rec = reinterpret_cast< record_header * >( static_cast< char * >( region_->get_address() ) + offset );
+    std::memset( rec, 0, sizeof( record_header ) );
+    rec->count = count;
+    write( offset, name, version, p );
+
+    h->used = offset + record_size( count ); // publish after the record is complete
+    region_->flush();
+
+    return offset;
+}
+
+// the record at offset has room for p.size() tables
+void
+library::write( uint64_t offset, const std::string& name, uint32_t version, const protocols<>& p )
+{
+    auto rec = reinterpret_cast< record_header * >( static_cast< char * >( region_->get_address() ) + offset );
+    std::fill( std::begin( rec->name ), std::end( rec->name ), 0 );
+    std::copy( name.begin(), name.end(), rec->name );
+    rec->version = version;
+    rec->used = uint32_t( p.size() );
+    rec->interval = p.interval_ticks();
+    rec->saved = std::chrono::duration_cast< std::chrono::seconds >( std::chrono::system_clock::now().time_since_epoch() ).count();
+    rec->state = p.state();
+
+    auto table = reinterpret_cast< pulse_table * >( rec + 1 );
+    for ( const auto& protocol: p ) {
+        std::copy( protocol.delay_ticks().begin(), protocol.delay_ticks().end(), table->delay );
+        std::copy( protocol.width_ticks().begin(), protocol.width_ticks().end(), table->width );
+        table->polarities = protocol.polarities();
+        table->states = protocol.states();
+        ++table;
+    }
+}
+
+// a whole record at offset lies within the used part of the mapping
+bool
+library::readable( uint64_t offset ) const
+{
+    auto base = static_cast< const char * >( region_->get_address() );
+    uint64_t used = std::min< uint64_t >( reinterpret_cast< const file_header * >( base )->used, region_->get_size() );
+
+    if ( offset < sizeof( file_header ) || offset > used || used - offset < sizeof( record_header ) )
+        return false;
+    auto rec = reinterpret_cast< const record_header * >( base + offset );
+    return rec->used <= rec->count && record_size( rec->count ) <= used - offset;
+}
+
+// offset must be readable
+protocols<>
+library::read( uint64_t offset ) const
+{
+    auto rec = reinterpret_cast< const record_header * >( static_cast< const char * >( region_->get_address() ) + offset );
+    auto table = reinterpret_cast< const pulse_table * >( rec + 1 );
+
+    protocols<> p;
+    p.setIntervalTicks( rec->interval );
+    p.setState( rec->state );
+    p.resize( rec->used && rec->used <= rec->count ? rec->used : rec->count );
+    for ( auto& protocol: p ) {
+        protocol.assign( table->delay, table->width, table->polarities, table->states );
+        ++table;
+    }
+    return p;
+}
+
+// 0 if there is none, or the header points outside the records
+uint64_t
+library::active_offset() const
+{
+    uint64_t active = static_cast< const file_header * >( region_->get_address() )->active;
+    if ( active && ! readable( active ) ) {
+        log( log::WARN ) << boost::format( "library %1%: active record at %2% is out of bounds, ignored" ) % path_ % active;
+        return 0;
+    }
+    return active;
+}
+
+// offset of name at version, the latest if version is 0; 0 if there is none
+uint64_t
+library::find( const std::string& name, uint32_t version ) const
+{
+    auto it = index_.find( name );
+    if ( it == index_.end() )
+        return 0;
+
+    auto base = static_cast< const char * >( region_->get_address() );
+    for ( auto offset = it->second.rbegin(); offset != it->second.rend(); ++offset ) {
+        if ( version == 0 || reinterpret_cast< const record_header * >( base + *offset )->version == version )
+            return *offset;
+    }
+    return 0;
+}
+
+uint32_t
+library::save( const std::string& name, const protocols<>& p )
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+
+    if ( ! region_ || name.empty() || name.size() >= name_size || p.size() == 0 )
+        return 0;
+
+    auto& versions = index_[ name ];
+    uint32_t version = 1;
+    if ( ! versions.empty() )
+        version = reinterpret_cast< const record_header * >(
+            static_cast< const char * >( region_->get_address() ) + versions.back() )->version + 1;
+
+    if ( uint64_t offset = append( name, version, p ) ) {
+        versions.push_back( offset );
+        return version;
+    }
+    if ( versions.empty() )
+        index_.erase( name );
+    return 0;
+}
+
+boost::optional< protocols<> >
+library::load( const std::string& name, uint32_t version )
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+
+    if ( region_ ) {
+        if ( auto offset = find( name, version ) )
+            return read( offset );
+    }
+    return boost::none;
+}
+
+bool
+library::activate( const protocols<>& p, const std::string& name, uint32_t version )
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+
+    if ( ! region_ || p.size() == 0 )
+        return false;
+
+    auto h = static_cast< file_header * >( region_->get_address() );
+    uint64_t active = active_offset();
+
+    if ( ! name.empty() ) {
+        uint64_t offset = find( name, version );
+        if ( offset && read( offset ) == p ) {
+            h->active = offset;
+            region_->flush();
+            return true;
+        }
+    }
+
+    if ( active && read( active ) == p )
+        return true;
+
+    // the older of the two slots in use, unless the header points at it or it is too small
+    uint64_t slot = 0;
+    for ( size_t i = slots_.size() > 2 ? slots_.size() - 2 : 0; i < slots_.size() && ! slot; ++i ) {
+        auto rec = reinterpret_cast< const record_header * >( static_cast< const char * >( region_->get_address() ) + slots_[ i ] );
+        if ( slots_[ i ] != active && rec->count >= p.size() )
+            slot = slots_[ i ];
+    }
+
+    if ( slot ) {
+        write( slot, "", 0, p );
+        region_->flush(); // the slot is complete before the header points at it
+    } else if ( ( slot = append( "", 0, p ) ) ) {
+        slots_.push_back( slot ); // the table count grew past both slots
+    } else {
+        return false;
+    }
+
+    static_cast< file_header * >( region_->get_address() )->active = slot; // append may have remapped
+    region_->flush();
+    return true;
+}
+
+boost::optional< protocols<> >
+library::active() const
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+
+    if ( region_ ) {
+        if ( auto offset = active_offset() )
+            return read( offset );
+    }
+    return boost::none;
+}
+
+std::vector< library::entry >
+library::list() const
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+
+    std::vector< entry > entries;
+    if ( ! region_ )
+        return entries;
+
+    auto base = static_cast< const char * >( region_->get_address() );
+    auto active = active_offset();
+
+    for ( const auto& item: index_ ) {
+        auto rec = reinterpret_cast< const record_header * >( base + item.second.back() );
+        bool is_active = std::find( item.second.begin(), item.second.end(), active ) != item.second.end();
+        entries.push_back( { item.first, rec->version, rec->saved, is_active } );
+    }
+    return entries;
+}
+
+void
+library::write_json( std::ostream& o ) const
+{
+    boost::property_tree::ptree pt, items;
+
+    for ( const auto& e: list() ) {
+        boost::property_tree::ptree item;
+        item.put( "name", e.name );
+        item.put( "version", e.version );
+        item.put( "saved", e.saved );
+        item.put( "active", e.active );
+        items.push_back( std::make_pair( "", item ) );
+    }
+    pt.add_child( "library", items );
+
+    boost::property_tree::write_json( o, pt );
+}
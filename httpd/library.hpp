@@ -0,0 +1,102 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include "dgprotocols.hpp"
+#include <boost/optional.hpp>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace boost { namespace interprocess { class file_mapping; class mapped_region; } }
+
+namespace dg {
+
+    // Named, versioned protocol tables in an append-only binary file that is
+    // mapped into memory.  Records hold device ticks and masks in the layout of
+    // dg::protocol, so recalling an entry is a copy, not a parse.  The one
+    // exception to append-only is the pair of unnamed slots the active table is
+    // written to in turn.
+    class library {
+        library();
+    public:
+        ~library();
+        static library * instance();
+
+        bool open( const std::string& path );
+        bool is_open() const;
+
+        struct entry {
+            std::string name;
+            uint32_t version;   // latest
+            int64_t saved;      // seconds since epoch
+            bool active;
+        };
+
+        std::vector< entry > list() const;
+
+        // appends a new version of name; returns the version number or 0 on error
+        uint32_t save( const std::string& name, const protocols<>& );
+
+        // latest version if version is 0
+        boost::optional< protocols<> > load( const std::string& name, uint32_t version = 0 );
+
+        // record the table the device was last committed with, restored at boot.
+        // A table loaded from name (version as for load) becomes the active entry;
+        // any other is written to the unnamed slot the header does not point at, so
+        // a torn write leaves the previous active table intact
+        bool activate( const protocols<>&, const std::string& name = std::string(), uint32_t version = 0 );
+        boost::optional< protocols<> > active() const;
+
+        void write_json( std::ostream& ) const;
+
+        static constexpr size_t name_size = 56;
+
+    private:
+        mutable std::mutex mutex_;
+        std::string path_;
+        std::unique_ptr< boost::interprocess::file_mapping > file_;
+        std::unique_ptr< boost::interprocess::mapped_region > region_;
+        std::map< std::string, std::vector< uint64_t > > index_; // record offsets by name, oldest first
+        std::vector< uint64_t > slots_; // unnamed record offsets, oldest first; the last two are in use
+
+        bool map( uint64_t size );
+        bool reserve( uint64_t bytes );
+        bool scan();
+        uint64_t append( const std::string& name, uint32_t version, const protocols<>& );
+        void write( uint64_t offset, const std::string& name, uint32_t version, const protocols<>& );
+        bool readable( uint64_t offset ) const;
+        protocols<> read( uint64_t offset ) const;
+        uint64_t find( const std::string& name, uint32_t version ) const;
+        uint64_t active_offset() const;
+    };
+
+}
@@ -0,0 +1,308 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+// libusb-1.0 API subset over dg::arp_simulator.  Transfers complete in submission order
+// per endpoint once the simulated latency has elapsed; an IN transfer waits for a reply
+// until its timeout.  A timerfd due at the next completion is the only pollfd, so
+// usb_reactor integrates the simulated device exactly like the real one.
+
+#include "libusb_mock.hpp"
+#include "arp_simulator.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <list>
+#include <mutex>
+#include <set>
+#include <vector>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace {
+
+    typedef std::chrono::steady_clock clock_type;
+
+    class engine {
+    public:
+        static engine& instance() {
+            static engine __instance;
+            return __instance;
+        }
+
+        engine() : timerfd_( timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC ) ) {
+            pollfd_.fd = timerfd_;
+            pollfd_.events = POLLIN;
+        }
+
+        ~engine() {
+            ::close( timerfd_ );
+        }
+
+        int submit( libusb_transfer * t ) {
+            std::lock_guard< std::mutex > lock( mutex_ );
+            auto now = clock_type::now();
+            auto due = now + std::chrono::duration_cast< clock_type::duration >( dg::arp_simulator::instance()->latency( t->length ) );
+            auto deadline = t->timeout ? due + std::chrono::milliseconds( t->timeout ) : clock_type::time_point::max();
+            queue_.push_back( entry{ t, due, deadline, false } );
+            rearm();
+            return LIBUSB_SUCCESS;
+        }
+
+        int cancel( libusb_transfer * t ) {
+            std::lock_guard< std::mutex > lock( mutex_ );
+            auto it = std::find_if( queue_.begin(), queue_.end(), [t]( const entry& e ){ return e.t == t; } );
+            if ( it == queue_.end() )
+                return LIBUSB_ERROR_NOT_FOUND;
+            it->cancelled = true;
+            it->due = clock_type::now();
+            rearm();
+            return LIBUSB_SUCCESS;
+        }
+
+        // wait up to timeout for the next completion, then run the callbacks of all completed transfers
+        int handle_events( std::chrono::microseconds timeout, int * completed ) {
+            if ( completed && *completed )
+                return LIBUSB_SUCCESS;
+
+            pollfd pfd = { timerfd_, POLLIN, 0 };
+            ::poll( &pfd, 1, int( ( timeout.count() + 999 ) / 1000 ) );
+
+            uint64_t expirations;
+            while ( ::read( timerfd_, &expirations, sizeof( expirations ) ) > 0 )
+                ;
+
+            std::vector< libusb_transfer * > done;
+            do {
+                std::lock_guard< std::mutex > lock( mutex_ );
+                process( done );
+                rearm();
+            } while ( 0 );
+
+            for ( auto t: done )
+                t->callback( t );
+
+            return LIBUSB_SUCCESS;
+        }
+
+        libusb_pollfd pollfd_;
+
+    private:
+        struct entry {
+            libusb_transfer * t;
+            clock_type::time_point due;
+            clock_type::time_point deadline;
+            bool cancelled;
+        };
+
+        std::mutex mutex_;
+        std::list< entry > queue_;
+        int timerfd_;
+
+        static libusb_transfer_status status( int rc ) {
+            switch ( rc ) {
+            case dg::arp_simulator::success:         return LIBUSB_TRANSFER_COMPLETED;
+            case dg::arp_simulator::error_timeout:   return LIBUSB_TRANSFER_TIMED_OUT;
+            case dg::arp_simulator::error_pipe:      return LIBUSB_TRANSFER_STALL;
+            case dg::arp_simulator::error_no_device: return LIBUSB_TRANSFER_NO_DEVICE;
+            default:                                 return LIBUSB_TRANSFER_ERROR;
+            }
+        }
+
+        void process( std::vector< libusb_transfer * >& done ) {
+            auto sim = dg::arp_simulator::instance();
+            bool progress = true;
+            while ( progress ) {
+                progress = false;
+                auto now = clock_type::now();
+                std::set< unsigned char > blocked; // endpoints with an earlier transfer still queued
+                for ( auto it = queue_.begin(); it != queue_.end(); ) {
+                    libusb_transfer * t = it->t;
+                    if ( it->cancelled ) {
+                        t->status = LIBUSB_TRANSFER_CANCELLED;
+                        t->actual_length = 0;
+                    } else if ( blocked.count( t->endpoint ) || it->due > now
+                                || ( ( t->endpoint & 0x80 ) && !sim->readable( t->endpoint ) && now < it->deadline ) ) {
+                        blocked.insert( t->endpoint );
+                        ++it;
+                        continue;
+                    } else {
+                        int transferred = 0;
+                        t->status = status( sim->transfer( t->endpoint, t->buffer, t->length, transferred ) );
+                        t->actual_length = transferred;
+                    }
+                    done.push_back( t );
+                    it = queue_.erase( it );
+                    progress = true;
+                }
+            }
+        }
+
+        void rearm() {
+            auto next = clock_type::time_point::max();
+            auto now = clock_type::now();
+            auto sim = dg::arp_simulator::instance();
+            for ( const auto& e: queue_ ) {
+                if ( e.cancelled || e.due > now )
+                    next = std::min( next, e.due );
+                else if ( ( e.t->endpoint & 0x80 ) && !sim->readable( e.t->endpoint ) )
+                    next = std::min( next, e.deadline ); // waiting for a reply
+                else
+                    next = std::min( next, now );
+            }
+
+            itimerspec spec = {};
+            if ( next != clock_type::time_point::max() ) {
+                auto ns = std::max( std::chrono::duration_cast< std::chrono::nanoseconds >( next - now ).count(), 1L );
+                spec.it_value.tv_sec = ns / 1000000000;
+                spec.it_value.tv_nsec = ns % 1000000000;
+            }
+            timerfd_settime( timerfd_, 0, &spec, nullptr );
+        }
+    };
+
+    void sync_callback( libusb_transfer * t )
+    {
+        *reinterpret_cast< int * >( t->user_data ) = 1;
+    }
+}
+
+extern "C" {
+
+const char *
+libusb_error_name( int code )
+{
+    switch ( code ) {
+    case LIBUSB_SUCCESS:             return "LIBUSB_SUCCESS";
+    case LIBUSB_ERROR_IO:            return "LIBUSB_ERROR_IO";
+    case LIBUSB_ERROR_INVALID_PARAM: return "LIBUSB_ERROR_INVALID_PARAM";
+    case LIBUSB_ERROR_ACCESS:        return "LIBUSB_ERROR_ACCESS";
+    case LIBUSB_ERROR_NO_DEVICE:     return "LIBUSB_ERROR_NO_DEVICE";
+    case LIBUSB_ERROR_NOT_FOUND:     return "LIBUSB_ERROR_NOT_FOUND";
+    case LIBUSB_ERROR_BUSY:          return "LIBUSB_ERROR_BUSY";
+    case LIBUSB_ERROR_TIMEOUT:       return "LIBUSB_ERROR_TIMEOUT";
+    case LIBUSB_ERROR_OVERFLOW:      return "LIBUSB_ERROR_OVERFLOW";
+    case LIBUSB_ERROR_PIPE:          return "LIBUSB_ERROR_PIPE";
+    case LIBUSB_ERROR_INTERRUPTED:   return "LIBUSB_ERROR_INTERRUPTED";
+    case LIBUSB_ERROR_NO_MEM:        return "LIBUSB_ERROR_NO_MEM";
+    case LIBUSB_ERROR_NOT_SUPPORTED: return "LIBUSB_ERROR_NOT_SUPPORTED";
+    default:                         return "LIBUSB_ERROR_OTHER";
+    }
+}
+
+int
+libusb_bulk_transfer( libusb_device_handle * handle, unsigned char endpoint, unsigned char * data, int length
+                      , int * transferred, unsigned int timeout )
+{
+    int completed = 0;
+    libusb_transfer * t = libusb_alloc_transfer( 0 );
+    libusb_fill_bulk_transfer( t, handle, endpoint, data, length, &sync_callback, &completed, timeout );
+    libusb_submit_transfer( t );
+    while ( !completed )
+        libusb_handle_events_completed( nullptr, &completed );
+
+    *transferred = t->actual_length;
+    int rc = LIBUSB_ERROR_IO;
+    switch ( t->status ) {
+    case LIBUSB_TRANSFER_COMPLETED: rc = LIBUSB_SUCCESS; break;
+    case LIBUSB_TRANSFER_TIMED_OUT: rc = LIBUSB_ERROR_TIMEOUT; break;
+    case LIBUSB_TRANSFER_STALL:     rc = LIBUSB_ERROR_PIPE; break;
+    case LIBUSB_TRANSFER_NO_DEVICE: rc = LIBUSB_ERROR_NO_DEVICE; break;
+    case LIBUSB_TRANSFER_OVERFLOW:  rc = LIBUSB_ERROR_OVERFLOW; break;
+    default: break;
+    }
+    libusb_free_transfer( t );
+    return rc;
+}
+
+libusb_transfer *
+libusb_alloc_transfer( int )
+{
+    return new libusb_transfer();
+}
+
+void
+libusb_free_transfer( libusb_transfer * t )
+{
+    delete t;
+}
+
+int
+libusb_submit_transfer( libusb_transfer * t )
+{
+    return engine::instance().submit( t );
+}
+
+int
+libusb_cancel_transfer( libusb_transfer * t )
+{
+    return engine::instance().cancel( t );
+}
+
+void
+libusb_set_pollfd_notifiers( libusb_context *, libusb_pollfd_added_cb, libusb_pollfd_removed_cb, void * )
+{
+    // the timerfd is the only pollfd and never changes
+}
+
+const libusb_pollfd **
+libusb_get_pollfds( libusb_context * )
+{
+    auto fds = static_cast< const libusb_pollfd ** >( std::calloc( 2, sizeof( libusb_pollfd * ) ) );
+    fds[ 0 ] = &engine::instance().pollfd_;
+    return fds;
+}
+
+void
+libusb_free_pollfds( const libusb_pollfd ** fds )
+{
+    std::free( fds );
+}
+
+int
+libusb_pollfds_handle_timeouts( libusb_context * )
+{
+    return 1;
+}
+
+int
+libusb_get_next_timeout( libusb_context *, timeval * )
+{
+    return 0;
+}
+
+int
+libusb_handle_events_timeout_completed( libusb_context *, timeval * tv, int * completed )
+{
+    return engine::instance().handle_events( std::chrono::seconds( tv->tv_sec ) + std::chrono::microseconds( tv->tv_usec ), completed );
+}
+
+int
+libusb_handle_events_completed( libusb_context *, int * completed )
+{
+    return engine::instance().handle_events( std::chrono::seconds( 60 ), completed );
+}
+
+}
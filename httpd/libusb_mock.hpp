@@ -0,0 +1,132 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#pragma once
+
+// The subset of the libusb-1.0 API used by arpproxy and usb_reactor, implemented by
+// libusb_mock.cpp on top of dg::arp_simulator for builds without libusb (HAS_LIBUSB off).
+// Names, values and structure members follow <libusb-1.0/libusb.h>.
+
+#include <cstdint>
+#include <sys/time.h>
+
+extern "C" {
+
+    struct libusb_context;
+    struct libusb_device;
+    struct libusb_device_handle;
+
+    enum libusb_error {
+        LIBUSB_SUCCESS = 0
+        , LIBUSB_ERROR_IO = -1
+        , LIBUSB_ERROR_INVALID_PARAM = -2
+        , LIBUSB_ERROR_ACCESS = -3
+        , LIBUSB_ERROR_NO_DEVICE = -4
+        , LIBUSB_ERROR_NOT_FOUND = -5
+        , LIBUSB_ERROR_BUSY = -6
+        , LIBUSB_ERROR_TIMEOUT = -7
+        , LIBUSB_ERROR_OVERFLOW = -8
+        , LIBUSB_ERROR_PIPE = -9
+        , LIBUSB_ERROR_INTERRUPTED = -10
+        , LIBUSB_ERROR_NO_MEM = -11
+        , LIBUSB_ERROR_NOT_SUPPORTED = -12
+        , LIBUSB_ERROR_OTHER = -99
+    };
+
+    enum libusb_transfer_status {
+        LIBUSB_TRANSFER_COMPLETED
+        , LIBUSB_TRANSFER_ERROR
+        , LIBUSB_TRANSFER_TIMED_OUT
+        , LIBUSB_TRANSFER_CANCELLED
+        , LIBUSB_TRANSFER_STALL
+        , LIBUSB_TRANSFER_NO_DEVICE
+        , LIBUSB_TRANSFER_OVERFLOW
+    };
+
+    enum libusb_hotplug_event {
+        LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED = 0x01
+        , LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT = 0x02
+    };
+
+    enum { LIBUSB_TRANSFER_TYPE_BULK = 2 };
+
+    struct libusb_transfer;
+    typedef void ( *libusb_transfer_cb_fn )( libusb_transfer * );
+
+    struct libusb_transfer {
+        libusb_device_handle * dev_handle;
+        uint8_t flags;
+        unsigned char endpoint;
+        unsigned char type;
+        unsigned int timeout;
+        libusb_transfer_status status;
+        int length;
+        int actual_length;
+        libusb_transfer_cb_fn callback;
+        void * user_data;
+        unsigned char * buffer;
+        int num_iso_packets;
+    };
+
+    struct libusb_pollfd {
+        int fd;
+        short events;
+    };
+
+    typedef void ( *libusb_pollfd_added_cb )( int fd, short events, void * user_data );
+    typedef void ( *libusb_pollfd_removed_cb )( int fd, void * user_data );
+
+    const char * libusb_error_name( int );
+
+    int libusb_bulk_transfer( libusb_device_handle *, unsigned char endpoint, unsigned char * data, int length
+                              , int * transferred, unsigned int timeout );
+
+    libusb_transfer * libusb_alloc_transfer( int iso_packets );
+    void libusb_free_transfer( libusb_transfer * );
+    int libusb_submit_transfer( libusb_transfer * );
+    int libusb_cancel_transfer( libusb_transfer * );
+
+    void libusb_set_pollfd_notifiers( libusb_context *, libusb_pollfd_added_cb, libusb_pollfd_removed_cb, void * user_data );
+    const libusb_pollfd ** libusb_get_pollfds( libusb_context * );
+    void libusb_free_pollfds( const libusb_pollfd ** );
+    int libusb_pollfds_handle_timeouts( libusb_context * );
+    int libusb_get_next_timeout( libusb_context *, timeval * );
+
+    int libusb_handle_events_timeout_completed( libusb_context *, timeval *, int * completed );
+    int libusb_handle_events_completed( libusb_context *, int * completed );
+
+    static inline void libusb_fill_bulk_transfer( libusb_transfer * transfer, libusb_device_handle * dev_handle
+                                                  , unsigned char endpoint, unsigned char * buffer, int length
+                                                  , libusb_transfer_cb_fn callback, void * user_data, unsigned int timeout ) {
+        transfer->dev_handle = dev_handle;
+        transfer->endpoint = endpoint;
+        transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+        transfer->timeout = timeout;
+        transfer->buffer = buffer;
+        transfer->length = length;
+        transfer->user_data = user_data;
+        transfer->callback = callback;
+    }
+}
@@ -15,8 +15,15 @@
 #include "config.h"
 #include "log.hpp"
 #include "bnc565.hpp"
+#include "library.hpp"
+#include "reactor.hpp"
+#include "registry.hpp"
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/program_options.hpp>
 #include <boost/filesystem/path.hpp>
@@ -43,14 +50,29 @@ main(int argc, char* argv[])
             ( "help", "print help message" )
             ( "version", "print version number" )
             ( "tty",  po::value<std::string>()->default_value("/dev/ttyUSB0"), "tty device name" )
+            ( "device", po::value< std::vector< std::string > >()->composing(), "delay generator as id=tty, repeatable; replaces --tty, the first one is the default" )
             ( "baud", po::value<int>()->default_value(4800), "baud rate" )
             ( "port", po::value<std::string>()->default_value("8080"), "http port number" )
             ( "recv", po::value<std::string>()->default_value("0.0.0.0"), "For IPv4, try 0.0.0.0, IPv6, try 0::0" )
             ( "doc_root", po::value<std::string>()->default_value( DOC_ROOT ), "document root" )
+            ( "threads", po::value<size_t>()->default_value( 4 ), "http server thread pool size" )
+            ( "max-connections", po::value<size_t>()->default_value( http::server::server::default_max_connections ), "clients served at a time, others get 503" )
+            ( "single-thread", "run http, serial i/o and timers on one io_service in the main thread" )
+            ( "cpu", po::value<std::string>(), "cpu list for the serial reader thread, e.g. 2 or 2-3; with --single-thread, the daemon (default 0)" )
+            ( "rt-priority", po::value<int>()->default_value( 0 ), "SCHED_FIFO priority for the serial reader thread (1-99, 0: normal); with --single-thread, the daemon" )
+            ( "mlock", "lock all pages in memory" )
+            ( "tick-rate", po::value<double>()->default_value( 1.0 ), "SSE tick rate (Hz)" )
+            ( "fetch-window", po::value<int>()->default_value( 200 ), "status fetch freshness window (ms)" )
+            ( "verify", "read every commit back and re-send the fields the device reports differently" )
+            ( "library", po::value<std::string>()->default_value( LIBRARY_FILE ), "protocol library file" )
+            ( "no-restore", "do not restore the last committed protocol at startup" )
             ( "verbose", po::value<int>()->default_value(0), "verbose level" )
             ( "debug,d", "debug mode" )
             ( "query,q", "query device" )
             ( "reset",   "reset digitizer" )
+            ( "convert", po::value< std::vector< std::string > >()->multitoken(), "convert protocol files: --convert <in> <out> (.json or .xml)" )
+            ( "apply", po::value< std::string >(), "commit a protocol file (.json or .xml) and exit" )
+            ( "dump", po::value< std::string >(), "save the device protocol to a file (.json or .xml) and exit" )
             ;
         po::store( po::command_line_parser( argc, argv ).options( desc ).run(), vm );
         po::notify( vm );
@@ -65,7 +87,67 @@ main(int argc, char* argv[])
 
         __debug_mode__ = vm.count( "debug" ) > 0 ;
 
-        dg::bnc565::instance()->initialize( vm[ "tty" ].as< std::string >(), vm[ "baud" ].as<int>() );
+        if ( vm.count( "convert" ) ) {
+            auto files = vm[ "convert" ].as< std::vector< std::string > >();
+            if ( files.size() != 2 ) {
+                std::cerr << "--convert takes an input and an output file" << std::endl;
+                return 1;
+            }
+            dg::protocols<> protocols;
+            if ( ! dg::protocols<>::load( files[ 0 ], protocols ) ) {
+                std::cerr << "no protocol table in " << files[ 0 ] << std::endl;
+                return 1;
+            }
+            if ( ! dg::protocols<>::save( files[ 1 ], protocols ) ) {
+                std::cerr << "can't write " << files[ 1 ] << std::endl;
+                return 1;
+            }
+            return 0;
+        }
+
+        // before the device singletons are created
+        dg::reactor::thread_policy policy{ vm[ "rt-priority" ].as< int >(), {} };
+        if ( vm.count( "cpu" ) )
+            policy.cpus = dg::reactor::parse_cpus( vm[ "cpu" ].as< std::string >() );
+
+        if ( vm.count( "single-thread" ) ) {
+            dg::reactor::enable();
+            if ( policy.cpus.empty() )
+                policy.cpus.push_back( 0 );
+        }
+        dg::reactor::setThreadPolicy( policy );
+
+        if ( vm.count( "single-thread" ) )
+            dg::reactor::configure_thread(); // main thread runs the device i/o
+        else if ( policy.rt_priority > 0 || ! policy.cpus.empty() )
+            std::cerr << "note: --rt-priority/--cpu apply to reply delivery only; commands are written from the http threads (use --single-thread)" << std::endl;
+
+        if ( vm.count( "mlock" ) )
+            dg::reactor::lock_memory();
+
+        if ( vm[ "tick-rate" ].as< double >() <= 0 || vm[ "tick-rate" ].as< double >() > 1000 ) {
+            std::cerr << "--tick-rate must be in (0, 1000]" << std::endl;
+            return 1;
+        }
+        std::vector< std::string > devices;
+        if ( vm.count( "device" ) )
+            devices = vm[ "device" ].as< std::vector< std::string > >();
+        else
+            devices.push_back( "dg0=" + vm[ "tty" ].as< std::string >() );
+
+        for ( const auto& device: devices ) {
+            auto eq = device.find( '=' );
+            if ( eq == std::string::npos || eq == 0 || device.compare( 0, eq, "all" ) == 0 ) {
+                std::cerr << "--device takes id=tty, id other than 'all': " << device << std::endl;
+                return 1;
+            }
+            auto dg = dg::registry::instance()->add( device.substr( 0, eq ) );
+            dg->setTickPeriod(
+                std::chrono::duration_cast< std::chrono::steady_clock::duration >( std::chrono::duration< double >( 1.0 / vm[ "tick-rate" ].as< double >() ) ) );
+            dg->setFetchFreshness( std::chrono::milliseconds( vm[ "fetch-window" ].as<int>() ) );
+            dg->setVerify( vm.count( "verify" ) > 0 );
+            dg->initialize( device.substr( eq + 1 ), vm[ "baud" ].as<int>() );
+        }
         
         if ( vm.count( "query" ) ) {
             __httpd__ = false;
@@ -76,6 +158,66 @@ main(int argc, char* argv[])
             dg::bnc565::instance()->reset();
         }
 
+        if ( vm.count( "apply" ) || vm.count( "dump" ) ) {
+            __httpd__ = false;
+
+            if ( ! *dg::bnc565::instance() && ! __debug_mode__ ) {
+                std::cerr << "device " << dg::bnc565::instance()->serialDevice() << " is not open" << std::endl;
+                return 1;
+            }
+
+            auto report = [&]( const char * what, const std::string& file, std::chrono::steady_clock::time_point t0, const dg::bnc565::counters& c0 ) {
+                auto c = dg::bnc565::instance()->command_counters();
+                std::cout << boost::format( "%s %s: %.3f s, %d commands, %d retries, %d timeouts, %d re-sent" )
+                    % what % file
+                    % std::chrono::duration< double >( std::chrono::steady_clock::now() - t0 ).count()
+                    % ( c.commands - c0.commands ) % ( c.retries - c0.retries ) % ( c.timeouts - c0.timeouts ) % ( c.resent - c0.resent ) << std::endl;
+            };
+
+            if ( vm.count( "apply" ) ) {
+                auto file = vm[ "apply" ].as< std::string >();
+                auto t0 = std::chrono::steady_clock::now();
+                auto c0 = dg::bnc565::instance()->command_counters();
+
+                dg::protocols<> protocols;
+                if ( ! dg::protocols<>::load( file, protocols ) ) {
+                    std::cerr << "no protocol table in " << file << std::endl;
+                    return 1;
+                }
+                bool applied;
+                if ( devices.size() > 1 ) {
+                    // all devices at once; prints the arm time of each and the skew
+                    auto results = dg::registry::instance()->commit_all( protocols );
+                    dg::registry::write_json( std::cout, results );
+                    std::cout << std::endl;
+                    applied = std::all_of( results.begin(), results.end(), []( const dg::registry::commit_result& r ){ return r.success; } );
+                } else {
+                    // rejected by the validator, or a write the device did not acknowledge
+                    std::vector< dg::validation_error > errors;
+                    if ( ! ( applied = dg::bnc565::instance()->commit( protocols, errors ) ) ) {
+                        dg::validator::write_json( std::cerr, errors );
+                        std::cerr << std::endl;
+                    }
+                }
+                report( applied ? "applied" : "failed to apply", file, t0, c0 );
+                if ( ! applied )
+                    return 1;
+            }
+
+            if ( vm.count( "dump" ) ) {
+                auto file = vm[ "dump" ].as< std::string >();
+                auto t0 = std::chrono::steady_clock::now();
+                auto c0 = dg::bnc565::instance()->command_counters();
+
+                dg::protocols<> protocols;
+                if ( ! dg::bnc565::instance()->fetch( protocols ) || ! dg::protocols<>::save( file, protocols ) ) {
+                    std::cerr << "can't write " << file << std::endl;
+                    return 1;
+                }
+                report( "dumped", file, t0, c0 );
+            }
+        }
+
         if ( __httpd__ ) {        
 
 #if ! defined WIN32
@@ -96,6 +238,21 @@ main(int argc, char* argv[])
             }
 #endif
 
+            // only once this is the one daemon on the device: the restore writes to it
+            if ( ! dg::library::instance()->open( vm[ "library" ].as< std::string >() ) )
+                dg::log( dg::log::WARN ) << boost::format( "protocol library %1% is not available" ) % vm[ "library" ].as< std::string >();
+
+            if ( ! vm.count( "no-restore" ) ) {
+                if ( auto protocols = dg::library::instance()->active() ) {
+                    std::vector< dg::validation_error > errors;
+                    if ( ! dg::bnc565::instance()->commit( protocols.get(), errors ) ) {
+                        std::ostringstream o;
+                        dg::validator::write_json( o, errors );
+                        dg::log( dg::log::ERR ) << boost::format( "active protocol in library not restored: %1%" ) % o.str();
+                    }
+                }
+            }
+
             // Initialise the server.
             dg::log() << boost::format( "started on %1% %2% %3%" )
                 % vm["recv"].as< std::string >()
@@ -104,12 +261,23 @@ main(int argc, char* argv[])
             
             __verbose_level__ = vm["verbose"].as< int >();
             
-            http::server::server s( vm["recv"].as< std::string >().c_str()
-                                    , vm["port"].as< std::string >().c_str()
-                                    , vm["doc_root"].as< std::string >().c_str() );
+            if ( dg::reactor::enabled() ) {
+                http::server::server s( dg::reactor::io_service()
+                                        , vm["recv"].as< std::string >().c_str()
+                                        , vm["port"].as< std::string >().c_str()
+                                        , vm["doc_root"].as< std::string >().c_str()
+                                        , vm["max-connections"].as< size_t >() );
+                s.run();
+            } else {
+                http::server::server s( vm["recv"].as< std::string >().c_str()
+                                        , vm["port"].as< std::string >().c_str()
+                                        , vm["doc_root"].as< std::string >().c_str()
+                                        , vm["threads"].as< size_t >()
+                                        , vm["max-connections"].as< size_t >() );
             
-            // Run the server until stopped.
-            s.run();
+                // Run the server until stopped.
+                s.run();
+            }
         }
         
     }  catch (std::exception& e)  {
@@ -0,0 +1,158 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#include "reactor.hpp"
+#include "log.hpp"
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#if defined __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+using namespace dg;
+
+namespace {
+    std::atomic< bool > __enabled( false );
+    reactor::thread_policy __policy{ 0, {} };
+}
+
+void
+reactor::enable()
+{
+    __enabled = true;
+}
+
+bool
+reactor::enabled()
+{
+    return __enabled;
+}
+
+boost::asio::io_service&
+reactor::io_service()
+{
+    static boost::asio::io_service __io_service( 1 ); // concurrency hint: single thread, no locking
+    return __io_service;
+}
+
+void
+reactor::setThreadPolicy( const thread_policy& policy )
+{
+    __policy = policy;
+}
+
+const reactor::thread_policy&
+reactor::threadPolicy()
+{
+    return __policy;
+}
+
+bool
+reactor::configure_thread()
+{
+    bool result = true;
+
+    if ( !__policy.cpus.empty() )
+        result = pin( __policy.cpus );
+
+    if ( __policy.rt_priority > 0 ) {
+#if defined __linux__
+        sched_param param;
+        param.sched_priority = __policy.rt_priority;
+        if ( int err = pthread_setschedparam( pthread_self(), SCHED_FIFO, &param ) ) {
+            log( log::WARN ) << boost::format( "can't set SCHED_FIFO priority %1%: %2%" ) % __policy.rt_priority % std::strerror( err );
+            result = false;
+        }
+#else
+        log( log::WARN ) << "real-time scheduling is not supported on this platform";
+        result = false;
+#endif
+    }
+    return result;
+}
+
+bool
+reactor::pin( const std::vector< int >& cpus )
+{
+#if defined __linux__
+    cpu_set_t cpuset;
+    CPU_ZERO( &cpuset );
+    for ( auto cpu: cpus )
+        CPU_SET( cpu, &cpuset );
+    if ( int err = pthread_setaffinity_np( pthread_self(), sizeof( cpuset ), &cpuset ) ) {
+        log( log::WARN ) << boost::format( "can't set cpu affinity: %1%" ) % std::strerror( err );
+        return false;
+    }
+    return true;
+#else
+    log( log::WARN ) << "cpu affinity is not supported on this platform";
+    return false;
+#endif
+}
+
+bool
+reactor::lock_memory()
+{
+#if defined __linux__
+    if ( mlockall( MCL_CURRENT | MCL_FUTURE ) != 0 ) {
+        log( log::WARN ) << boost::format( "mlockall: %1%" ) % std::strerror( errno );
+        return false;
+    }
+    return true;
+#else
+    log( log::WARN ) << "memory locking is not supported on this platform";
+    return false;
+#endif
+}
+
+std::vector< int >
+reactor::parse_cpus( const std::string& list )
+{
+    std::vector< std::string > items;
+    boost::split( items, list, boost::is_any_of( "," ) );
+
+    std::vector< int > cpus;
+    for ( const auto& item: items ) {
+        if ( item.empty() )
+            continue;
+        auto dash = item.find( '-' );
+        int first = boost::lexical_cast< int >( item.substr( 0, dash ) );
+        int last = dash == std::string::npos ? first : boost::lexical_cast< int >( item.substr( dash + 1 ) );
+        if ( first < 0 || last < first || last >= 1024 ) // CPU_SETSIZE
+            throw std::invalid_argument( "invalid cpu list: " + list );
+        for ( int cpu = first; cpu <= last; ++cpu )
+            cpus.push_back( cpu );
+    }
+    return cpus;
+}
@@ -0,0 +1,68 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#pragma once
+
+#include <boost/asio.hpp>
+#include <string>
+#include <vector>
+
+namespace dg {
+
+    // Opt-in single threaded daemon: the http acceptor, the serial port, the timers and
+    // the usb polling all share one io_service, run on the main thread.  Must be enabled
+    // before the first bnc565::instance() call; device i/o is then completed on the
+    // calling thread instead of waiting for a reader thread.
+    // Also holds the scheduling policy for whichever thread runs the device i/o.  Without
+    // enable() that is only the serial reader, i.e. reply delivery: commands are written
+    // from the http pool threads, which keep the default policy.
+    class reactor {
+    public:
+        static void enable();
+        static bool enabled();
+
+        static boost::asio::io_service& io_service();
+
+        struct thread_policy {
+            int rt_priority;          // SCHED_FIFO priority, 0 for the default policy
+            std::vector< int > cpus;  // affinity, empty for any cpu
+        };
+        static void setThreadPolicy( const thread_policy& );
+        static const thread_policy& threadPolicy();
+
+        // apply the thread policy to the calling thread
+        static bool configure_thread();
+
+        // bind the calling thread to a set of cpus
+        static bool pin( const std::vector< int >& cpus );
+
+        // mlockall; page faults on the command path are avoided
+        static bool lock_memory();
+
+        // "0,2-3" -> { 0, 2, 3 }; throws on a malformed list
+        static std::vector< int > parse_cpus( const std::string& );
+    };
+
+}
@@ -0,0 +1,322 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#include "registry.hpp"
+#include "bnc565.hpp"
+#include "dgctl.hpp"
+#include "log.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <sstream>
+#include <thread>
+
+using namespace dg;
+
+registry::registry()
+{
+}
+
+registry::~registry()
+{
+    // controllers are connected to their devices' signals
+    for ( auto& d: devices_ )
+        d->ctl.reset();
+}
+
+registry *
+registry::instance()
+{
+    static registry __instance;
+    return &__instance;
+}
+
+registry::device *
+registry::lookup( const std::string& id ) const
+{
+    auto it = std::find_if( devices_.begin(), devices_.end(), [&]( const std::unique_ptr< device >& d ){ return d->id == id; } );
+    return it != devices_.end() ? it->get() : nullptr;
+}
+
+bnc565 *
+registry::add( const std::string& id )
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+
+    if ( auto d = lookup( id ) )
+        return d->dg.get();
+
+    std::unique_ptr< device > d( new device{ id, std::unique_ptr< bnc565 >( new bnc565() ), nullptr } );
+    d->ctl.reset( new dgctl( *d->dg, devices_.empty() ? std::string() : id ) );
+    devices_.push_back( std::move( d ) );
+
+    return devices_.back()->dg.get();
+}
+
+bnc565 *
+registry::find( const std::string& id ) const
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+    auto d = lookup( id );
+    return d ? d->dg.get() : nullptr;
+}
+
+dgctl *
+registry::controller( const std::string& id ) const
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+    auto d = lookup( id );
+    return d ? d->ctl.get() : nullptr;
+}
+
+const std::string&
+registry::default_id()
+{
+    do {
+        std::lock_guard< std::mutex > lock( mutex_ );
+        if ( !devices_.empty() )
+            return devices_.front()->id;
+    } while ( 0 );
+    add( "dg0" );
+    return devices_.front()->id;
+}
+
+std::vector< std::string >
+registry::ids() const
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+    std::vector< std::string > ids;
+    for ( const auto& d: devices_ )
+        ids.push_back( d->id );
+    return ids;
+}
+
+namespace {
+
+    // releases all waiters at once when the last of 'count' arrives
+    class barrier {
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        size_t count_;
+        size_t waiting_;
+        std::chrono::steady_clock::time_point released_;
+    public:
+        barrier( size_t count ) : count_( count ), waiting_( 0 ) {}
+
+        void wait() {
+            std::unique_lock< std::mutex > lock( mutex_ );
+            if ( ++waiting_ == count_ ) {
+                released_ = std::chrono::steady_clock::now();
+                cond_.notify_all();
+            }
+            cond_.wait( lock, [&]{ return waiting_ >= count_; } );
+        }
+
+        std::chrono::steady_clock::time_point released() const { return released_; }
+    };
+
+    template< typename F >
+    void parallel( size_t n, F f ) {
+        std::vector< std::thread > threads;
+        for ( size_t i = 0; i < n; ++i )
+            threads.emplace_back( [&f, i]{ f( i ); } );
+        for ( auto& t: threads )
+            t.join();
+    }
+}
+
+std::vector< registry::commit_result >
+registry::commit_all( const protocols<>& protocols )
+{
+    typedef std::chrono::steady_clock clock;
+
+    std::vector< std::pair< std::string, bnc565 * > > targets;
+    do {
+        std::lock_guard< std::mutex > lock( mutex_ );
+        for ( const auto& d: devices_ )
+            targets.emplace_back( d->id, d->dg.get() );
+    } while ( 0 );
+
+    std::vector< commit_result > results( targets.size() );
+    for ( size_t i = 0; i < targets.size(); ++i )
+        results[ i ] = commit_result{ targets[ i ].first, false, false, false, {}, {}, {}, {} };
+
+    // phase 1: trigger off, download and read back
+    auto t0 = clock::now();
+    std::vector< char > staged( targets.size(), 0 );
+    parallel( targets.size(), [&]( size_t i ){
+            auto& r = results[ i ];
+            staged[ i ] = targets[ i ].second->stage( protocols, r.errors, r.off );
+            r.staged = clock::now() - t0;
+        });
+
+    if ( std::find( staged.begin(), staged.end(), 0 ) != staged.end() ) {
+        size_t off = std::count_if( results.begin(), results.end(), []( const commit_result& r ){ return r.off; } );
+        std::string not_off;
+        for ( const auto& r: results )
+            if ( !r.off )
+                not_off += ( not_off.empty() ? "" : ", " ) + r.id;
+        log( log::WARN ) << boost::format( "commit to all devices: staging failed, %1% of %2% unit(s) left with the trigger off%3%" )
+            % off % targets.size() % ( not_off.empty() ? std::string() : "; not switched off: " + not_off );
+        return results;
+    }
+
+    // phase 2: every unit owns its serial line before the barrier opens
+    barrier ready( targets.size() );
+    parallel( targets.size(), [&]( size_t i ){
+            clock::time_point sent, acked;
+            auto& r = results[ i ];
+            r.success = targets[ i ].second->arm( [&]{ ready.wait(); }, sent, acked );
+            r.sent = sent - ready.released();
+            r.acked = acked - ready.released();
+        });
+
+    size_t armed = std::count_if( results.begin(), results.end(), []( const commit_result& r ){ return r.success; } );
+    if ( armed == targets.size() )
+        return results;
+
+    // no unit may fire the new table while another does not; a failed arm may still have
+    // switched its unit on, so every trigger goes off again, ahead of anything else on the line
+    parallel( targets.size(), [&]( size_t i ){
+            std::string reply;
+            auto& r = results[ i ];
+            r.reverted = r.success;
+            r.success = false;
+            r.off = targets[ i ].second->switch_connect( false, reply );
+        });
+
+    size_t off = std::count_if( results.begin(), results.end(), []( const commit_result& r ){ return r.off; } );
+    log( log::WARN ) << boost::format( "commit to all devices: %1% of %2% unit(s) armed, all switched back off; %3% acknowledged" )
+        % armed % targets.size() % off;
+
+    return results;
+}
+
+void
+registry::write_json( std::ostream& o, const std::vector< commit_result >& results )
+{
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    bool armed = !results.empty() && std::all_of( results.begin(), results.end(), []( const commit_result& r ){ return r.success; } );
+
+    o << "{ \"devices\": [";
+    for ( const auto& r: results ) {
+        o << ( &r == &results.front() ? " " : ", " );
+        o << boost::format( "{ \"id\": \"%s\", \"success\": %s, \"staged_us\": %d" )
+            % r.id % ( r.success ? "true" : "false" ) % duration_cast< microseconds >( r.staged ).count();
+        if ( armed )
+            o << boost::format( ", \"sent_us\": %d, \"acked_us\": %d" )
+                % duration_cast< microseconds >( r.sent ).count() % duration_cast< microseconds >( r.acked ).count();
+        if ( r.reverted )
+            o << ", \"reverted\": true";
+        if ( !r.errors.empty() ) {
+            o << ", \"validation\": ";
+            validator::write_json( o, r.errors );
+        }
+        o << " }";
+    }
+    o << boost::format( " ], \"armed\": %s" ) % ( armed ? "true" : "false" );
+
+    if ( !armed ) {
+        // units whose trigger could not be switched off may still be firing
+        std::vector< const commit_result * > not_off;
+        for ( const auto& r: results )
+            if ( !r.off )
+                not_off.push_back( &r );
+        if ( !not_off.empty() ) {
+            o << ", \"trigger_not_off\": [";
+            for ( auto r: not_off )
+                o << ( r == not_off.front() ? " \"" : ", \"" ) << r->id << "\"";
+            o << " ]";
+        }
+    }
+
+    if ( armed ) {
+        // skew: spread of the arm commands on the wire; window: first write to last acknowledge,
+        // which bounds the true arm instants
+        auto sent = std::minmax_element( results.begin(), results.end()
+                                         , []( const commit_result& a, const commit_result& b ){ return a.sent < b.sent; } );
+        auto acked = std::max_element( results.begin(), results.end()
+                                       , []( const commit_result& a, const commit_result& b ){ return a.acked < b.acked; } );
+        o << boost::format( ", \"skew_us\": %d, \"window_us\": %d" )
+            % duration_cast< microseconds >( sent.second->sent - sent.first->sent ).count()
+            % duration_cast< microseconds >( acked->acked - sent.first->sent ).count();
+    }
+    o << " }";
+}
+
+bool
+registry::http_request( const std::string&, const std::string& request_path, std::string& rep )
+{
+    std::ostringstream o;
+
+    if ( request_path == "/dg/all/ctl?devices.json" ) {
+
+        auto ids = this->ids();
+        o << "{ \"default\": \"" << default_id() << "\", \"devices\": [";
+        for ( const auto& id: ids )
+            o << ( &id == &ids.front() ? " \"" : ", \"" ) << id << "\"";
+        o << " ] }";
+
+    } else if ( request_path.compare( 0, 24, "/dg/all/ctl?commit.json=", 24 ) == 0
+                || request_path.compare( 0, 23, "/dg/all/ctl?commit.xml=", 23 ) == 0 ) {
+
+        bool xml = request_path[ 19 ] == 'x';
+        std::string payload( request_path.substr( xml ? 23 : 24 ) );
+        dg::protocols<> protocols;
+        std::vector< validation_error > errors;
+        bool parsed = false;
+
+        try {
+            if ( xml ) {
+                parsed = dg::protocols<>::read_xml( &payload[ 0 ], payload.size(), protocols, errors );
+            } else {
+                std::stringstream json( payload );
+                parsed = dg::protocols<>::read_json( json, protocols, errors );
+            }
+        } catch ( std::exception& e ) {
+            log() << boost::format( "commit to all devices: %1%" ) % e.what();
+        }
+
+        if ( parsed ) {
+            auto results = commit_all( protocols );
+            write_json( o, results );
+            log() << o.str();
+        } else if ( ! errors.empty() ) {
+            validator::write_json( o, errors );
+        } else {
+            o << "Error: malformed protocol";
+        }
+
+    } else {
+
+        o << "registry -- unknown request(" << request_path << ")";
+
+    }
+
+    rep = o.str();
+    return true;
+}
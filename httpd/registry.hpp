@@ -0,0 +1,97 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#pragma once
+
+#include "bnc565.hpp"
+#include "dgprotocols.hpp"
+#include "validator.hpp"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace dg {
+
+    class dgctl;
+
+    // Delay generators served by this process, keyed by id.  Each device has its own
+    // controller and, unless the reactor is shared, its own io_service thread.  The first
+    // device added is the default one, which the unprefixed /dg/ctl routes address;
+    // /dg/<id>/ctl addresses any device and /dg/all/ctl all of them.
+    class registry {
+        registry();
+    public:
+        ~registry();
+        static registry * instance();
+
+        // the device with that id, created on first use
+        bnc565 * add( const std::string& id );
+
+        bnc565 * find( const std::string& id ) const;
+        dgctl * controller( const std::string& id ) const;
+
+        // creates 'dg0' if no device has been added yet
+        const std::string& default_id();
+
+        std::vector< std::string > ids() const;
+
+        struct commit_result {
+            std::string id;
+            bool success;                              // staged, verified and armed
+            bool off;                                  // the trigger off was acknowledged
+            bool reverted;                             // armed, then switched off as another unit failed to arm
+            std::vector< validation_error > errors;     // including fields that did not read back
+            std::chrono::steady_clock::duration staged; // from the start of the apply
+            std::chrono::steady_clock::duration sent;   // arm command written, from the barrier release
+            std::chrono::steady_clock::duration acked;  // arm command acknowledged
+        };
+
+        // Transactional apply.  Every unit switches its trigger off, downloads and reads the
+        // protocol back (re-sending what differs), all in parallel.  Only if all of them verified, each takes its serial
+        // line, waits at a barrier and switches the trigger on; otherwise every trigger stays off.  If a unit then fails
+        // to arm, every trigger is switched off again at emergency priority; a unit whose trigger
+        // could not be switched off, at either stage, has off false.
+        std::vector< commit_result > commit_all( const protocols<>& );
+
+        static void write_json( std::ostream&, const std::vector< commit_result >& );
+
+        // /dg/all/ctl?devices.json, ?commit.json=, ?commit.xml=
+        bool http_request( const std::string& method, const std::string& request_path, std::string& );
+
+    private:
+        struct device {
+            std::string id;
+            std::unique_ptr< bnc565 > dg;
+            std::unique_ptr< dgctl > ctl;
+        };
+        mutable std::mutex mutex_;
+        std::vector< std::unique_ptr< device > > devices_; // in order of addition
+        device * lookup( const std::string& id ) const;
+    };
+
+}
@@ -9,6 +9,7 @@
 //
 
 #include "dgctl.hpp"
+#include "registry.hpp"
 #include "connection.hpp"
 #include "connection_manager.hpp"
 #include "mime_types.hpp"
@@ -43,9 +44,35 @@ request_handler::handle_request( const request& req, reply& rep )
     if ( __verbose_level__ >= 9 )
         std::cerr << "\nhandle_request: " << req.method << "; uri=" << request_path << std::endl;
 
+    // /dg/<id>/ctl?... addresses one device, /dg/all/ctl?... all of them
+    std::string device;
+    if ( request_path.compare( 0, 4, "/dg/", 4 ) == 0 ) {
+        auto slash = request_path.find( '/', 4 );
+        if ( slash != std::string::npos && request_path.compare( slash, 5, "/ctl?", 5 ) == 0 ) {
+            device = request_path.substr( 4, slash - 4 );
+            request_path.erase( 3, slash - 3 );
+        }
+    }
+
+    if ( device == "all" ) {
+
+        dg::registry::instance()->http_request( req.method, "/dg/all" + request_path.substr( 3 ), rep.content );
+        rep.status = reply::ok;
+        rep.headers.push_back( { "Content-Length", std::to_string(rep.content.size()) } );
+        rep.headers.push_back( { "Content-Type", "text/xml" } );
+        return;
+
+    }
+
     if ( request_path.compare( 0, 8, "/dg/ctl?", 8 ) == 0 ) {
 
-        dg::dgctl::instance()->http_request( req.method, request_path, rep.content );
+        auto ctl = device.empty() ? dg::dgctl::instance() : dg::dgctl::instance( device );
+        if ( !ctl ) {
+            rep = reply::stock_reply(reply::not_found);
+            return;
+        }
+
+        ctl->http_request( req.method, request_path, rep.content );
         rep.status = reply::ok;
         
         rep.headers.push_back( { "Content-Length", std::to_string(rep.content.size()) } );
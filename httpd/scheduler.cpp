@@ -0,0 +1,158 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#include "scheduler.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+
+using namespace dg;
+
+scheduler::scheduler() : busy_( false )
+                       , owner_priority_( priority_poll )
+                       , depth_( 0 )
+{
+    head_.fill( 0 );
+    tail_.fill( 0 );
+    resuming_.fill( 0 );
+    std::fill( stats_.begin(), stats_.end(), statistics{ 0, clock_type::duration::zero(), clock_type::duration::zero(), 0 } );
+}
+
+const char *
+scheduler::name( command_priority pri )
+{
+    static const char * names [] = { "emergency", "control", "commit", "poll" };
+    return pri < priority_count ? names[ pri ] : "";
+}
+
+bool
+scheduler::higher_waiting( command_priority pri ) const
+{
+    for ( int q = 0; q < pri; ++q ) {
+        if ( tail_[ q ] != head_[ q ] || resuming_[ q ] )
+            return true;
+    }
+    return false;
+}
+
+void
+scheduler::acquire( command_priority pri )
+{
+    std::unique_lock< std::mutex > lock( mutex_ );
+
+    if ( busy_ && owner_ == std::this_thread::get_id() ) {
+        ++depth_; // nested call from the same batch keeps the outer priority
+        return;
+    }
+
+    auto t0 = clock_type::now();
+    uint64_t ticket = tail_[ pri ]++;
+
+    cond_.wait( lock, [&]{
+            return !busy_ && head_[ pri ] == ticket && resuming_[ pri ] == 0 && !higher_waiting( pri ); } );
+
+    ++head_[ pri ];
+    busy_ = true;
+    owner_ = std::this_thread::get_id();
+    owner_priority_ = pri;
+    depth_ = 1;
+
+    auto wait = clock_type::now() - t0;
+    auto& st = stats_[ pri ];
+    st.count++;
+    st.total_wait += wait;
+    st.max_wait = std::max( st.max_wait, wait );
+}
+
+void
+scheduler::release()
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+
+    if ( !busy_ || owner_ != std::this_thread::get_id() )
+        return;
+
+    if ( --depth_ == 0 ) {
+        busy_ = false;
+        owner_ = std::thread::id();
+        cond_.notify_all();
+    }
+}
+
+void
+scheduler::yield()
+{
+    std::unique_lock< std::mutex > lock( mutex_ );
+
+    if ( !busy_ || owner_ != std::this_thread::get_id() || !higher_waiting( owner_priority_ ) )
+        return;
+
+    auto pri = owner_priority_;
+    auto depth = depth_;
+
+    stats_[ pri ].preempted++;
+
+    // resume ahead of any other waiter in the same class once higher classes drained
+    ++resuming_[ pri ];
+    busy_ = false;
+    owner_ = std::thread::id();
+    cond_.notify_all();
+
+    cond_.wait( lock, [&]{ return !busy_ && !higher_waiting( pri ); } );
+
+    --resuming_[ pri ];
+    busy_ = true;
+    owner_ = std::this_thread::get_id();
+    owner_priority_ = pri;
+    depth_ = depth;
+}
+
+scheduler::statistics
+scheduler::stats( command_priority pri ) const
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+    return stats_[ pri ];
+}
+
+void
+scheduler::write_json( std::ostream& o ) const
+{
+    using namespace std::chrono;
+
+    std::lock_guard< std::mutex > lock( mutex_ );
+
+    o << "{ \"scheduler\": [";
+    for ( int pri = 0; pri < priority_count; ++pri ) {
+        const auto& st = stats_[ pri ];
+        double avg = st.count ? duration_cast< duration< double, std::micro > >( st.total_wait ).count() / st.count : 0;
+        o << ( pri ? ", " : " " )
+          << boost::format( "{ \"class\": \"%s\", \"count\": %d, \"wait_avg_us\": %.1f, \"wait_max_us\": %d, \"preempted\": %d }" )
+            % name( command_priority( pri ) )
+            % st.count
+            % avg
+            % duration_cast< microseconds >( st.max_wait ).count()
+            % st.preempted;
+    }
+    o << " ] }";
+}
@@ -0,0 +1,99 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+namespace dg {
+
+    // smaller value has higher priority
+    enum command_priority {
+        priority_emergency    // trigger off
+        , priority_control    // trigger on, raw command text
+        , priority_commit     // protocol download, reset
+        , priority_poll       // status fetch
+        , priority_count
+    };
+
+    // Grants the serial line to one caller at a time, highest priority class first,
+    // FIFO within a class.  A multi-command batch holds the line for its duration but
+    // yields at each command boundary when a higher priority class is waiting.
+    class scheduler {
+    public:
+        scheduler();
+
+        typedef std::chrono::steady_clock clock_type;
+
+        struct statistics {
+            size_t count;
+            clock_type::duration total_wait;
+            clock_type::duration max_wait;
+            size_t preempted;  // number of times a batch of this class has been yielded
+        };
+
+        void acquire( command_priority );
+        void release();
+
+        // call at a command boundary; hand the line over to a higher priority waiter if any
+        void yield();
+
+        statistics stats( command_priority ) const;
+        void write_json( std::ostream& ) const;
+
+        static const char * name( command_priority );
+
+        class scoped_lock {
+            scheduler& scheduler_;
+        public:
+            scoped_lock( const scoped_lock& ) = delete;
+            scoped_lock& operator = ( const scoped_lock& ) = delete;
+            scoped_lock( scheduler& s, command_priority pri ) : scheduler_( s ) { scheduler_.acquire( pri ); }
+            ~scoped_lock() { scheduler_.release(); }
+        };
+
+    private:
+        mutable std::mutex mutex_;
+        std::condition_variable cond_;
+        bool busy_;
+        command_priority owner_priority_;
+        std::thread::id owner_;
+        size_t depth_;
+        std::array< uint64_t, priority_count > head_;  // next ticket to be served
+        std::array< uint64_t, priority_count > tail_;  // next ticket to be issued
+        std::array< size_t, priority_count > resuming_; // yielded batches waiting to continue
+        std::array< statistics, priority_count > stats_;
+
+        bool higher_waiting( command_priority ) const;
+    };
+
+}
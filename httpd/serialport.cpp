@@ -30,6 +30,13 @@
 #include <boost/system/error_code.hpp>
 #include <boost/system/system_error.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <chrono>
+
+#if !defined WIN32
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
 
 serialport::serialport( boost::asio::io_service& io_service
                         , const char * device_name
@@ -108,6 +115,56 @@ serialport::write( const char * data, std::size_t length, unsigned long microsec
 	return cond_.wait_for( lock, std::chrono::microseconds( microseconds ) ) != std::cv_status::timeout;
 }
 
+bool
+serialport::write_inline( const char * data, std::size_t length, unsigned long microseconds )
+{
+    if ( length == 0 )
+        return false;
+#if !defined WIN32
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds( microseconds );
+    int fd = port_.native_handle();
+    while ( length ) {
+        ssize_t n = ::write( fd, data, length );
+        if ( n > 0 ) {
+            data += n;
+            length -= n;
+            continue;
+        }
+        if ( n < 0 && errno != EAGAIN && errno != EINTR )
+            return false;
+        auto remaining = std::chrono::duration_cast< std::chrono::milliseconds >( deadline - std::chrono::steady_clock::now() );
+        if ( remaining.count() <= 0 )
+            return false;
+        pollfd pfd = { fd, POLLOUT, 0 };
+        ::poll( &pfd, 1, int( remaining.count() ) );
+    }
+    return true;
+#else
+    boost::system::error_code ec;
+    boost::asio::write( port_, boost::asio::buffer( data, length ), ec );
+    return !ec;
+#endif
+}
+
+bool
+serialport::read_inline( unsigned long microseconds )
+{
+#if !defined WIN32
+    int fd = port_.native_handle();
+    pollfd pfd = { fd, POLLIN, 0 };
+    if ( ::poll( &pfd, 1, int( ( microseconds + 999 ) / 1000 ) ) <= 0 )
+        return false;
+    char buf[ 256 ];
+    ssize_t n = ::read( fd, buf, sizeof( buf ) );
+    if ( n <= 0 )
+        return false;
+    dispatch( buf, std::size_t( n ) );
+    return true;
+#else
+    return false;
+#endif
+}
+
 void
 serialport::start()
 {
@@ -137,21 +194,24 @@ serialport::handle_read( const boost::system::error_code& error, std::size_t byt
 {
     if ( !error ) {
         read_buffer_.commit( bytes_transferred );
-        std::istream is( &read_buffer_ );
-        while ( is.good() ) {
-            char c;
-            if ( is.get( c ).good() ) {
-                inbuf_ += c;
-                if ( c == '\r' || c == '\n' ) {
-                    reader_( inbuf_.c_str(), inbuf_.size() );
-                    inbuf_.clear();
-                }
-            }
-        }
+        dispatch( boost::asio::buffer_cast< const char * >( read_buffer_.data() ), read_buffer_.size() );
     }
     initiate_read();
 }
 
+void
+serialport::dispatch( const char * data, std::size_t length )
+{
+    while ( length-- ) {
+        char c = *data++;
+        inbuf_ += c;
+        if ( c == '\r' || c == '\n' ) {
+            reader_( inbuf_.c_str(), inbuf_.size() );
+            inbuf_.clear();
+        }
+    }
+}
+
 void
 serialport::handle_write( const boost::system::error_code& error, std::size_t bytes_transferred )
 {
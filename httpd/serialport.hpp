@@ -47,6 +47,10 @@ public:
     void write ( const char *, std::size_t );
     bool write ( const char *, std::size_t, unsigned long microseconds );
 
+    // single threaded use: complete i/o on the calling thread instead of the io_service
+    bool write_inline( const char *, std::size_t, unsigned long microseconds );
+    bool read_inline( unsigned long microseconds ); // true if any data was passed to the reader
+
     const boost::system::error_code& error_code() const;
     bool is_open() const;
 
@@ -65,5 +69,6 @@ private:
     void handle_timeout( const boost::system::error_code& );
     void handle_read(  const boost::system::error_code&, std::size_t );
     void handle_write( const boost::system::error_code&, std::size_t );
+    void dispatch( const char *, std::size_t );
 };
 
@@ -11,20 +11,52 @@
 #include "server.hpp"
 #include "dgctl.hpp"
 #include <signal.h>
+#include <thread>
 #include <utility>
+#include <vector>
 #include <iostream>
 
 namespace http {
 namespace server {
 
+const std::size_t server::default_max_connections;
+
 server::server(const std::string& address, const std::string& port,
-    const std::string& doc_root)
-  : io_service_(),
+    const std::string& doc_root, std::size_t thread_pool_size,
+    std::size_t max_connections)
+  : thread_pool_size_(thread_pool_size),
+    own_io_service_(new boost::asio::io_service()),
+    io_service_(*own_io_service_),
+    strand_(io_service_),
+    signals_(io_service_),
+    acceptor_(io_service_),
+    connection_manager_(max_connections),
+    socket_(io_service_),
+    request_handler_(doc_root),
+    connection_pool_(std::make_shared<connection_pool>(io_service_, max_connections,
+        connection_manager_, request_handler_))
+{
+  listen(address, port);
+}
+
+server::server(boost::asio::io_service& io_service, const std::string& address,
+    const std::string& port, const std::string& doc_root,
+    std::size_t max_connections)
+  : thread_pool_size_(1),
+    io_service_(io_service),
+    strand_(io_service_),
     signals_(io_service_),
     acceptor_(io_service_),
-    connection_manager_(),
+    connection_manager_(max_connections),
     socket_(io_service_),
-    request_handler_(doc_root)
+    request_handler_(doc_root),
+    connection_pool_(std::make_shared<connection_pool>(io_service_, max_connections,
+        connection_manager_, request_handler_))
+{
+  listen(address, port);
+}
+
+void server::listen(const std::string& address, const std::string& port)
 {
   // Register to handle the signals that indicate when the server should exit.
   // It is safe to register for the same signal multiple times in a program,
@@ -37,6 +69,10 @@ server::server(const std::string& address, const std::string& port,
 
   do_await_stop();
 
+  reply unavailable = reply::stock_reply(reply::service_unavailable);
+  for (const auto& b: unavailable.to_buffers())
+    unavailable_.append(boost::asio::buffer_cast<const char*>(b), boost::asio::buffer_size(b));
+
   // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
   boost::asio::ip::tcp::resolver resolver(io_service_);
   boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve({address, port});
@@ -60,32 +96,53 @@ void server::run()
   // have finished. While the server is running, there is always at least one
   // asynchronous operation outstanding: the asynchronous accept call waiting
   // for new incoming connections.
+  // A request blocked on the serial line (e.g. status fetch) must not hold off
+  // the other clients, so run the io_service from a pool of threads.
+  std::vector<std::thread> threads;
+  for (std::size_t i = 1; i < thread_pool_size_; ++i)
+    threads.emplace_back([this]{ io_service_.run(); });
+
   io_service_.run();
+
+  for (auto& t: threads)
+    t.join();
 }
 
 void server::do_accept()
 {
     acceptor_.async_accept(socket_,
-                           [this](boost::system::error_code ec)  {
+                           strand_.wrap([this](boost::system::error_code ec)  {
                                // Check whether the server was stopped by a signal before this
                                // completion handler had a chance to run.
-                               if (!acceptor_.is_open())   {
+                               if (ec == boost::asio::error::operation_aborted || !acceptor_.is_open())   {
                                    return;
                                }
 
                                if (!ec) {
-                                   connection_manager_.start(
-                                       std::make_shared<connection>(
-                                           std::move(socket_), connection_manager_, request_handler_));
+                                   if (auto c = connection_pool_->acquire(socket_))
+                                       connection_manager_.start(c);
+                                   else
+                                       do_reject();
                                }
 
                                do_accept();
-                           });
+                           }));
+}
+
+void server::do_reject()
+{
+  auto socket = std::make_shared<boost::asio::ip::tcp::socket>(std::move(socket_));
+  boost::asio::async_write(*socket, boost::asio::buffer(unavailable_),
+      [socket](boost::system::error_code, std::size_t)
+      {
+        boost::system::error_code ignored_ec;
+        socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+      });
 }
 
 void server::do_await_stop()
 {
-  signals_.async_wait(
+  signals_.async_wait(strand_.wrap(
       [this](boost::system::error_code /*ec*/, int /*signo*/)
       {
         // The server is stopped by cancelling all outstanding asynchronous
@@ -93,7 +150,12 @@ void server::do_await_stop()
         // call will exit.
         acceptor_.close();
         connection_manager_.stop_all();
-      });
+
+        // A shared io_service also carries the device timers, which never
+        // run out of work.
+        if (!own_io_service_)
+          io_service_.stop();
+      }));
 }
 
 } // namespace server
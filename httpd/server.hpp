@@ -12,9 +12,11 @@
 #define HTTP_SERVER_HPP
 
 #include <boost/asio.hpp>
+#include <memory>
 #include <string>
 #include "connection.hpp"
 #include "connection_manager.hpp"
+#include "connection_pool.hpp"
 #include "request_handler.hpp"
 
 namespace http {
@@ -28,24 +30,50 @@ public:
   server& operator=(const server&) = delete;
 
   /// Construct the server to listen on the specified TCP address and port, and
-  /// serve up files from the given directory.
+  /// serve up files from the given directory.  At most max_connections clients
+  /// are served at a time; others get 503 Service Unavailable.
   explicit server(const std::string& address, const std::string& port,
-      const std::string& doc_root);
+      const std::string& doc_root, std::size_t thread_pool_size = 1,
+      std::size_t max_connections = default_max_connections);
+
+  /// Construct the server on an io_service shared with other components.  The
+  /// caller's thread is the only one to run it.
+  server(boost::asio::io_service& io_service, const std::string& address,
+      const std::string& port, const std::string& doc_root,
+      std::size_t max_connections = default_max_connections);
+
+  static const std::size_t default_max_connections = 64;
 
   /// Run the server's io_service loop.
   void run();
 
 private:
+  /// Set up signal handling and the listening acceptor.
+  void listen(const std::string& address, const std::string& port);
+
   /// Perform an asynchronous accept operation.
   void do_accept();
 
+  /// Answer the accepted socket with 503 and close it.
+  void do_reject();
+
   /// Wait for a request to stop the server.
   void do_await_stop();
 
     void operator () ( const std::string& );
 
+  /// The number of threads that will call io_service::run().
+  std::size_t thread_pool_size_;
+
+  /// The io_service owned by this server, null when it is shared.
+  std::unique_ptr<boost::asio::io_service> own_io_service_;
+
   /// The io_service used to perform asynchronous operations.
-  boost::asio::io_service io_service_;
+  boost::asio::io_service& io_service_;
+
+  /// Serializes the accept completions with the stop handler that closes the
+  /// acceptor; they may otherwise run on two threads of the pool at once.
+  boost::asio::io_service::strand strand_;
 
   /// The signal_set is used to register for process termination notifications.
   boost::asio::signal_set signals_;
@@ -61,6 +89,12 @@ private:
 
   /// The handler for all incoming requests.
   request_handler request_handler_;
+
+  /// Preallocated connections the accepted sockets are handed to.
+  std::shared_ptr<connection_pool> connection_pool_;
+
+  /// The stock 503 reply, written when the pool is exhausted.
+  std::string unavailable_;
 };
 
 } // namespace server
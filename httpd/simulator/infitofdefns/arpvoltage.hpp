@@ -0,0 +1,65 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+// Stand-in for the qtplatz infitofdefns voltage conversions, for the simulator build only.
+// Every channel is a linear 10 mV (10 mA, 0.01 degC) per count scale, so that values
+// round-trip through the simulated registers; these are not the instrument calibrations.
+
+#include <cmath>
+#include <cstdint>
+
+namespace infitof {
+    namespace arp {
+
+        template< typename tag > struct linear_conversion {
+            static double world_value( uint32_t v ) { return v * 0.01; }
+            static uint32_t device_value( double d ) { return d > 0 ? uint32_t( std::lround( d * 100 ) ) : 0; }
+        };
+
+        struct Cfilament : linear_conversion< Cfilament > {};
+        struct Theat20 : linear_conversion< Theat20 > {};
+        struct Theat50 : linear_conversion< Theat50 > {};
+        struct Theat100 : linear_conversion< Theat100 > {};
+        struct Vacc : linear_conversion< Vacc > {};
+        struct Vdet : linear_conversion< Vdet > {};
+        struct Veinzel : linear_conversion< Veinzel > {};
+        struct Vent_in : linear_conversion< Vent_in > {};
+        struct Vent_out : linear_conversion< Vent_out > {};
+        struct Vext_in : linear_conversion< Vext_in > {};
+        struct Vext_out : linear_conversion< Vext_out > {};
+        struct Vionization : linear_conversion< Vionization > {};
+        struct VpressGauge : linear_conversion< VpressGauge > {};
+        struct Vpush : linear_conversion< Vpush > {};
+        struct Vsel_in : linear_conversion< Vsel_in > {};
+        struct Vsel_out : linear_conversion< Vsel_out > {};
+        struct Vtn_in : linear_conversion< Vtn_in > {};
+        struct Vtn_m : linear_conversion< Vtn_m > {};
+        struct Vtn_out : linear_conversion< Vtn_out > {};
+
+    }
+}
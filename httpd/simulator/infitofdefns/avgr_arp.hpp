@@ -0,0 +1,88 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+// Stand-in for the qtplatz infitofdefns ARP register indices, for the simulator build only.
+// Each index addresses one 32-bit register of the HV block (ARP_OFFSET_HV + 4 * index);
+// arpproxy keeps 32 of each.
+
+namespace infitof {
+    namespace arp {
+
+        enum setpt_index {
+            setpt_accVoltage
+            , setpt_aux1
+            , setpt_aux2
+            , setpt_detVoltage
+            , setpt_einzelVoltage
+            , setpt_entInVoltage
+            , setpt_entOutVoltage
+            , setpt_extInVoltage
+            , setpt_extOutVoltage
+            , setpt_filCurrent
+            , setpt_heaterTemp100W
+            , setpt_heaterTemp20W
+            , setpt_heaterTemp50W
+            , setpt_ionVoltage
+            , setpt_pumpValveCtrl
+            , setpt_pushVoltage
+            , setpt_selInVoltage
+            , setpt_selOutVoltage
+            , setpt_stlVoltage
+            , setpt_turnInVoltage
+            , setpt_turnMVoltage
+            , setpt_turnOutVoltage
+        };
+
+        enum act_index {
+            act_accVoltage
+            , act_aux1_alarm
+            , act_aux2_alarm
+            , act_detVoltage
+            , act_devStateMonitor
+            , act_einzelVoltage
+            , act_entInVoltage
+            , act_entOutVoltage
+            , act_extInVoltage
+            , act_extOutVoltage
+            , act_filCurrent
+            , act_guageMonitor
+            , act_heater100WTemp
+            , act_heater20WTemp
+            , act_heater50WTemp
+            , act_ionVoltage
+            , act_pumpValveCtrl
+            , act_pushVoltage
+            , act_selInVoltage
+            , act_selOutVoltage
+            , act_turnInVoltage
+            , act_turnM
+            , act_turnOutVoltage
+        };
+
+    }
+}
@@ -0,0 +1,62 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "usbmanager.hpp"
+
+using namespace dg;
+
+namespace {
+    // the simulator has no device list; any non-null pointer names the one device
+    libusb_device * const simulated_device = reinterpret_cast< libusb_device * >( 1 );
+    libusb_device_handle * const simulated_handle = reinterpret_cast< libusb_device_handle * >( 1 );
+}
+
+bool
+usbmanager::initialize( std::function< void( libusb_device *, libusb_hotplug_event ) > callback )
+{
+    if ( callback )
+        callback( simulated_device, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED );
+    return true;
+}
+
+bool
+usbmanager::usb_open( libusb_device * dev, libusb_device_handle *& handle )
+{
+    handle = dev ? simulated_handle : nullptr;
+    return handle != nullptr;
+}
+
+bool
+usbmanager::usb_claim_interface( libusb_device_handle * handle, int )
+{
+    return handle != nullptr;
+}
+
+void
+usbmanager::usb_close( libusb_device_handle *& handle )
+{
+    handle = nullptr;
+}
@@ -0,0 +1,50 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+// Stand-in for the usbmanager of the device build (linux/drivers), used when arpproxy is
+// built against the simulated EZ-USB/FPGA (ARP_SIMULATOR): the one simulated device is
+// announced on initialize, as libusb announces present devices when a hotplug callback
+// is registered with LIBUSB_HOTPLUG_ENUMERATE.
+
+#include "libusb_mock.hpp"
+#include <functional>
+
+struct libusb_device;
+
+namespace dg {
+
+    class usbmanager {
+    public:
+        bool initialize( std::function< void( libusb_device *, libusb_hotplug_event ) > );
+
+        static bool usb_open( libusb_device *, libusb_device_handle *& );
+        static bool usb_claim_interface( libusb_device_handle *, int interface );
+        static void usb_close( libusb_device_handle *& );
+    };
+
+}
@@ -0,0 +1,130 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#include "ticker.hpp"
+#include "log.hpp"
+#include <boost/format.hpp>
+
+extern int __verbose_level__;
+
+using namespace dg;
+
+ticker::ticker( boost::asio::io_service& io_service
+                , clock_type::duration period ) : timer_( io_service )
+                                                , period_( period.count() )
+                                                , tick_( 0 )
+                                                , deadline_( 0 )
+                                                , missed_( 0 )
+                                                , running_( false )
+                                                , armed_period_( period )
+{
+}
+
+ticker::~ticker()
+{
+    stop();
+}
+
+ticker::clock_type::time_point
+ticker::epoch()
+{
+    static const clock_type::time_point __epoch = clock_type::now();
+    return __epoch;
+}
+
+boost::signals2::connection
+ticker::connect( const tick_handler_t::slot_type& subscriber )
+{
+    return handler_.connect( subscriber );
+}
+
+void
+ticker::start( clock_type::duration holdoff )
+{
+    if ( !running_.exchange( true ) ) {
+        tick_ = 0;
+        deadline_ = 0;
+        arm( clock_type::now() + holdoff );
+    }
+}
+
+void
+ticker::stop()
+{
+    running_ = false;
+    boost::system::error_code ec;
+    timer_.cancel( ec );
+}
+
+void
+ticker::setPeriod( clock_type::duration period )
+{
+    if ( period <= clock_type::duration::zero() ) {
+        log( log::WARN ) << boost::format( "ticker: period %1%ns ignored" ) % std::chrono::duration_cast< std::chrono::nanoseconds >( period ).count();
+        return;
+    }
+    period_ = period.count();
+}
+
+ticker::clock_type::duration
+ticker::period() const
+{
+    return clock_type::duration( period_.load() );
+}
+
+void
+ticker::arm( clock_type::time_point now )
+{
+    auto period = this->period();
+
+    // next period boundary after now, counted from the epoch
+    size_t next = size_t( ( now - epoch() ) / period ) + 1;
+    if ( deadline_ && period == armed_period_ && next > deadline_ + 1 ) {
+        auto skipped = next - deadline_ - 1;
+        missed_ += skipped;
+        if ( __verbose_level__ >= log::INFO )
+            log( log::WARN ) << boost::format( "ticker: %1% deadline(s) missed after tick %2%" ) % skipped % tick_;
+    }
+    deadline_ = next;
+    armed_period_ = period;
+
+    timer_.expires_at( epoch() + period * next );
+    timer_.async_wait( [this]( const boost::system::error_code& ec ){ on_timer( ec ); } );
+}
+
+void
+ticker::on_timer( const boost::system::error_code& ec )
+{
+    if ( ec == boost::asio::error::operation_aborted || !running_ )
+        return;
+
+    auto now = clock_type::now();
+    jitter_.add( now - timer_.expires_at() );
+
+    handler_( ++tick_ );
+
+    if ( running_ )
+        arm( clock_type::now() );
+}
@@ -0,0 +1,84 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#pragma once
+
+#include "histogram.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/signals2.hpp>
+
+namespace dg {
+
+    // Periodic timer on absolute deadlines epoch + n * period.  Handler run time does
+    // not accumulate as drift, and tickers sharing the process wide epoch stay phase
+    // locked when their periods are multiples of each other.  A tick that falls due
+    // while the previous one is still running is counted as missed and skipped.  The
+    // tick number passed to the handler counts this ticker's ticks since start(), from 1.
+    class ticker {
+    public:
+        typedef std::chrono::steady_clock clock_type;
+        typedef boost::signals2::signal< void( size_t tick ) > tick_handler_t;
+
+        ticker( boost::asio::io_service&, clock_type::duration period );
+        ~ticker();
+
+        boost::signals2::connection connect( const tick_handler_t::slot_type& );
+
+        // the first tick is the first deadline after holdoff
+        void start( clock_type::duration holdoff = clock_type::duration::zero() );
+        void stop();
+
+        // takes effect from the next deadline; a period that is not positive is ignored
+        void setPeriod( clock_type::duration );
+        clock_type::duration period() const;
+
+        size_t tick() const { return tick_; }
+        size_t missed() const { return missed_; }
+
+        // lateness of each handler invocation against its deadline
+        const histogram& jitter() const { return jitter_; }
+
+        static clock_type::time_point epoch();
+
+    private:
+        boost::asio::steady_timer timer_;
+        std::atomic< clock_type::rep > period_;
+        std::atomic< size_t > tick_;
+        size_t deadline_;             // periods since the epoch of the armed deadline
+        std::atomic< size_t > missed_;
+        std::atomic< bool > running_;
+        clock_type::duration armed_period_;
+        tick_handler_t handler_;
+        histogram jitter_;
+
+        void arm( clock_type::time_point now );
+        void on_timer( const boost::system::error_code& );
+    };
+
+}
@@ -0,0 +1,342 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#include "usb_reactor.hpp"
+#include "log.hpp"
+#include <boost/format.hpp>
+#if defined __linux__ && HAS_LIBUSB
+#  include <libusb-1.0/libusb.h>
+#else
+#  include "libusb_mock.hpp"
+#endif
+#include <poll.h>
+#include <vector>
+
+using namespace dg;
+
+namespace {
+
+    int status_code( const libusb_transfer * t )
+    {
+        switch ( t->status ) {
+        case LIBUSB_TRANSFER_COMPLETED: return 0;
+        case LIBUSB_TRANSFER_TIMED_OUT: return LIBUSB_ERROR_TIMEOUT;
+        case LIBUSB_TRANSFER_STALL:     return LIBUSB_ERROR_PIPE;
+        case LIBUSB_TRANSFER_OVERFLOW:  return LIBUSB_ERROR_OVERFLOW;
+        case LIBUSB_TRANSFER_NO_DEVICE: return LIBUSB_ERROR_NO_DEVICE;
+        case LIBUSB_TRANSFER_CANCELLED: return LIBUSB_ERROR_INTERRUPTED;
+        default:                        return LIBUSB_ERROR_IO;
+        }
+    }
+
+}
+
+usb_reactor::usb_reactor( boost::asio::io_service& io_service
+                          , libusb_context * context
+                          , size_t max_in_flight ) : io_service_( io_service )
+                                                   , strand_( io_service )
+                                                   , context_( context )
+                                                   , max_in_flight_( max_in_flight )
+                                                   , timer_( io_service )
+                                                   , timeouts_by_fd_( libusb_pollfds_handle_timeouts( context ) != 0 )
+                                                   , closing_( false )
+{
+    libusb_set_pollfd_notifiers( context_, &usb_reactor::on_pollfd_added, &usb_reactor::on_pollfd_removed, this );
+
+    if ( const libusb_pollfd ** fds = libusb_get_pollfds( context_ ) ) {
+        for ( auto p = fds; *p; ++p ) {
+            int fd = (*p)->fd;
+            short events = (*p)->events;
+            strand_.post( [=]{ watch( fd, events ); } );
+        }
+        libusb_free_pollfds( fds );
+    }
+    strand_.post( [this]{ arm_timeout(); } );
+}
+
+usb_reactor::~usb_reactor()
+{
+    closing_ = true;
+
+    do {
+        std::lock_guard< std::mutex > lock( mutex_ );
+        for ( auto& ep: endpoints_ )
+            for ( auto& t: ep.second.submitted )
+                libusb_cancel_transfer( t.first );
+    } while ( 0 );
+
+    // cancelled transfers still complete through our callback
+    while ( in_flight() ) {
+        timeval tv = { 0, 100000 };
+        libusb_handle_events_timeout_completed( context_, &tv, nullptr );
+    }
+
+    libusb_set_pollfd_notifiers( context_, nullptr, nullptr, nullptr );
+
+    boost::system::error_code ec;
+    timer_.cancel( ec );
+    for ( auto& d: descriptors_ ) {
+        d.second->cancel( ec );
+        d.second->release(); // owned by libusb
+    }
+}
+
+void
+usb_reactor::async_bulk_transfer( libusb_device_handle * handle, unsigned char endpoint
+                                  , uint8_t * data, int length, unsigned int timeout, handler_type handler )
+{
+    enqueue( request{ handle, endpoint, data, length, timeout, std::move( handler ), false } );
+}
+
+int
+usb_reactor::bulk_transfer( libusb_device_handle * handle, unsigned char endpoint
+                            , uint8_t * data, int length, int& transferred, unsigned int timeout )
+{
+    int completed = 0;
+    int status = LIBUSB_ERROR_IO;
+
+    enqueue( request{ handle, endpoint, data, length, timeout
+                , [&]( int s, int n ){ status = s; transferred = n; completed = 1; }, true } );
+
+    while ( !completed ) {
+        int rc = libusb_handle_events_completed( context_, &completed );
+        if ( rc < 0 && rc != LIBUSB_ERROR_INTERRUPTED ) {
+            log( log::ERR ) << boost::format( "usb_reactor: %1%" ) % libusb_error_name( rc );
+            cancel( handle );
+        }
+    }
+    return status;
+}
+
+void
+usb_reactor::cancel( libusb_device_handle * handle )
+{
+    std::unique_lock< std::mutex > lock( mutex_ );
+
+    std::vector< request > dropped;
+    for ( auto& ep: endpoints_ ) {
+        if ( ep.first.first != handle )
+            continue;
+        for ( auto& t: ep.second.submitted )
+            libusb_cancel_transfer( t.first );
+        for ( auto& r: ep.second.pending )
+            dropped.push_back( std::move( r ) );
+        ep.second.pending.clear();
+    }
+    lock.unlock();
+
+    for ( auto& r: dropped ) {
+        if ( r.direct )
+            r.handler( LIBUSB_ERROR_INTERRUPTED, 0 );
+        else
+            strand_.post( [r]{ r.handler( LIBUSB_ERROR_INTERRUPTED, 0 ); } );
+    }
+}
+
+size_t
+usb_reactor::in_flight() const
+{
+    std::lock_guard< std::mutex > lock( mutex_ );
+    size_t n = 0;
+    for ( const auto& ep: endpoints_ )
+        n += ep.second.submitted.size();
+    return n;
+}
+
+void
+usb_reactor::enqueue( request&& r )
+{
+    endpoint_key key( r.handle, r.endpoint );
+
+    std::unique_lock< std::mutex > lock( mutex_ );
+    endpoints_[ key ].pending.push_back( std::move( r ) );
+    submit_pending( key, lock );
+}
+
+void
+usb_reactor::submit_pending( endpoint_key key, std::unique_lock< std::mutex >& lock )
+{
+    auto it = endpoints_.find( key );
+    if ( it == endpoints_.end() )
+        return;
+
+    auto& q = it->second;
+    std::vector< std::pair< request, int > > failed;
+
+    while ( q.submitted.size() < max_in_flight_ && !q.pending.empty() ) {
+        request r = std::move( q.pending.front() );
+        q.pending.pop_front();
+
+        libusb_transfer * t = libusb_alloc_transfer( 0 );
+        libusb_fill_bulk_transfer( t, r.handle, r.endpoint, r.data, r.length, &usb_reactor::on_transfer, this, r.timeout );
+        if ( int rc = libusb_submit_transfer( t ) ) {
+            libusb_free_transfer( t );
+            failed.emplace_back( std::move( r ), rc );
+        } else {
+            q.submitted.emplace( t, std::move( r ) );
+        }
+    }
+
+    if ( q.submitted.empty() && q.pending.empty() )
+        endpoints_.erase( it );
+
+    if ( !timeouts_by_fd_ )
+        strand_.post( [this]{ arm_timeout(); } );
+
+    if ( failed.empty() )
+        return;
+
+    lock.unlock();
+    for ( auto& f: failed ) {
+        if ( f.first.direct )
+            f.first.handler( f.second, 0 );
+        else {
+            auto handler = std::move( f.first.handler );
+            int rc = f.second;
+            strand_.post( [handler, rc]{ handler( rc, 0 ); } );
+        }
+    }
+    lock.lock();
+}
+
+void
+usb_reactor::complete( libusb_transfer * t )
+{
+    int status = status_code( t );
+    int transferred = t->actual_length;
+    endpoint_key key( t->dev_handle, t->endpoint );
+
+    std::unique_lock< std::mutex > lock( mutex_ );
+
+    request r;
+    auto it = endpoints_.find( key );
+    if ( it != endpoints_.end() ) {
+        auto sit = it->second.submitted.find( t );
+        if ( sit != it->second.submitted.end() ) {
+            r = std::move( sit->second );
+            it->second.submitted.erase( sit );
+        }
+    }
+    libusb_free_transfer( t );
+
+    submit_pending( key, lock );
+    lock.unlock();
+
+    if ( !r.handler )
+        return;
+
+    if ( r.direct )
+        r.handler( status, transferred );
+    else
+        strand_.post( [r, status, transferred]{ r.handler( status, transferred ); } );
+}
+
+void
+usb_reactor::watch( int fd, short events )
+{
+    if ( closing_ )
+        return;
+
+    auto sd = std::make_shared< boost::asio::posix::stream_descriptor >( io_service_, fd );
+    descriptors_[ fd ] = sd;
+
+    if ( events & POLLIN )
+        wait( sd, fd, false );
+    if ( events & POLLOUT ) // usbfs signals reaped URBs as writable
+        wait( sd, fd, true );
+}
+
+void
+usb_reactor::unwatch( int fd )
+{
+    auto it = descriptors_.find( fd );
+    if ( it != descriptors_.end() ) {
+        boost::system::error_code ec;
+        it->second->cancel( ec );
+        it->second->release();
+        descriptors_.erase( it );
+    }
+}
+
+void
+usb_reactor::wait( std::shared_ptr< boost::asio::posix::stream_descriptor > sd, int fd, bool write )
+{
+    auto handler = strand_.wrap( [=]( const boost::system::error_code& ec, std::size_t ){
+            if ( ec || closing_ )
+                return;
+            handle_events();
+            auto it = descriptors_.find( fd );
+            if ( it != descriptors_.end() && it->second == sd )
+                wait( sd, fd, write );
+        });
+
+    if ( write )
+        sd->async_write_some( boost::asio::null_buffers(), handler );
+    else
+        sd->async_read_some( boost::asio::null_buffers(), handler );
+}
+
+void
+usb_reactor::handle_events()
+{
+    timeval zero = { 0, 0 };
+    libusb_handle_events_timeout_completed( context_, &zero, nullptr );
+    if ( !timeouts_by_fd_ )
+        arm_timeout();
+}
+
+void
+usb_reactor::arm_timeout()
+{
+    timeval tv;
+    if ( timeouts_by_fd_ || closing_ || libusb_get_next_timeout( context_, &tv ) != 1 )
+        return;
+
+    timer_.expires_from_now( std::chrono::seconds( tv.tv_sec ) + std::chrono::microseconds( tv.tv_usec ) );
+    timer_.async_wait( strand_.wrap( [this]( const boost::system::error_code& ec ){
+                if ( !ec && !closing_ )
+                    handle_events();
+            }) );
+}
+
+void
+usb_reactor::on_transfer( libusb_transfer * t )
+{
+    reinterpret_cast< usb_reactor * >( t->user_data )->complete( t );
+}
+
+void
+usb_reactor::on_pollfd_added( int fd, short events, void * user_data )
+{
+    auto self = reinterpret_cast< usb_reactor * >( user_data );
+    self->strand_.post( [=]{ self->watch( fd, events ); } );
+}
+
+void
+usb_reactor::on_pollfd_removed( int fd, void * user_data )
+{
+    auto self = reinterpret_cast< usb_reactor * >( user_data );
+    self->strand_.post( [=]{ self->unwatch( fd ); } );
+}
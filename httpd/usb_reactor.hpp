@@ -0,0 +1,116 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+struct libusb_context;
+struct libusb_device_handle;
+struct libusb_transfer;
+
+namespace dg {
+
+    // Runs libusb event handling from an io_service: libusb's pollfds are watched as
+    // posix descriptors and its timeouts by a steady_timer, so no thread blocks in
+    // libusb_handle_events.  Transfers are queued per endpoint in submission order
+    // with up to max_in_flight of them submitted at once; replies on an IN endpoint
+    // therefore match the order of the commands on its OUT endpoint.
+    class usb_reactor {
+    public:
+        // status is a libusb_error code as returned by libusb_bulk_transfer
+        typedef std::function< void( int status, int transferred ) > handler_type;
+
+        usb_reactor( boost::asio::io_service&, libusb_context * = nullptr, size_t max_in_flight = 8 );
+        ~usb_reactor();
+
+        // data must stay valid until the handler has been called on the strand
+        void async_bulk_transfer( libusb_device_handle *, unsigned char endpoint
+                                  , uint8_t * data, int length, unsigned int timeout, handler_type );
+
+        // synchronous transfer through the same endpoint queue; libusb events are
+        // handled on the calling thread until it completes
+        int bulk_transfer( libusb_device_handle *, unsigned char endpoint
+                           , uint8_t * data, int length, int& transferred, unsigned int timeout );
+
+        // cancel everything queued or in flight for a device (detach)
+        void cancel( libusb_device_handle * );
+
+        size_t in_flight() const;
+
+    private:
+        struct request {
+            libusb_device_handle * handle;
+            unsigned char endpoint;
+            uint8_t * data;
+            int length;
+            unsigned int timeout;
+            handler_type handler;
+            bool direct;     // call handler from the libusb callback, not on the strand
+        };
+
+        struct endpoint_queue {
+            std::map< libusb_transfer *, request > submitted;
+            std::deque< request > pending;
+        };
+
+        typedef std::pair< libusb_device_handle *, unsigned char > endpoint_key;
+
+        boost::asio::io_service& io_service_;
+        boost::asio::io_service::strand strand_;
+        libusb_context * context_;
+        const size_t max_in_flight_;
+        mutable std::mutex mutex_;
+        std::map< endpoint_key, endpoint_queue > endpoints_;
+        std::map< int, std::shared_ptr< boost::asio::posix::stream_descriptor > > descriptors_;
+        boost::asio::steady_timer timer_;
+        bool timeouts_by_fd_; // libusb exposes its timeouts as a timerfd among the pollfds
+        std::atomic< bool > closing_;
+
+        void enqueue( request&& );
+        void submit_pending( endpoint_key, std::unique_lock< std::mutex >& );
+        void complete( libusb_transfer * );
+
+        void watch( int fd, short events );
+        void unwatch( int fd );
+        void wait( std::shared_ptr< boost::asio::posix::stream_descriptor >, int fd, bool write );
+        void handle_events();
+        void arm_timeout();
+
+        static void on_transfer( libusb_transfer * );
+        static void on_pollfd_added( int fd, short events, void * );
+        static void on_pollfd_removed( int fd, void * );
+    };
+
+}
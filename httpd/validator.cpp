@@ -0,0 +1,136 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "validator.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <string>
+
+using namespace dg;
+
+validator::validator() : validator( t0() )
+{
+}
+
+validator::validator( const sync_type& sync ) : sync_( sync )
+                                              , loop_( 0 )
+{
+    // depth along the sync chain; a chain longer than the channel count is a loop
+    std::array< size_t, delay_pulse_count > depth;
+
+    for ( size_t ch = 0; ch < delay_pulse_count; ++ch ) {
+        size_t n = 0;
+        int src = sync_[ ch ];
+        while ( src >= 0 && src < int( delay_pulse_count ) && n <= delay_pulse_count ) {
+            src = sync_[ src ];
+            ++n;
+        }
+        if ( n > delay_pulse_count )
+            loop_ |= 1u << ch;
+        depth[ ch ] = n;
+    }
+
+    for ( size_t ch = 0; ch < delay_pulse_count; ++ch )
+        order_[ ch ] = int( ch );
+    std::stable_sort( order_.begin(), order_.end(), [&]( int a, int b ){ return depth[ a ] < depth[ b ]; } );
+}
+
+validator::sync_type
+validator::t0()
+{
+    sync_type sync;
+    sync.fill( -1 );
+    return sync;
+}
+
+bool
+validator::operator()( const protocols<>& protocols, std::vector< validation_error >& errors ) const
+{
+    size_t count = errors.size();
+    const tick_type interval = protocols.interval_ticks();
+
+    if ( interval <= 0 )
+        errors.push_back( { -1, -1, invalid_interval, interval } );
+
+    if ( protocols.size() == 0 )
+        errors.push_back( { -1, -1, no_protocol, 0 } );
+
+    int index = 0;
+    for ( const auto& p: protocols ) {
+
+        std::array< tick_type, delay_pulse_count > start;
+
+        for ( int ch: order_ ) {
+            int src = sync_[ ch ];
+            if ( loop_ & ( 1u << ch ) )
+                start[ ch ] = 0; // reported below
+            else
+                start[ ch ] = p.delay_ticks( ch ) + ( src >= 0 && src < int( delay_pulse_count ) ? start[ src ] : 0 );
+        }
+
+        uint32_t mask = kernel::out_of_range( start.data(), p.width_ticks().data(), delay_pulse_count, interval ) | loop_;
+
+        for ( size_t ch = 0; mask && ch < delay_pulse_count; ++ch ) {
+            if ( !( mask & ( 1u << ch ) ) )
+                continue;
+            if ( loop_ & ( 1u << ch ) ) {
+                errors.push_back( { index, int( ch ), sync_loop, 0 } );
+                continue;
+            }
+            if ( p.width_ticks( ch ) < 1 )
+                errors.push_back( { index, int( ch ), invalid_width, p.width_ticks( ch ) } );
+            if ( start[ ch ] < 0 )
+                errors.push_back( { index, int( ch ), starts_before_t0, start[ ch ] } );
+            else if ( interval > 0 && start[ ch ] + p.width_ticks( ch ) > interval )
+                errors.push_back( { index, int( ch ), exceeds_period, start[ ch ] + p.width_ticks( ch ) } );
+        }
+        ++index;
+    }
+
+    return errors.size() == count;
+}
+
+const char *
+validator::name( validation_code code )
+{
+    static const char * names [] = { "invalid_interval", "invalid_width", "starts_before_t0", "exceeds_period", "sync_loop", "readback_mismatch", "no_protocol", "write_failed", "invalid_value" };
+    return names[ code ];
+}
+
+// times in microseconds, same as status.json, with "unit": "us"; flags as 0 or 1
+void
+validator::write_json( std::ostream& o, const std::vector< validation_error >& errors )
+{
+    o << "{ \"errors\": [";
+    for ( const auto& e: errors ) {
+        o << ( &e == &errors.front() ? " " : ", " )
+          << boost::format( "{ \"protocol\": %d, \"ch\": %d, \"code\": \"%s\", \"value\": %s%s }" )
+            % e.protocol % e.channel % name( e.code )
+            % ( e.kind == flag_value ? std::to_string( e.value ) : format_ticks( e.value, microseconds_digits ) )
+            % ( e.kind == flag_value ? "" : ", \"unit\": \"us\"" );
+    }
+    o << " ] }";
+}
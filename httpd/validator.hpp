@@ -0,0 +1,85 @@
+// -*- C++ -*-
+/**************************************************************************
+** Copyright (C) 2017 Toshinobu Hondo, Ph.D.
+** Copyright (C) 2017 MS-Cheminformatics LLC
+*
+** Contact: toshi.hondo@scienceliaison.com
+**
+** Commercial Usage
+**
+** Licensees holding valid ScienceLiaison commercial licenses may use this
+** file in accordance with the ScienceLiaison Commercial License Agreement
+** provided with the Software or, alternatively, in accordance with the terms
+** contained in a written agreement between you and ScienceLiaison.
+**
+** GNU Lesser General Public License Usage
+**
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.TXT included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include "dgprotocols.hpp"
+#include <array>
+#include <ostream>
+#include <vector>
+
+namespace dg {
+
+    enum validation_code {
+        invalid_interval     // period is zero or negative
+        , invalid_width      // width below one tick
+        , starts_before_t0   // delay, summed along the sync chain, is negative
+        , exceeds_period     // pulse ends after the period
+        , sync_loop          // sync chain does not lead back to T0
+        , readback_mismatch  // the device still reports another value after a re-send
+        , no_protocol        // the table list is empty
+        , write_failed       // the device did not acknowledge the write
+        , invalid_value      // not a number, or beyond max_seconds; value is 0
+    };
+
+    enum value_kind {
+        ticks_value          // a time in device ticks
+        , flag_value         // 0 or 1: a channel state, polarity or the trigger
+    };
+
+    struct validation_error {
+        int protocol;        // index in protocols<>
+        int channel;         // -1 for the interval
+        validation_code code;
+        tick_type value;     // the offending interval, width, start or end; or a flag
+        value_kind kind = ticks_value;
+    };
+
+    // Checks a protocol table against the device timing model before any serial
+    // traffic: each channel starts at its delay past the start of its sync source,
+    // and must end within the period.
+    class validator {
+    public:
+        // sync source per channel; -1 for T0
+        typedef std::array< int, delay_pulse_count > sync_type;
+
+        validator();
+        explicit validator( const sync_type& );
+
+        static sync_type t0(); // every channel synchronized to T0
+
+        bool operator()( const protocols<>&, std::vector< validation_error >& ) const;
+
+        static const char * name( validation_code );
+        static void write_json( std::ostream&, const std::vector< validation_error >& );
+
+    private:
+        sync_type sync_;
+        std::array< int, delay_pulse_count > order_; // sources before dependents
+        uint32_t loop_;                              // channels on or below a sync loop
+    };
+
+}
@@ -0,0 +1,221 @@
+//
+// websocket.cpp
+// ~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "websocket.hpp"
+#include "request.hpp"
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/archive/iterators/base64_from_binary.hpp>
+#include <boost/archive/iterators/transform_width.hpp>
+#include <boost/uuid/detail/sha1.hpp>
+#include <algorithm>
+#include <cstdint>
+
+namespace http {
+namespace server {
+namespace websocket {
+
+namespace {
+
+const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+std::string header_value(const request& req, const char* name)
+{
+    auto it = std::find_if(req.headers.begin(), req.headers.end(), [&](const header& h) {
+            return boost::iequals(h.name, name); });
+    return it != req.headers.end() ? it->value : std::string();
+}
+
+} // namespace
+
+bool is_upgrade(const request& req)
+{
+    return req.method == "GET"
+        && boost::iequals(header_value(req, "Upgrade"), "websocket")
+        && boost::icontains(header_value(req, "Connection"), "upgrade")
+        && !header_value(req, "Sec-WebSocket-Key").empty();
+}
+
+std::string accept_key(const std::string& client_key)
+{
+    boost::uuids::detail::sha1 sha1;
+    std::string key = client_key + guid;
+    sha1.process_bytes(key.data(), key.size());
+
+    unsigned int digest[5];
+    sha1.get_digest(digest);
+
+    unsigned char bytes[20];
+    for (int i = 0; i < 5; ++i) {
+        bytes[i * 4]     = (digest[i] >> 24) & 0xff;
+        bytes[i * 4 + 1] = (digest[i] >> 16) & 0xff;
+        bytes[i * 4 + 2] = (digest[i] >> 8) & 0xff;
+        bytes[i * 4 + 3] = digest[i] & 0xff;
+    }
+
+    using namespace boost::archive::iterators;
+    typedef base64_from_binary<transform_width<const unsigned char*, 6, 8> > base64;
+
+    std::string encoded(base64(bytes), base64(bytes + sizeof(bytes)));
+    encoded.append((3 - sizeof(bytes) % 3) % 3, '=');
+    return encoded;
+}
+
+std::string handshake(const request& req)
+{
+    return "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: " + accept_key(header_value(req, "Sec-WebSocket-Key")) + "\r\n"
+        "\r\n";
+}
+
+std::shared_ptr<const std::string> encode(opcode op, const std::string& payload)
+{
+    auto frame = std::make_shared<std::string>();
+    frame->reserve(payload.size() + 10);
+
+    frame->push_back(char(0x80 | op)); // FIN
+    uint64_t size = payload.size();
+    if (size < 126) {
+        frame->push_back(char(size));
+    } else if (size <= 0xffff) {
+        frame->push_back(char(126));
+        for (int shift = 8; shift >= 0; shift -= 8)
+            frame->push_back(char((size >> shift) & 0xff));
+    } else {
+        frame->push_back(char(127));
+        for (int shift = 56; shift >= 0; shift -= 8)
+            frame->push_back(char((size >> shift) & 0xff));
+    }
+    frame->append(payload);
+    return frame;
+}
+
+decoder::decoder()
+    : message_opcode_(text), fragmented_(false), close_code_(0)
+{
+}
+
+void decoder::append(const char* begin, const char* end)
+{
+    if (!close_code_)
+        buffer_.append(begin, end);
+}
+
+decoder::result_type decoder::next(opcode& op, std::string& payload)
+{
+    if (close_code_)
+        return bad;
+
+    for (;;) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(buffer_.data());
+        std::size_t avail = buffer_.size();
+
+        if (avail < 2)
+            return indeterminate;
+
+        bool fin = p[0] & 0x80;
+        opcode frame_op = opcode(p[0] & 0x0f);
+        bool masked = p[1] & 0x80;
+        uint64_t size = p[1] & 0x7f;
+        std::size_t offset = 2;
+
+        if (!masked) // clients must mask every frame
+            return fail(1002);
+
+        if (p[0] & 0x70) // RSV1-3; no extension is negotiated
+            return fail(1002);
+
+        bool control = frame_op & 0x08;
+        switch (frame_op) {
+        case continuation:
+            if (!fragmented_) // nothing to continue
+                return fail(1002);
+            break;
+        case text:
+        case binary:
+            if (fragmented_) // the partial message must be finished first
+                return fail(1002);
+            break;
+        case close:
+        case ping:
+        case pong:
+            if (!fin || size > 125)
+                return fail(1002);
+            break;
+        default: // reserved
+            return fail(1002);
+        }
+
+        if (size == 126) {
+            if (avail < offset + 2)
+                return indeterminate;
+            size = (uint64_t(p[2]) << 8) | p[3];
+            offset += 2;
+        } else if (size == 127) {
+            if (avail < offset + 8)
+                return indeterminate;
+            if (p[2] & 0x80) // the most significant bit must be 0
+                return fail(1002);
+            size = 0;
+            for (int i = 0; i < 8; ++i)
+                size = (size << 8) | p[2 + i];
+            offset += 8;
+        }
+
+        // the length is the client's; compare before adding anything to it
+        if (size > max_message_size || size > max_message_size - message_.size())
+            return fail(1009);
+
+        if (avail < offset + 4 + size)
+            return indeterminate;
+
+        const unsigned char* mask = p + offset;
+        offset += 4;
+
+        std::string data(size, '\0');
+        for (std::size_t i = 0; i < size; ++i)
+            data[i] = char(p[offset + i] ^ mask[i % 4]);
+
+        buffer_.erase(0, offset + std::size_t(size));
+
+        if (control) {
+            op = frame_op;
+            payload.swap(data);
+            return good;
+        }
+
+        if (frame_op == continuation) {
+            message_.append(data);
+        } else {
+            message_opcode_ = frame_op;
+            message_.swap(data);
+        }
+        fragmented_ = !fin;
+
+        if (fin) {
+            op = message_opcode_;
+            payload.swap(message_);
+            message_.clear();
+            return good;
+        }
+    }
+}
+
+decoder::result_type decoder::fail(unsigned short code)
+{
+    close_code_ = code;
+    buffer_.clear();
+    message_.clear();
+    fragmented_ = false;
+    return bad;
+}
+
+} // namespace websocket
+} // namespace server
+} // namespace http
@@ -0,0 +1,89 @@
+//
+// websocket.hpp
+// ~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_WEBSOCKET_HPP
+#define HTTP_WEBSOCKET_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace http {
+namespace server {
+
+struct request;
+
+/// RFC 6455 framing for the server side of a WebSocket connection.
+namespace websocket {
+
+enum opcode
+{
+    continuation = 0x0,
+    text = 0x1,
+    binary = 0x2,
+    close = 0x8,
+    ping = 0x9,
+    pong = 0xa
+};
+
+/// True if the request asks for a protocol switch to websocket.
+bool is_upgrade(const request& req);
+
+/// The Sec-WebSocket-Accept value for the client's Sec-WebSocket-Key.
+std::string accept_key(const std::string& client_key);
+
+/// The 101 Switching Protocols response for an upgrade request.
+std::string handshake(const request& req);
+
+/// Encode a single unmasked, final frame.
+std::shared_ptr<const std::string> encode(opcode op, const std::string& payload);
+
+/// Incremental decoder for masked client frames.  Fragmented messages are
+/// reassembled; control frames may arrive in between and are returned at once.
+class decoder
+{
+public:
+    decoder();
+
+    /// Result of next.
+    enum result_type { good, bad, indeterminate };
+
+    /// Append received bytes.
+    void append(const char* begin, const char* end);
+
+    /// Extract the next complete message.  Returns indeterminate when more data
+    /// is required, bad on a protocol violation or an oversized message; once
+    /// bad, further data is discarded.  Violations (RFC 6455 5.2, 5.4) are an
+    /// unmasked frame, RSV bits without an extension, a reserved opcode, a
+    /// fragmented or oversized control frame, a continuation with no message
+    /// started and a new data frame inside a fragmented message.
+    result_type next(opcode& op, std::string& payload);
+
+    /// The status code to close with after next returned bad: 1002 for a
+    /// protocol error, 1009 for a message above max_message_size.
+    unsigned short close_code() const { return close_code_; }
+
+    /// Largest message accepted.
+    static const std::size_t max_message_size = 64 * 1024;
+
+private:
+    result_type fail(unsigned short code);
+
+    std::string buffer_;
+    std::string message_;
+    opcode message_opcode_;
+    bool fragmented_; // a non-final data frame has been received
+    unsigned short close_code_;
+};
+
+} // namespace websocket
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_WEBSOCKET_HPP